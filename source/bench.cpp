@@ -0,0 +1,180 @@
+/*
+ KSolve+ - Puzzle solving program.
+ Copyright (C) 2007-2013 Kre Krig and Michael Gottlieb
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+// Benchmark of building pruning tables, loading them and solving, over a
+// fixed set of the bundled puzzles with fixed and seeded random scrambles,
+// so that runs can be compared with each other. Build with "make bench"
+// and run as "bench [puzzle-directory] [--seed n] [--threads n]", or run
+// all of it with "make benchmark".
+
+#define KSOLVE_NO_MAIN
+#include "main.cpp"
+
+static const char *BENCH_FORMAT = "2"; // changes when the lines printed change meaning
+
+// A puzzle of the suite and the scrambles it is solved for
+struct benchCase {
+	const char *def;
+	const char *scrambles;
+};
+
+static const benchCase BENCH_CASES[] = {
+	{"2x2x2.def",
+		"ScrambleAlg Jperm\nR U R' F' R U R' U' R' F R2 U' R' U'\nEnd\n"
+		"RandomScramble r1\nEnd\nRandomScramble r2\nEnd\nRandomScramble r3\nEnd\nRandomScramble r4\nEnd\n"},
+	{"Pyraminx.def",
+		"RandomScramble r1\nEnd\nRandomScramble r2\nEnd\nRandomScramble r3\nEnd\nRandomScramble r4\nEnd\n"},
+	{"UFO.def",
+		"RandomScramble r1\nEnd\nRandomScramble r2\nEnd\n"},
+	{"Helicopter_Cube_3gen.def",
+		"RandomScramble r1\nEnd\nRandomScramble r2\nEnd\n"},
+	{"Bicube.def",
+		"Scramble 3-cycle\nCORNERS\n1 4 3 5 2 6 7 8\n0 1 0 1 1 0 0 0\nEDGES\n4 2 3 5 1 6 7 8 9 10 11\n1 0 0 0 1 0 0 0 0 0 0\n"
+		"UCENTER\n1\n0\nFCENTER\n1\n0\nRCENTER\n1\n0\nLCENTER\n1\n0\nEnd\n"},
+	{"Megaminx_RU.def",
+		"Scramble Aperm\nEDGES\n1 2 3 4 5 6 7 8 9\nCORNERS\n4 2 3 5 1 6 7 8\nEnd\n"
+		"Scramble Uperm\nEDGES\n2 5 3 4 1 6 7 8 9\nCORNERS\n1 2 3 4 5 6 7 8\nEnd\n"},
+	{"3x3x3_RFU.def",
+		"ScrambleAlg sune\nR U R' U R U2 R'\nEnd\nScrambleAlg Tperm\nR U R' U' R' F R2 U' R' U' R U R' F'\nEnd\n"},
+};
+
+// When the first solution of a scramble came, and how many there were
+struct benchSolutions {
+	double start;
+	double first;
+	long long count;
+};
+
+static void benchFound(void *context, const std::string &solution) {
+	benchSolutions &found = *(benchSolutions *)context;
+	if (found.count++ == 0)
+		found.first = ksolve::wallSeconds() - found.start;
+}
+
+static void benchLine(const std::string &puzzle, const std::string &threads, const std::string &what, double value) {
+	std::cout << puzzle << "\t" << threads << "\t" << what << "\t" << value << "\n";
+}
+
+static void benchLine(const std::string &puzzle, const std::string &threads, const std::string &what, long long value) {
+	std::cout << puzzle << "\t" << threads << "\t" << what << "\t" << value << "\n";
+}
+
+// Load a definition as the program does, from its files or not
+static ksolve::loadedPuzzle *benchLoad(ksolve::solverContext &context, const std::string &path, bool useFiles) {
+	std::ifstream definition(path.c_str());
+	if (!definition.good()) {
+		std::cerr << "Can't open " << path << ".\n";
+		exit(-1);
+	}
+	return ksolve::loadPuzzle(context, definition, path, useFiles);
+}
+
+// Solve the scrambles of a case on the given number of threads, and print
+// what it took
+static void benchSolve(ksolve::loadedPuzzle &puzzle, const benchCase &bench, const std::string &name, int threads) {
+#ifdef _OPENMP
+	omp_set_num_threads(threads);
+#endif
+	ksolve::puzzleScope scope(puzzle, true);
+	std::vector<ksolve::searchThread> counts(ksolve::searchThreads());
+	for (unsigned int t = 0; t < counts.size(); t++)
+		ksolve::clearCounts(counts[t]);
+	benchSolutions found;
+	ksolve::solutionSink sink(benchFound, &found);
+	sink.threads = &counts;
+
+	std::istringstream scrambleStream(bench.scrambles);
+	ksolve::Scramble states(scrambleStream, puzzle.solved, puzzle.moves, puzzle.datasets, puzzle.blocks, *puzzle.options);
+	long long scrambles = 0, unsolved = 0, solutions = 0, lengths = 0;
+	double firstSum = 0, start = ksolve::wallSeconds();
+	ksolve::ScrambleDef scramble = states.getScramble();
+	while (scramble.state.size() != 0) {
+		found.start = ksolve::wallSeconds();
+		found.count = 0;
+		int length = ksolve::solveScramble(puzzle, scramble, sink, true);
+		scrambles++;
+		if (found.count > 0) {
+			lengths += length;
+			solutions += found.count;
+			firstSum += found.first;
+		} else
+			unsolved++;
+		ksolve::freeScramble(scramble);
+		scramble = states.getScramble();
+	}
+	double seconds = ksolve::wallSeconds() - start;
+	long long nodes = ksolve::mergeCounts(counts, 0, seconds).nodes;
+
+	std::ostringstream threadText;
+	threadText << threads;
+	benchLine(name, threadText.str(), "scrambles", scrambles);
+	benchLine(name, threadText.str(), "unsolved", unsolved);
+	benchLine(name, threadText.str(), "solutions", solutions);
+	benchLine(name, threadText.str(), "length_sum", lengths);
+	benchLine(name, threadText.str(), "nodes", nodes);
+	benchLine(name, threadText.str(), "nodes_per_second", seconds > 0 ? nodes / seconds : 0);
+	benchLine(name, threadText.str(), "first_solution_seconds", scrambles > unsolved ? firstSum / (scrambles - unsolved) : 0);
+	benchLine(name, threadText.str(), "solve_seconds", seconds);
+}
+
+int main(int argc, char *argv[]) {
+	std::string dir = "puzzles";
+	ksolve::solverContext context;
+	context.options.randomSeed = 1;
+	int maxThreads = ksolve::searchThreads();
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+			context.options.randomSeed = atoll(argv[++i]);
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+			maxThreads = atoi(argv[++i]);
+		else
+			dir = argv[i];
+	}
+	std::vector<int> threadCounts;
+	for (int t = 1; t < maxThreads; t *= 2)
+		threadCounts.push_back(t);
+	threadCounts.push_back(std::max(1, maxThreads));
+
+	std::cout << "# ksolve benchmark, format " << BENCH_FORMAT << ", seed " << context.options.randomSeed << ", up to " << threadCounts.back() << " threads\n";
+	std::cout << "# puzzle\tthreads\tmeasure\tvalue\n";
+	std::cout.precision(6);
+	for (unsigned int c = 0; c < sizeof(BENCH_CASES) / sizeof(BENCH_CASES[0]); c++) {
+		const benchCase &bench = BENCH_CASES[c];
+		std::string name(bench.def, strlen(bench.def) - 4);
+		std::string path = dir + "/" + bench.def;
+
+		// building the tables, without the files
+		double start = ksolve::wallSeconds();
+		ksolve::freePuzzle(context, benchLoad(context, path, false));
+		benchLine(name, "-", "build_seconds", ksolve::wallSeconds() - start);
+
+		// loading them, once the files are there
+		ksolve::freePuzzle(context, benchLoad(context, path, true));
+		start = ksolve::wallSeconds();
+		ksolve::loadedPuzzle *puzzle = benchLoad(context, path, true);
+		benchLine(name, "-", "load_seconds", ksolve::wallSeconds() - start);
+
+		for (unsigned int t = 0; t < threadCounts.size(); t++)
+			benchSolve(*puzzle, bench, name, threadCounts[t]);
+		ksolve::freePuzzle(context, puzzle);
+		std::cout.flush();
+	}
+	return EXIT_SUCCESS;
+}
@@ -17,7 +17,7 @@
  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 
-// Functions to check whether permutations are unique.
+// Functions to check whether permutations are unique, and their parity.
 
 #ifndef CHECKS_H
 #define CHECKS_H
@@ -56,4 +56,14 @@ static bool uniquePermutation(int test[], int size) {
    return true;
 }
 
+// Parity of a permutation (of unique pieces), from its number of inversions
+static int permutationParity(const int *perm, int size) {
+	int parity = 0;
+	for (int i = 0; i < size; i++)
+		for (int j = i + 1; j < size; j++)
+			if (perm[i] > perm[j])
+				parity ^= 1;
+	return parity;
+}
+
 #endif
@@ -0,0 +1,534 @@
+/*
+ KSolve+ - Puzzle solving program.
+ Copyright (C) 2007-2013 Kre Krig and Michael Gottlieb
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+// God's Algorithm with the positions split into cosets by one coordinate,
+// the orientation or the permutation of a single piece set, for puzzles too
+// big for one array in memory.
+
+#ifndef COSETBFS_H
+#define COSETBFS_H
+
+static const int COSET_FILE_VERSION = 1;
+static const int COSET_HEADER_SIZE = 4096; // the distances start here
+static const long long COSET_CHUNK = 1 << 20; // bytes of a coset read at once
+
+// A move changes the coordinate by itself, so it takes all positions of
+// one coset into one other coset. For each depth, the positions of every
+// coset are expanded once, and the positions they lead to are written to a
+// file for each coset they fall in. Each coset is then filled in on its
+// own from those files, with only its own array (a byte per position) in
+// memory, and the cosets are worked on in parallel. The arrays are kept in
+// the scratch directory between depths; a coset that is done is written
+// out at once, so a run that is stopped can be resumed without doing those
+// cosets again.
+struct cosetBFS {
+	Position &solved;
+	MoveList &moves;
+	PieceTypes &datasets;
+	std::vector<Block> &blocks;
+	std::map<std::pair<int, int>, long long> &subSizes;
+	int metric;
+	string dir;
+	unsigned long long puzzle; // puzzleHash, so a run is only resumed for the same puzzle
+	long long maxmem; // bytes the cosets worked on at once may take (-M)
+	long long cosets; // the values of the coordinate
+	long long low; // the size of the parts of the index after the coordinate
+	long long cosetSize; // positions in each coset
+	int threads; // cosets worked on at once
+	std::vector<fullmove*> moveList;
+	std::vector<long long> target; // the coset each move takes each coset to
+	std::vector<std::vector<long long> > sources; // the cosets leading into each coset
+
+	cosetBFS(Position &solved, MoveList &moves, PieceTypes &datasets, std::vector<Block> &blocks,
+			std::map<std::pair<int, int>, long long> &subSizes, int metric, string dir, string setName, unsigned long long puzzle, long long maxmem)
+		: solved(solved), moves(moves), datasets(datasets), blocks(blocks), subSizes(subSizes), metric(metric), dir(dir), puzzle(puzzle), maxmem(maxmem) {
+		// the orientation of the set, or its permutation if it has none
+		int set = setnameFind(setName);
+		if (set < 0 || datasets.find(set) == datasets.end()) {
+			std::cerr << "There is no piece set " << setName << " to split the positions by.\n";
+			exit(-1);
+		}
+		std::map<std::pair<int, int>, long long>::iterator coordinate = subSizes.end(), iter;
+		for (iter = subSizes.begin(); iter != subSizes.end(); iter++)
+			if (iter->first.first == set && (iter->first.second <= 1) == (datasets[set].omod > 1))
+				coordinate = iter;
+		if (coordinate == subSizes.end()) {
+			std::cerr << "Piece set " << setName << " has no orientation or permutation to split the positions by.\n";
+			exit(-1);
+		}
+		if (coordinate->first.second == 5) {
+			std::cerr << "The parity of " << setName << " follows from other sets, so it cannot split the positions.\n";
+			exit(-1);
+		}
+		cosets = coordinate->second;
+		if (cosets < 2) {
+			std::cerr << "Splitting by " << setName << " gives only one coset.\n";
+			exit(-1);
+		}
+		low = 1;
+		cosetSize = 1;
+		for (iter = subSizes.begin(); iter != subSizes.end(); iter++) {
+			if (iter == coordinate)
+				continue;
+			cosetSize *= iter->second;
+			if (iter->first > coordinate->first)
+				low *= iter->second;
+		}
+		// follow each move from a position of each coset
+		for (MoveList::iterator m = moves.begin(); m != moves.end(); m++)
+			moveList.push_back(&m->second);
+		long long n = moveList.size();
+		target.resize(cosets * n);
+		sources.resize(cosets);
+		Position from(solved.size()), to(solved.size());
+		for (int i = 0; i < solved.size(); i++) {
+			from[i] = newSubstate(solved[i].size);
+			to[i] = newSubstate(solved[i].size);
+		}
+		for (long long c = 0; c < cosets; c++) {
+			unpackPosition(from, c * low, subSizes, datasets, solved);
+			for (long long k = 0; k < n; k++) {
+				applyMove(from, to, moveList[k]->state, datasets);
+				target[c*n + k] = cosetOf(packPosition(to, subSizes, datasets));
+				sources[target[c*n + k]].push_back(c);
+			}
+		}
+		long long mostTargets = 1; // cosets one coset leads to
+		for (long long c = 0; c < cosets; c++) {
+			std::sort(sources[c].begin(), sources[c].end());
+			sources[c].erase(std::unique(sources[c].begin(), sources[c].end()), sources[c].end());
+			std::vector<long long> targets(target.begin() + c*n, target.begin() + (c+1)*n);
+			std::sort(targets.begin(), targets.end());
+			mostTargets = std::max(mostTargets, (long long)(std::unique(targets.begin(), targets.end()) - targets.begin()));
+		}
+		for (int i = 0; i < solved.size(); i++) {
+			delete []from[i].permutation;
+			delete []from[i].orientation;
+			delete []to[i].permutation;
+			delete []to[i].orientation;
+		}
+
+		// a thread holds a coset and a chunk of records while gathering, and
+		// a chunk of the coset and up to a chunk of records for each coset it
+		// leads to while scattering (no more than one record per move of
+		// each position)
+		long long scattered = std::min(mostTargets * COSET_CHUNK, (long long)sizeof(unsigned long long) * n * cosetSize);
+		long long perThread = std::max(cosetSize + COSET_CHUNK, COSET_CHUNK + scattered);
+		threads = 1;
+#ifdef _OPENMP
+		threads = omp_get_max_threads();
+#endif
+		if (threads > maxmem / perThread)
+			threads = maxmem / perThread;
+		if (threads < 1) {
+			std::cerr << "A coset of " << cosetSize << " positions and its buffers (" << perThread << " bytes) do not fit in the memory given with -M; split by a bigger set.\n";
+			exit(-1);
+		}
+	}
+
+	// The coset of a position of the whole puzzle, its index within the
+	// coset, and back
+	long long cosetOf(long long index) {
+		return index / low % cosets;
+	}
+
+	long long localIndex(long long index) {
+		return index / (low * cosets) * low + index % low;
+	}
+
+	long long globalIndex(long long coset, long long local) {
+		return (local / low * cosets + coset) * low + local % low;
+	}
+
+	string cosetFile(long long coset, const char *suffix) {
+		std::ostringstream name;
+		name << dir << "/ksolve-coset-" << coset << suffix;
+		return name.str();
+	}
+
+	// The positions a coset leads to in another coset, and the mark that a
+	// coset has written all of those for a depth
+	string sentFile(long long source, long long target) {
+		std::ostringstream name;
+		name << dir << "/ksolve-coset-" << target << ".from-" << source;
+		return name.str();
+	}
+
+	string progressFile() {
+		return dir + "/ksolve-cosets.progress";
+	}
+
+	// Write a coset: a text header with the depths expanded into it and the
+	// positions it gained in the last one, then its distances
+	void writeCoset(const string &filename, int level, const long long *gained, const signed char *distance) {
+		std::ostringstream header;
+		header << "ksolve-coset " << COSET_FILE_VERSION << " " << level;
+		for (int d = 0; d < 128; d++)
+			header << " " << gained[d];
+		header << "\n";
+		string text = header.str();
+		text.resize(COSET_HEADER_SIZE, ' ');
+		text[COSET_HEADER_SIZE - 1] = '\n';
+		if (!writeCheckpointFile(filename, text, (const char *)distance, cosetSize)) {
+			std::cerr << "Could not write scratch file " << filename << ".\n";
+			exit(-1);
+		}
+	}
+
+	// Read the header of a coset file; false if there is none
+	bool readHeader(std::ifstream &in, int &level, long long *gained) {
+		string magic;
+		int version;
+		in >> magic >> version >> level;
+		for (int d = 0; d < 128; d++)
+			in >> gained[d];
+		in.seekg(COSET_HEADER_SIZE);
+		return !in.fail() && magic == "ksolve-coset" && version == COSET_FILE_VERSION;
+	}
+
+	// Every coset is unvisited, except for the solved position
+	void start() {
+		long long gained[128];
+		for (int d = 0; d < 128; d++)
+			gained[d] = 0;
+		std::vector<signed char> distance(cosetSize, -1);
+		long long index = packPosition(solved, subSizes, datasets);
+		for (long long c = 0; c < cosets; c++) {
+			if (c == cosetOf(index))
+				distance[localIndex(index)] = 0;
+			writeCoset(cosetFile(c, ""), 0, gained, &distance[0]);
+			if (c == cosetOf(index))
+				distance[localIndex(index)] = -1;
+		}
+		saveProgress(0, gained);
+	}
+
+	// After every depth the counts so far are saved; the cosets are only
+	// moved into place after that
+	void saveProgress(int depth, const long long *cnt) {
+		std::ostringstream text;
+		text << "ksolve-cosets " << COSET_FILE_VERSION << " " << puzzle << " " << metric << " " << cosets << " " << cosetSize << " " << depth << "\n";
+		for (int d = 0; d < 128; d++)
+			text << cnt[d] << " ";
+		text << "\n";
+		if (!writeCheckpointFile(progressFile(), text.str(), NULL, 0)) {
+			std::cerr << "Could not write scratch file " << progressFile() << ".\n";
+			exit(-1);
+		}
+	}
+
+	// Continue a run stopped part way; false if the scratch directory holds
+	// none for this table
+	bool resume(int &depth, long long *cnt) {
+		std::ifstream in(progressFile().c_str());
+		if (!in.good())
+			return false;
+		string magic;
+		int version, savedMetric, savedDepth;
+		unsigned long long savedPuzzle;
+		long long savedCosets, savedSize;
+		in >> magic >> version >> savedPuzzle >> savedMetric >> savedCosets >> savedSize >> savedDepth;
+		for (int d = 0; d < 128; d++)
+			in >> cnt[d];
+		if (in.fail() || magic != "ksolve-cosets" || version != COSET_FILE_VERSION || savedPuzzle != puzzle
+				|| savedMetric != metric || savedCosets != cosets || savedSize != cosetSize || savedDepth < 0 || savedDepth >= 127) {
+			std::cout << "The cosets in " << dir << " are for another table, starting over.\n";
+			for (int d = 0; d < 128; d++)
+				cnt[d] = d == 0;
+			return false;
+		}
+		depth = savedDepth;
+		// move the cosets of the last depth saved into place, if that
+		// was stopped
+		long long gained[128];
+		for (long long c = 0; c < cosets; c++) {
+			std::ifstream next(cosetFile(c, ".next").c_str(), std::ios::binary);
+			int level;
+			if (next.good() && readHeader(next, level, gained) && level == depth)
+				rename(cosetFile(c, ".next").c_str(), cosetFile(c, "").c_str());
+		}
+		return true;
+	}
+
+	// Expand the positions at this depth into every coset, adding the new
+	// positions to cnt
+	void expand(int depth, long long *cnt) {
+		scatter(depth);
+		gather(depth, cnt);
+		saveProgress(depth + 1, cnt);
+		for (long long c = 0; c < cosets; c++)
+			rename(cosetFile(c, ".next").c_str(), cosetFile(c, "").c_str());
+		removeSent();
+	}
+
+	// Apply every move once to each position of each coset at this depth,
+	// and write where they lead, with their new depth, to the files of the
+	// cosets they fall in
+	void scatter(int depth) {
+		long long n = moveList.size();
+		bool using_blocks = blocks.size() != 0;
+		const std::size_t buffered = COSET_CHUNK / sizeof(unsigned long long);
+		#pragma omp parallel num_threads(threads)
+		{
+			std::vector<signed char> chunk(COSET_CHUNK);
+			Position from(solved.size()), to(solved.size());
+			for (int i = 0; i < solved.size(); i++) {
+				from[i] = newSubstate(solved[i].size);
+				to[i] = newSubstate(solved[i].size);
+			}
+
+			#pragma omp for schedule(dynamic, 1)
+			for (long long source = 0; source < cosets; source++) {
+				// done before the run was stopped?
+				std::ifstream mark(cosetFile(source, ".sent").c_str());
+				int level = -1;
+				if (mark >> level && level == depth + 1)
+					continue;
+
+				// one file for each coset this one leads to, even if nothing
+				// is written to it, so none is left from an earlier depth
+				std::map<long long, std::ofstream*> out;
+				std::map<long long, std::vector<unsigned long long> > records;
+				for (long long k = 0; k < n; k++) {
+					long long t = target[source*n + k];
+					if (out.count(t) == 0)
+						out[t] = new std::ofstream(sentFile(source, t).c_str(), std::ios::binary | std::ios::trunc);
+				}
+				std::ifstream in(cosetFile(source, "").c_str(), std::ios::binary);
+				in.seekg(COSET_HEADER_SIZE);
+				for (long long at = 0; at < cosetSize; at += COSET_CHUNK) {
+					long long length = std::min(COSET_CHUNK, cosetSize - at);
+					if (!in.read((char *)&chunk[0], length)) {
+						std::cerr << "Could not read scratch file " << cosetFile(source, "") << ".\n";
+						exit(-1);
+					}
+					for (long long j = 0; j < length; j++) {
+						if (chunk[j] != depth)
+							continue;
+						unpackPosition(from, globalIndex(source, at + j), subSizes, datasets, solved);
+						for (long long k = 0; k < n; k++) {
+							if (using_blocks) // see if the blocks will prevent this move
+								if (!blockLegal(from, blocks, moveList[k]->state))
+									continue;
+							applyMove(from, to, moveList[k]->state, datasets);
+							long long local = localIndex(packPosition(to, subSizes, datasets));
+							int newDepth = depth + (metric == 0 ? 1 : moveList[k]->qtm);
+							std::vector<unsigned long long> &buffer = records[target[source*n + k]];
+							buffer.push_back((unsigned long long)local << 7 | newDepth);
+							if (buffer.size() == buffered) {
+								out[target[source*n + k]]->write((const char *)&buffer[0], buffer.size() * sizeof(unsigned long long));
+								buffer.clear();
+							}
+						}
+					}
+				}
+				bool written = true;
+				std::map<long long, std::ofstream*>::iterator iter;
+				for (iter = out.begin(); iter != out.end(); iter++) {
+					std::vector<unsigned long long> &buffer = records[iter->first];
+					if (buffer.size() != 0)
+						iter->second->write((const char *)&buffer[0], buffer.size() * sizeof(unsigned long long));
+					iter->second->close();
+					written = written && !iter->second->fail();
+					delete iter->second;
+				}
+				std::ostringstream text;
+				text << depth + 1 << "\n";
+				if (!written || !writeCheckpointFile(cosetFile(source, ".sent"), text.str(), NULL, 0)) {
+					std::cerr << "Could not write scratch files of coset " << source << " in " << dir << ".\n";
+					exit(-1);
+				}
+			}
+
+			for (int i = 0; i < solved.size(); i++) {
+				delete []from[i].permutation;
+				delete []from[i].orientation;
+				delete []to[i].permutation;
+				delete []to[i].orientation;
+			}
+		}
+	}
+
+	// Fill in the positions that the cosets leading into each coset sent
+	// it, adding the new positions to cnt
+	void gather(int depth, long long *cnt) {
+		const long long buffered = COSET_CHUNK / sizeof(unsigned long long);
+		#pragma omp parallel num_threads(threads)
+		{
+			long long localCnt[128];
+			for (int d = 0; d < 128; d++)
+				localCnt[d] = 0;
+			std::vector<signed char> distance(cosetSize);
+			std::vector<unsigned long long> records(buffered);
+
+			#pragma omp for schedule(dynamic, 1)
+			for (long long t = 0; t < cosets; t++) {
+				// done before the run was stopped?
+				long long gained[128];
+				int level;
+				std::ifstream done(cosetFile(t, ".next").c_str(), std::ios::binary);
+				if (done.good() && readHeader(done, level, gained) && level == depth + 1) {
+					for (int d = 0; d < 128; d++)
+						localCnt[d] += gained[d];
+					continue;
+				}
+
+				std::ifstream in(cosetFile(t, "").c_str(), std::ios::binary);
+				if (!in.good() || !readHeader(in, level, gained) || !in.read((char *)&distance[0], cosetSize)) {
+					std::cerr << "Could not read scratch file " << cosetFile(t, "") << ".\n";
+					exit(-1);
+				}
+				for (int d = 0; d < 128; d++)
+					gained[d] = 0;
+				for (std::size_t s = 0; s < sources[t].size(); s++) {
+					std::ifstream sent(sentFile(sources[t][s], t).c_str(), std::ios::binary);
+					if (!sent.good()) {
+						std::cerr << "Could not read scratch file " << sentFile(sources[t][s], t) << ".\n";
+						exit(-1);
+					}
+					while (1) {
+						sent.read((char *)&records[0], buffered * sizeof(unsigned long long));
+						long long length = sent.gcount() / sizeof(unsigned long long);
+						for (long long j = 0; j < length; j++) {
+							long long local = records[j] >> 7;
+							signed char newDepth = records[j] & 127;
+							signed char old = distance[local];
+							if (old != -1 && old <= newDepth)
+								continue;
+							if (old != -1) // found a shorter way to a position of a later depth
+								gained[old]--;
+							distance[local] = newDepth;
+							gained[newDepth]++;
+						}
+						if (length < buffered)
+							break;
+					}
+				}
+				writeCoset(cosetFile(t, ".next"), depth + 1, gained, &distance[0]);
+				for (int d = 0; d < 128; d++)
+					localCnt[d] += gained[d];
+			}
+
+			#pragma omp critical
+			{
+				for (int d = 0; d < 128; d++)
+					cnt[d] += localCnt[d];
+			}
+		}
+	}
+
+	// Remove the files the cosets sent each other
+	void removeSent() {
+		for (long long t = 0; t < cosets; t++)
+			for (std::size_t s = 0; s < sources[t].size(); s++)
+				remove(sentFile(sources[t][s], t).c_str());
+		for (long long c = 0; c < cosets; c++)
+			remove(cosetFile(c, ".sent").c_str());
+	}
+
+	// The distance of a position of the whole puzzle
+	int distanceAt(long long index) {
+		std::ifstream in(cosetFile(cosetOf(index), "").c_str(), std::ios::binary);
+		in.seekg(COSET_HEADER_SIZE + localIndex(index));
+		return (signed char)in.get();
+	}
+
+	// Print up to n positions of the last depth, the first ones in the order
+	// of the whole puzzle's index, each with a solution found by stepping to
+	// the closest neighbor
+	void printAntipodes(int depth, long long n) {
+		std::vector<long long> antipodes;
+		std::vector<signed char> chunk(COSET_CHUNK);
+		for (long long c = 0; c < cosets; c++) {
+			std::ifstream in(cosetFile(c, "").c_str(), std::ios::binary);
+			in.seekg(COSET_HEADER_SIZE);
+			for (long long at = 0; at < cosetSize; at += COSET_CHUNK) {
+				long long length = std::min(COSET_CHUNK, cosetSize - at);
+				in.read((char *)&chunk[0], length);
+				for (long long j = 0; j < length && in.good(); j++)
+					if (chunk[j] == depth)
+						keepSmallest(antipodes, globalIndex(c, at + j), n);
+			}
+		}
+
+		Position start(solved.size()), cur(solved.size()), next(solved.size());
+		for (int i = 0; i < solved.size(); i++) {
+			start[i] = newSubstate(solved[i].size);
+			cur[i] = newSubstate(solved[i].size);
+			next[i] = newSubstate(solved[i].size);
+		}
+		for (unsigned int a = 0; a < antipodes.size(); a++) {
+			unpackPosition(start, antipodes[a], subSizes, datasets, solved);
+			unpackPosition(cur, antipodes[a], subSizes, datasets, solved);
+			std::cout << "Antipode solved by";
+			int curDepth = depth;
+			while (curDepth > 0) {
+				// try all moves to see which leads to the lowest depth
+				int minDepth = curDepth;
+				int minIndex = -1;
+				MoveList::iterator moveIter;
+				for (moveIter = moves.begin(); moveIter != moves.end(); moveIter++) {
+					if (blocks.size() != 0 && !blockLegal(cur, blocks, moveIter->second.state))
+						continue;
+					applyMove(cur, next, moveIter->second.state, datasets);
+					int nextDepth = distanceAt(packPosition(next, subSizes, datasets));
+					if (nextDepth >= 0 && nextDepth < minDepth) {
+						minDepth = nextDepth;
+						minIndex = moveIter->first;
+					}
+				}
+				if (minIndex < 0) {
+					std::cerr << "Could not find a solution for an antipode.\n";
+					exit(-1);
+				}
+				applyMove(cur, next, moves[minIndex].state, datasets);
+				for (int i = 0; i < solved.size(); i++) {
+					std::copy(next[i].permutation, next[i].permutation + next[i].size, cur[i].permutation);
+					std::copy(next[i].orientation, next[i].orientation + next[i].size, cur[i].orientation);
+				}
+				curDepth = minDepth;
+				std::cout << " " << moves[minIndex].name;
+			}
+			std::cout << ":\n";
+			printPosition(start);
+			std::cout << "\n";
+		}
+		for (int i = 0; i < solved.size(); i++) {
+			delete []start[i].permutation;
+			delete []start[i].orientation;
+			delete []cur[i].permutation;
+			delete []cur[i].orientation;
+			delete []next[i].permutation;
+			delete []next[i].orientation;
+		}
+	}
+
+	// Remove the scratch files of the run
+	void cleanup() {
+		for (long long c = 0; c < cosets; c++) {
+			remove(cosetFile(c, "").c_str());
+			remove(cosetFile(c, ".next").c_str());
+		}
+		removeSent();
+		remove(progressFile().c_str());
+	}
+};
+
+#endif
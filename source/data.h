@@ -32,12 +32,26 @@ static const int MAX_COMPLETE_PERMUTATION_TABLE_SIZE = 10000000; // >10! (perm o
 static const int MAX_COMPLETE_ORIENTATION_TABLE_SIZE = 10000000; // Complete tables contain one int (4 byte) per entry.
 static const int MAX_PARTIAL_PERMUTATION_TABLE_SIZE = 1000000; // Max number of entries in a partial table.
 static const int MAX_PARTIAL_ORIENTATION_TABLE_SIZE = 1000000; // SIZE is number of entries.
+static const int MAX_SUBSET_PERMUTATION_TABLE_SIZE = 10000000; // Max number of entries in one pattern-subset table.
+
+// Written at the start of .tables files; tables with another version are recomputed.
+static const int TABLE_FILE_VERSION = 3;
 
 // The types of pruning tables. 
 static const int TABLE_TYPE_NONE = 0;
 static const int TABLE_TYPE_COMPLETE = 1;
 static const int TABLE_TYPE_PARTIAL = 2;
 
+// Tables for ranking the arrangements of pieces that may have copies, built
+// once from the solved state
+struct multisetRank{
+	std::vector<int> pieces; // ranked pieces (values in the solved permutation)
+	std::vector<int> classOf; // piece -> index into pieces, or -1 if not ranked
+	std::vector<int> count; // number of copies of each ranked piece in the solved state
+	std::vector<long long> radix; // number of ways to place each ranked piece
+	long long combinations; // number of arrangements, or -1 if too many
+};
+
 // Some general data for a set of pieces
 struct dataset{
 	int type;
@@ -47,9 +61,13 @@ struct dataset{
 	int permbits, oribits ; // bits for perm and ori
 	int ptabletype;
 	int otabletype;
+	int subsettables; // number of pattern-subset permutation tables
 	bool uniqueperm; // Perm of unique numbers (1,2,3,...), or repeated (1,3,1,2)
 	bool oparity; // Does orientation have a parity constraint? (If so, last orientation is unnecessary)
 	bool pparity; // Does permutation have a parity constraint?
+	std::vector<int> parityWith; // Sets whose permutation parities, added up, give this one's (relative to solved)
+	std::vector<char> freeOrientation; // Pieces (by number) whose orientation an Ignore leaves out of God's Algorithm tables
+	multisetRank prank; // ranking tables for non-unique permutations
 };
 
 // part of a state, including orientation and permutation
@@ -59,16 +77,43 @@ struct substate {
 	int size;
 };
 
+// the moves of one set, laid out for ranking the orientations of all children of a position at once
+struct childMoves{
+	int nmoves; // number of move IDs (0 if the set has no complete orientation table)
+	int size;
+	int omod;
+	std::vector<int> from; // from[m*size+i]: position (0-based) the piece at i comes from under move m
+	std::vector<int> twist; // twist[m*size+i]: orientation that piece gets from move m
+	std::vector<int> weight; // weight[i] = omod^(size-1-i)
+};
+
+// pruning table for the positions of a chosen subset of the pieces in a set
+struct subsetprune{
+	multisetRank rank;
+	std::vector<char> table;
+};
+
 // part of a pruning table
 struct subprune{
 	std::vector<char> orientation;
 	std::vector<char> permutation;
 	std::map<std::vector<long long>, char> partialorientation;
 	std::map<std::vector<long long>, char> partialpermutation;
+	std::vector<subsetprune> subsets;
+	childMoves children;
+	int maskOffset; // first word of this set in positionRanks::where, or -1 if it has no multiset-ranked table
+	int maskPieces; // pieces 1..maskPieces-1 have their own mask; word 0 collects all others
 	int partialpermutation_depth;
 	int partialorientation_depth;
 };
 
+// Ranks of a position kept for each node on the search path, so that a
+// child is ranked from its parent and the positions its move touches
+struct positionRanks{
+	std::vector<long long> orientation; // per set: index into the complete orientation table, or -1 to compute it
+	std::vector<unsigned long long> where; // per set and piece: bitmask of the positions holding that piece
+};
+
 // some typedefs to make things easier
 typedef std::string string;
 typedef std::vector<substate> Position;
@@ -76,6 +121,8 @@ typedef std::map<int, std::set<int> > Block;
 typedef std::pair<int, int> MovePair;
 typedef std::map<int, subprune> PruneTable;
 typedef std::map<int, dataset> PieceTypes;
+typedef std::map<int, std::vector<std::vector<int> > > PatternSubsets;
+typedef std::mt19937_64 randomSource; // see random.h
 
 // all the information needed to describe a possible move
 struct fullmove {
@@ -84,6 +131,7 @@ struct fullmove {
 	int parentID;
 	int qtm;
 	Position state;
+	std::vector<std::vector<int> > touched; // touched[set]: positions (0-based) this move changes
 };
 
 // info about a particular move limit
@@ -100,6 +148,7 @@ struct ScrambleDef {
 	Position ignore;
 	int max_depth;
 	int slack;
+	long long max_solutions; // stop after this many solutions, or 0 for all of them
 	int metric; // 0 = HTM, 1 = QTM
 	int printState; // 0 = no, 1 = yes
 	std::vector<MoveLimit> moveLimits;
@@ -107,4 +156,10 @@ struct ScrambleDef {
 
 typedef std::map<int, fullmove> MoveList;
 
+// A mistake in a definition or scramble. ksolve prints it and stops; the
+// server answers the request it came with, and the library returns it.
+struct inputError : std::runtime_error {
+	inputError(const string &message) : std::runtime_error(message) {}
+};
+
 #endif
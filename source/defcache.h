@@ -0,0 +1,334 @@
+/*
+ KSolve+ - Puzzle solving program.
+ Copyright (C) 2007-2013 Kre Krig and Michael Gottlieb
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+// Compiled definition files: the rules of a puzzle as Rules leaves them,
+// with all generated moves, saved next to the .def file so that later runs
+// need not parse the file and generate the moves again
+
+#ifndef DEFCACHE_H
+#define DEFCACHE_H
+
+// Written at the start of .rules files, which are ignored if it differs.
+static const int RULES_FILE_VERSION = 1;
+static const int RULES_HEADER_SIZE = 64; // the rules start here
+
+// Everything ksolveWrapped takes from Rules
+struct puzzleRules {
+	PieceTypes datasets;
+	Position solved;
+	MoveList moves;
+	std::set<MovePair> forbidden;
+	Position ignore;
+	std::vector<Block> blocks;
+	PatternSubsets subsets;
+};
+
+// The rules as a list of numbers, strings taking their length and then a number per character
+struct rulesWriter {
+	std::vector<int> words;
+
+	void put(int w) {
+		words.push_back(w);
+	}
+
+	void put(const string &s) {
+		put(s.size());
+		for (unsigned int i = 0; i < s.size(); i++)
+			put((unsigned char)s[i]);
+	}
+
+	void put(Position &position) {
+		put(position.size());
+		for (int iter = 0; iter < position.size(); iter++) {
+			put(position[iter].size);
+			for (int i = 0; i < position[iter].size; i++)
+				put(position[iter].permutation[i]);
+			for (int i = 0; i < position[iter].size; i++)
+				put(position[iter].orientation[i]);
+		}
+	}
+};
+
+// Reading them back; failed is set if the numbers run out or make no sense
+struct rulesReader {
+	const int *words;
+	long long count;
+	long long at;
+	bool failed;
+
+	int get() {
+		if (at >= count) {
+			failed = true;
+			return 0;
+		}
+		return words[at++];
+	}
+
+	// a count of things still to come, each at least one number long
+	int getCount() {
+		int n = get();
+		if (n < 0 || n > count - at)
+			failed = true;
+		return failed ? 0 : n;
+	}
+
+	string getString() {
+		int n = getCount();
+		string s(n, ' ');
+		for (int i = 0; i < n; i++)
+			s[i] = get();
+		return s;
+	}
+
+	Position getPosition() {
+		Position position(getCount());
+		for (int iter = 0; iter < position.size(); iter++) {
+			int size = getCount();
+			position[iter].size = 0;
+			position[iter].permutation = position[iter].orientation = NULL;
+			if (size == 0)
+				continue;
+			position[iter] = newSubstate(size);
+			for (int i = 0; i < size; i++)
+				position[iter].permutation[i] = get();
+			for (int i = 0; i < size; i++)
+				position[iter].orientation[i] = get();
+		}
+		return position;
+	}
+};
+
+// FNV-1a hash of the text of a definition file
+static unsigned long long definitionHash(const string &text) {
+	unsigned long long hash = 14695981039346656037ULL;
+	for (unsigned int i = 0; i < text.size(); i++) {
+		hash ^= (unsigned char)text[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// Save the rules made from a definition file with this hash
+static void saveRules(const string &filename, unsigned long long hash, puzzleRules &rules) {
+	rulesWriter out;
+	out.put(rules.datasets.size());
+	PieceTypes::iterator iter;
+	for (iter = rules.datasets.begin(); iter != rules.datasets.end(); iter++) {
+		dataset &set = iter->second;
+		out.put(iter->first);
+		out.put(setnameFromIndex(iter->first));
+		out.put(set.size);
+		out.put(set.omod);
+		out.put(set.maxInSolved);
+		out.put(set.permbits);
+		out.put(set.oribits);
+		out.put(set.uniqueperm);
+		out.put(set.oparity);
+		out.put(set.pparity);
+		out.put(set.parityWith.size());
+		for (unsigned int i = 0; i < set.parityWith.size(); i++)
+			out.put(set.parityWith[i]);
+	}
+	out.put(rules.solved);
+	out.put(rules.ignore);
+	out.put(rules.moves.size());
+	MoveList::iterator moveIter;
+	for (moveIter = rules.moves.begin(); moveIter != rules.moves.end(); moveIter++) {
+		fullmove &move = moveIter->second;
+		out.put(move.name);
+		out.put(move.id);
+		out.put(move.parentID);
+		out.put(move.qtm);
+		out.put(move.state);
+	}
+	out.put(rules.forbidden.size());
+	std::set<MovePair>::iterator pair;
+	for (pair = rules.forbidden.begin(); pair != rules.forbidden.end(); pair++) {
+		out.put(pair->first);
+		out.put(pair->second);
+	}
+	out.put(rules.blocks.size());
+	for (unsigned int b = 0; b < rules.blocks.size(); b++) {
+		out.put(rules.blocks[b].size());
+		Block::iterator blockIter;
+		for (blockIter = rules.blocks[b].begin(); blockIter != rules.blocks[b].end(); blockIter++) {
+			out.put(blockIter->first);
+			out.put(blockIter->second.size());
+			std::set<int>::iterator piece;
+			for (piece = blockIter->second.begin(); piece != blockIter->second.end(); piece++)
+				out.put(*piece);
+		}
+	}
+	out.put(rules.subsets.size());
+	PatternSubsets::iterator subsetIter;
+	for (subsetIter = rules.subsets.begin(); subsetIter != rules.subsets.end(); subsetIter++) {
+		out.put(subsetIter->first);
+		out.put(subsetIter->second.size());
+		for (unsigned int s = 0; s < subsetIter->second.size(); s++) {
+			out.put(subsetIter->second[s].size());
+			for (unsigned int i = 0; i < subsetIter->second[s].size(); i++)
+				out.put(subsetIter->second[s][i]);
+		}
+	}
+
+	std::ostringstream header;
+	header << "ksolve-rules " << RULES_FILE_VERSION << " " << hash << " " << out.words.size() << "\n";
+	string text = header.str();
+	text.resize(RULES_HEADER_SIZE, ' ');
+	text[RULES_HEADER_SIZE - 1] = '\n';
+	string temporary = filename + ".tmp";
+	std::ofstream file(temporary.c_str(), std::ios::binary);
+	file.write(text.data(), text.size());
+	file.write((const char *)out.words.data(), out.words.size() * sizeof(int));
+	file.close();
+	if (file.fail() || rename(temporary.c_str(), filename.c_str()) != 0)
+		remove(temporary.c_str());
+}
+
+// Load the rules saved for a definition file with this hash, with one read;
+// false if there are none, or they are for another file
+static bool loadRules(const string &filename, unsigned long long hash, puzzleRules &rules) {
+	std::ifstream file(filename.c_str(), std::ios::binary);
+	if (!file.good())
+		return false;
+	file.seekg(0, std::ios::end);
+	long long bytes = file.tellg();
+	if (bytes < RULES_HEADER_SIZE)
+		return false;
+	std::vector<char> data(bytes);
+	file.seekg(0);
+	file.read(&data[0], bytes);
+	if (file.fail())
+		return false;
+	std::istringstream header(string(&data[0], RULES_HEADER_SIZE));
+	string magic;
+	int version;
+	unsigned long long savedHash;
+	long long count;
+	header >> magic >> version >> savedHash >> count;
+	if (header.fail() || magic != "ksolve-rules" || version != RULES_FILE_VERSION || savedHash != hash
+			|| count != (bytes - RULES_HEADER_SIZE) / (long long)sizeof(int))
+		return false;
+	std::vector<int> words(count);
+	if (count > 0)
+		memcpy(&words[0], &data[RULES_HEADER_SIZE], count * sizeof(int));
+	rulesReader in = {words.data(), count, 0, false};
+
+	puzzleRules loaded;
+	int nsets = in.getCount();
+	for (int s = 0; s < nsets && !in.failed; s++) {
+		int index = in.get();
+		string name = in.getString();
+		// the set names are numbered as they are first seen, so they must come out the same as before
+		int known = setnameFind(name);
+		if (in.failed || (known >= 0 ? known : (int)setNames->names.size()) != index)
+			return false;
+		setnameIndex(name);
+		dataset &set = loaded.datasets[index];
+		set.type = 0;
+		set.size = in.get();
+		set.omod = in.get();
+		set.maxInSolved = in.get();
+		set.permbits = in.get();
+		set.oribits = in.get();
+		set.uniqueperm = in.get();
+		set.oparity = in.get();
+		set.pparity = in.get();
+		set.ptabletype = TABLE_TYPE_NONE;
+		set.otabletype = TABLE_TYPE_NONE;
+		set.subsettables = 0;
+		set.parityWith.resize(in.getCount());
+		for (unsigned int i = 0; i < set.parityWith.size(); i++)
+			set.parityWith[i] = in.get();
+	}
+	loaded.solved = in.getPosition();
+	loaded.ignore = in.getPosition();
+	int nmoves = in.getCount();
+	for (int m = 0; m < nmoves && !in.failed; m++) {
+		fullmove move;
+		move.name = in.getString();
+		move.id = in.get();
+		move.parentID = in.get();
+		move.qtm = in.get();
+		move.state = in.getPosition();
+		loaded.moves[move.id] = move;
+	}
+	int npairs = in.getCount();
+	for (int p = 0; p < npairs && !in.failed; p++) {
+		int first = in.get();
+		loaded.forbidden.insert(MovePair(first, in.get()));
+	}
+	loaded.blocks.resize(in.getCount());
+	for (unsigned int b = 0; b < loaded.blocks.size() && !in.failed; b++) {
+		int nsetsInBlock = in.getCount();
+		for (int s = 0; s < nsetsInBlock && !in.failed; s++) {
+			std::set<int> &pieces = loaded.blocks[b][in.get()];
+			int npieces = in.getCount();
+			for (int i = 0; i < npieces; i++)
+				pieces.insert(in.get());
+		}
+	}
+	int nsubsets = in.getCount();
+	for (int s = 0; s < nsubsets && !in.failed; s++) {
+		std::vector<std::vector<int> > &groups = loaded.subsets[in.get()];
+		groups.resize(in.getCount());
+		for (unsigned int g = 0; g < groups.size() && !in.failed; g++) {
+			groups[g].resize(in.getCount());
+			for (unsigned int i = 0; i < groups[g].size(); i++)
+				groups[g][i] = in.get();
+		}
+	}
+	if (in.failed || in.at != count || (int)loaded.solved.size() != nsets)
+		return false;
+
+	PieceTypes::iterator iter;
+	for (iter = loaded.datasets.begin(); iter != loaded.datasets.end(); iter++)
+		if (!iter->second.uniqueperm)
+			iter->second.prank = makeMultisetRank(loaded.solved[iter->first].permutation, iter->second.size);
+	rules = loaded;
+	return true;
+}
+
+// The rules of a definition file, from its .rules file if that was made
+// from the same text, or else parsed, and saved there if useFile
+static void readRules(std::istream &definitionStream, string defFileName, bool useFile, puzzleRules &rules, int verbose) {
+	std::ostringstream text;
+	text << definitionStream.rdbuf();
+	unsigned long long hash = definitionHash(text.str());
+	string filename = defFileName + ".rules";
+	if (useFile && loadRules(filename, hash, rules)) {
+		if (verbose)
+			messages() << "Using compiled rules " << filename << ".\n";
+		return;
+	}
+
+	std::istringstream definition(text.str());
+	Rules ruleset(definition, verbose);
+	rules.datasets = ruleset.getDatasets();
+	rules.solved = ruleset.getSolved();
+	rules.moves = ruleset.getMoves();
+	rules.forbidden = ruleset.getForbiddenPairs();
+	rules.ignore = ruleset.getIgnore();
+	rules.blocks = ruleset.getBlocks();
+	rules.subsets = ruleset.getPatternSubsets();
+	if (useFile)
+		saveRules(filename, hash, rules);
+}
+
+#endif
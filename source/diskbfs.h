@@ -0,0 +1,499 @@
+/*
+ KSolve+ - Puzzle solving program.
+ Copyright (C) 2007-2013 Kre Krig and Michael Gottlieb
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+// Breadth-first God's Algorithm enumeration with the positions of each depth
+// kept on disk, for puzzles too big for any table in memory.
+
+#ifndef DISKBFS_H
+#define DISKBFS_H
+
+// Writes a sorted run of packed positions. A position is width words; with
+// one word per position the words are stored as varint deltas.
+class runWriter {
+public:
+	runWriter(const string &filename, int width) : out(filename.c_str(), std::ios::binary), width(width), last(0), count(0) {
+		if (!out.good()) {
+			std::cerr << "Could not write scratch file " << filename << ".\n";
+			exit(-1);
+		}
+	}
+
+	void put(const unsigned long long *record) {
+		if (width == 1) {
+			unsigned long long delta = record[0] - last;
+			last = record[0];
+			while (delta >= 128) {
+				out.put((char)(delta | 128));
+				delta >>= 7;
+			}
+			out.put((char)delta);
+		} else {
+			out.write((const char *)record, sizeof(unsigned long long) * width);
+		}
+		count++;
+	}
+
+	long long close() {
+		out.close();
+		if (out.fail()) {
+			std::cerr << "Error writing scratch file.\n";
+			exit(-1);
+		}
+		return count;
+	}
+
+private:
+	std::ofstream out;
+	int width;
+	unsigned long long last;
+	long long count;
+};
+
+// Reads back a run written by runWriter, one position at a time
+class runReader {
+public:
+	runReader(const string &filename, int width) : in(filename.c_str(), std::ios::binary), width(width), last(0), record(width) {
+		if (!in.good()) {
+			std::cerr << "Could not read scratch file " << filename << ".\n";
+			exit(-1);
+		}
+		valid = true;
+		next();
+	}
+
+	// Advance to the next position; false at the end of the run
+	bool next() {
+		if (!valid)
+			return false;
+		if (width == 1) {
+			unsigned long long delta = 0;
+			int shift = 0, c;
+			while ((c = in.get()) != EOF) {
+				delta |= (unsigned long long)(c & 127) << shift;
+				shift += 7;
+				if (c < 128)
+					break;
+			}
+			if (c == EOF) {
+				valid = false;
+				return false;
+			}
+			last += delta;
+			record[0] = last;
+		} else {
+			in.read((char *)&record[0], sizeof(unsigned long long) * width);
+			if (in.gcount() != (std::streamsize)(sizeof(unsigned long long) * width)) {
+				valid = false;
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool good() const { return valid; }
+	const unsigned long long *current() const { return &record[0]; }
+
+private:
+	std::ifstream in;
+	int width;
+	unsigned long long last;
+	std::vector<unsigned long long> record;
+	bool valid;
+};
+
+// Lexicographic order of two packed positions
+static inline int compareRecords(const unsigned long long *a, const unsigned long long *b, int width) {
+	for (int i = 0; i < width; i++)
+		if (a[i] != b[i])
+			return a[i] < b[i] ? -1 : 1;
+	return 0;
+}
+
+struct recordLess {
+	const unsigned long long *records;
+	int width;
+	bool operator()(long long a, long long b) const {
+		return compareRecords(records + a*width, records + b*width, width) < 0;
+	}
+};
+
+// Sort the positions in buffer, drop duplicates, write them as a run and
+// empty the buffer
+static void writeSortedRun(std::vector<unsigned long long> &buffer, int width, const string &filename) {
+	runWriter out(filename, width);
+	if (width == 1) {
+		std::sort(buffer.begin(), buffer.end());
+		for (std::size_t i = 0; i < buffer.size(); i++)
+			if (i == 0 || buffer[i] != buffer[i-1])
+				out.put(&buffer[i]);
+	} else {
+		long long n = buffer.size() / width;
+		std::vector<long long> order(n);
+		for (long long i = 0; i < n; i++)
+			order[i] = i;
+		recordLess less = {&buffer[0], width};
+		std::sort(order.begin(), order.end(), less);
+		for (long long i = 0; i < n; i++)
+			if (i == 0 || compareRecords(&buffer[order[i]*width], &buffer[order[i-1]*width], width) != 0)
+				out.put(&buffer[order[i]*width]);
+	}
+	out.close();
+	buffer.clear();
+}
+
+static const unsigned int MERGE_FAN_IN = 64; // runs mergeRuns reads at once
+static const int MAX_MERGE_PASSES = 16; // for cleaning up after a stopped run
+static const long long MIN_RUN_BUFFER = 4 << 20; // bytes; a smaller -M would write a run every few positions
+
+// Orders run readers by their current position, for a heap with the
+// smallest on top
+struct readerGreater {
+	int width;
+	bool operator()(runReader *a, runReader *b) const {
+		return compareRecords(a->current(), b->current(), width) > 0;
+	}
+};
+
+// Merge a few sorted runs into one, taking the smallest position from a heap
+// of them, leaving out duplicates and any position found in one of the
+// (sorted) runs of subtract. Returns the number of positions written.
+static long long mergeGroup(const std::vector<string> &inputs, const std::vector<string> &subtract, int width, const string &output) {
+	std::vector<runReader*> heap, sub;
+	for (unsigned int i = 0; i < inputs.size(); i++) {
+		runReader *in = new runReader(inputs[i], width);
+		if (in->good())
+			heap.push_back(in);
+		else
+			delete in;
+	}
+	for (unsigned int i = 0; i < subtract.size(); i++)
+		sub.push_back(new runReader(subtract[i], width));
+	readerGreater greater = {width};
+	std::make_heap(heap.begin(), heap.end(), greater);
+
+	runWriter out(output, width);
+	std::vector<unsigned long long> last(width);
+	bool haveLast = false;
+	while (!heap.empty()) {
+		std::pop_heap(heap.begin(), heap.end(), greater);
+		runReader *smallest = heap.back();
+		const unsigned long long *record = smallest->current();
+		bool keep = !haveLast || compareRecords(record, &last[0], width) != 0;
+		for (unsigned int i = 0; i < sub.size() && keep; i++) {
+			while (sub[i]->good() && compareRecords(sub[i]->current(), record, width) < 0)
+				sub[i]->next();
+			if (sub[i]->good() && compareRecords(sub[i]->current(), record, width) == 0)
+				keep = false;
+		}
+		if (keep)
+			out.put(record);
+		std::copy(record, record + width, last.begin());
+		haveLast = true;
+		if (smallest->next())
+			std::push_heap(heap.begin(), heap.end(), greater);
+		else {
+			delete smallest;
+			heap.pop_back();
+		}
+	}
+
+	for (unsigned int i = 0; i < sub.size(); i++)
+		delete sub[i];
+	return out.close();
+}
+
+// The runs of one pass of merging, kept next to its output
+static string mergePassFile(const string &output, int pass, int n) {
+	std::ostringstream name;
+	name << output << ".pass-" << pass << "-" << n;
+	return name.str();
+}
+
+// Merge sorted runs into one, leaving out duplicates and any position found
+// in one of the (sorted) runs of subtract. With more than MERGE_FAN_IN runs,
+// groups of them are merged first, in as many passes as it takes, so that
+// only so many files are open at once. Returns the number of positions
+// written.
+static long long mergeRuns(const std::vector<string> &inputs, const std::vector<string> &subtract, int width, const string &output) {
+	std::vector<string> runs = inputs;
+	for (int pass = 0; runs.size() > MERGE_FAN_IN; pass++) {
+		std::vector<string> merged;
+		for (unsigned int first = 0; first < runs.size(); first += MERGE_FAN_IN) {
+			std::vector<string> group(runs.begin() + first, runs.begin() + std::min((unsigned int)runs.size(), first + MERGE_FAN_IN));
+			merged.push_back(mergePassFile(output, pass, merged.size()));
+			mergeGroup(group, std::vector<string>(), width, merged.back());
+		}
+		if (pass > 0)
+			for (unsigned int i = 0; i < runs.size(); i++)
+				remove(runs[i].c_str());
+		runs = merged;
+	}
+	long long count = mergeGroup(runs, subtract, width, output);
+	if (runs != inputs)
+		for (unsigned int i = 0; i < runs.size(); i++)
+			remove(runs[i].c_str());
+	return count;
+}
+
+// God's Algorithm by breadth-first search with every depth in a run on disk.
+// Memory use is the buffer of new positions, at most maxmem bytes (but at
+// least MIN_RUN_BUFFER); when it fills up, it is sorted and written out as
+// a run, and all runs for a depth are merged once the depth before it is
+// done. A new position can only be at most 2*maxQTM moves closer than its
+// depth in the search, so only the runs of those depths have to be merged
+// against.
+struct diskBFS {
+	Position &solved;
+	MoveList &moves;
+	PieceTypes &datasets;
+	std::vector<Block> &blocks;
+	std::map<std::pair<int, int>, long long> &subSizes;
+	int metric;
+	string dir;
+	bool ranked; // one word per position, the index used by the array; otherwise packPosition2
+	int width;
+	int maxQTM;
+	long long maxmem; // bytes the buffer may take (-M)
+	std::map<int, std::vector<string> > pending; // runs of positions found for each depth
+	std::vector<string> merged; // runs merged into a level, which the last checkpoint may still list
+
+	diskBFS(Position &solved, MoveList &moves, PieceTypes &datasets, std::vector<Block> &blocks,
+			std::map<std::pair<int, int>, long long> &subSizes, int metric, string dir, bool ranked, long long maxmem)
+		: solved(solved), moves(moves), datasets(datasets), blocks(blocks), subSizes(subSizes), metric(metric), dir(dir), ranked(ranked), maxmem(maxmem) {
+		width = ranked ? 1 : packPosition2(solved, datasets, 0).size();
+		maxQTM = 1;
+		for (MoveList::iterator m = moves.begin(); m != moves.end(); m++)
+			if (metric == 1 && m->second.qtm > maxQTM)
+				maxQTM = m->second.qtm;
+	}
+
+	string levelFile(int depth) {
+		std::ostringstream name;
+		name << dir << "/ksolve-depth-" << depth << ".run";
+		return name.str();
+	}
+
+	string pendingFile(int depth, int n) {
+		std::ostringstream name;
+		name << dir << "/ksolve-pending-" << depth << "-" << n << ".run";
+		return name.str();
+	}
+
+	void pack(Position &position, unsigned long long *record) {
+		if (ranked) {
+			record[0] = packPosition(position, subSizes, datasets);
+		} else {
+			std::vector<long long> packed = packPosition2(position, datasets, width);
+			for (int i = 0; i < width; i++)
+				record[i] = packed[i];
+		}
+	}
+
+	void unpack(const unsigned long long *record, Position &position) {
+		if (ranked) {
+			unpackPosition(position, record[0], subSizes, datasets, solved);
+		} else {
+			std::vector<long long> packed(record, record + width);
+			unpackPosition2(position, packed, datasets);
+		}
+	}
+
+	// Write the buffered positions for each depth as runs
+	void flush(std::map<int, std::vector<unsigned long long> > &buffers) {
+		std::map<int, std::vector<unsigned long long> >::iterator iter;
+		for (iter = buffers.begin(); iter != buffers.end(); iter++) {
+			if (iter->second.empty())
+				continue;
+			string filename = pendingFile(iter->first, pending[iter->first].size());
+			writeSortedRun(iter->second, width, filename);
+			pending[iter->first].push_back(filename);
+		}
+	}
+
+	// Apply every move to every position of this depth, buffering the
+	// results by the depth they would have
+	void expand(int depth) {
+		bool using_blocks = blocks.size() != 0;
+		long long capacity = std::max(maxmem, MIN_RUN_BUFFER) / sizeof(unsigned long long);
+		if (capacity < width)
+			capacity = width;
+		long long buffered = 0;
+		std::map<int, std::vector<unsigned long long> > buffers;
+		std::vector<unsigned long long> record(width);
+		Position from(solved.size()), to(solved.size());
+		for (int iter = 0; iter < solved.size(); iter++) {
+			from[iter] = newSubstate(solved[iter].size);
+			to[iter] = newSubstate(solved[iter].size);
+		}
+
+		for (runReader in(levelFile(depth), width); in.good(); in.next()) {
+			unpack(in.current(), from);
+			MoveList::iterator moveIter;
+			for (moveIter = moves.begin(); moveIter != moves.end(); moveIter++) {
+				if (using_blocks) // see if the blocks will prevent this move
+					if (!blockLegal(from, blocks, moveIter->second.state))
+						continue;
+				applyMove(from, to, moveIter->second.state, datasets);
+				pack(to, &record[0]);
+				std::vector<unsigned long long> &buffer = buffers[depth + (metric == 0 ? 1 : moveIter->second.qtm)];
+				buffer.insert(buffer.end(), record.begin(), record.end());
+				buffered += width;
+				if (buffered + width > capacity) {
+					flush(buffers);
+					buffered = 0;
+				}
+			}
+		}
+		flush(buffers);
+
+		for (int iter = 0; iter < solved.size(); iter++) {
+			delete []from[iter].permutation;
+			delete []from[iter].orientation;
+			delete []to[iter].permutation;
+			delete []to[iter].orientation;
+		}
+	}
+
+	// Merge the runs found for this depth into its level, and return its size.
+	// The runs are kept until removeMerged, so that a run stopped before the
+	// next checkpoint can still resume from the last one.
+	long long finish(int depth) {
+		std::vector<string> subtract;
+		for (int d = depth - 1; d >= 0 && d >= depth - 2*maxQTM; d--)
+			subtract.push_back(levelFile(d));
+		long long count = mergeRuns(pending[depth], subtract, width, levelFile(depth));
+		merged.insert(merged.end(), pending[depth].begin(), pending[depth].end());
+		pending.erase(depth);
+		return count;
+	}
+
+	// Remove the runs finish has merged, once a checkpoint without them is written
+	void removeMerged() {
+		for (unsigned int i = 0; i < merged.size(); i++)
+			remove(merged[i].c_str());
+		merged.clear();
+	}
+
+	// The level of depth 0 holds only the solved position
+	void start() {
+		std::vector<unsigned long long> record(width);
+		pack(solved, &record[0]);
+		writeSortedRun(record, width, levelFile(0));
+	}
+
+	// Which of the sorted positions in records are in the run of this depth?
+	std::vector<bool> findInLevel(int depth, std::vector<std::vector<unsigned long long> > &records) {
+		std::vector<bool> found(records.size(), false);
+		if (depth < 0)
+			return found;
+		runReader in(levelFile(depth), width);
+		for (unsigned int i = 0; i < records.size(); i++) {
+			while (in.good() && compareRecords(in.current(), &records[i][0], width) < 0)
+				in.next();
+			found[i] = in.good() && compareRecords(in.current(), &records[i][0], width) == 0;
+		}
+		return found;
+	}
+
+	// Print up to n positions of the last depth, each with a solution found
+	// by stepping to a neighbor in a closer level
+	void printAntipodes(int depth, long long n) {
+		std::vector<std::vector<unsigned long long> > antipodes;
+		for (runReader in(levelFile(depth), width); in.good() && (long long)antipodes.size() < n; in.next())
+			antipodes.push_back(std::vector<unsigned long long>(in.current(), in.current() + width));
+
+		Position start(solved.size()), cur(solved.size()), next(solved.size());
+		for (int iter = 0; iter < solved.size(); iter++) {
+			start[iter] = newSubstate(solved[iter].size);
+			cur[iter] = newSubstate(solved[iter].size);
+			next[iter] = newSubstate(solved[iter].size);
+		}
+		for (unsigned int a = 0; a < antipodes.size(); a++) {
+			unpack(&antipodes[a][0], start);
+			unpack(&antipodes[a][0], cur);
+			std::cout << "Antipode solved by";
+			int curDepth = depth;
+			while (curDepth > 0) {
+				// find the closest neighbor, looking the result of every move
+				// up in each of the closer levels it could be in, with one
+				// pass over each level; ties go to the first move
+				std::vector<std::pair<std::vector<unsigned long long>, int> > candidates;
+				MoveList::iterator moveIter;
+				for (moveIter = moves.begin(); moveIter != moves.end(); moveIter++) {
+					if (blocks.size() != 0 && !blockLegal(cur, blocks, moveIter->second.state))
+						continue;
+					applyMove(cur, next, moveIter->second.state, datasets);
+					std::vector<unsigned long long> record(width);
+					pack(next, &record[0]);
+					candidates.push_back(std::make_pair(record, moveIter->first));
+				}
+				std::sort(candidates.begin(), candidates.end());
+				std::vector<std::vector<unsigned long long> > records;
+				for (unsigned int i = 0; i < candidates.size(); i++)
+					records.push_back(candidates[i].first);
+				int best = -1, bestDepth = curDepth;
+				for (int d = curDepth - 1; d >= 0 && d >= curDepth - maxQTM; d--) {
+					std::vector<bool> found = findInLevel(d, records);
+					for (unsigned int i = 0; i < found.size(); i++)
+						if (found[i] && (d < bestDepth || candidates[i].second < best)) {
+							best = candidates[i].second;
+							bestDepth = d;
+						}
+				}
+				if (best < 0) {
+					std::cerr << "Could not find a solution for an antipode.\n";
+					exit(-1);
+				}
+				applyMove(cur, next, moves[best].state, datasets);
+				for (int iter = 0; iter < solved.size(); iter++) {
+					std::copy(next[iter].permutation, next[iter].permutation + next[iter].size, cur[iter].permutation);
+					std::copy(next[iter].orientation, next[iter].orientation + next[iter].size, cur[iter].orientation);
+				}
+				curDepth = bestDepth;
+				std::cout << " " << moves[best].name;
+			}
+			std::cout << ":\n";
+			printPosition(start);
+			std::cout << "\n";
+		}
+		for (int iter = 0; iter < solved.size(); iter++) {
+			delete []start[iter].permutation;
+			delete []start[iter].orientation;
+			delete []cur[iter].permutation;
+			delete []cur[iter].orientation;
+			delete []next[iter].permutation;
+			delete []next[iter].orientation;
+		}
+	}
+
+	// Remove all scratch files up to this depth, including runs left behind
+	// by an earlier run that was stopped and resumed
+	void cleanup(int depth) {
+		for (int d = 0; d <= depth + 2*maxQTM; d++) {
+			remove(levelFile(d).c_str());
+			for (int n = 0; remove(pendingFile(d, n).c_str()) == 0; n++)
+				;
+			for (int pass = 0; pass < MAX_MERGE_PASSES; pass++)
+				for (int n = 0; remove(mergePassFile(levelFile(d), pass, n).c_str()) == 0; n++)
+					;
+		}
+	}
+};
+
+#endif
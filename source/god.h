@@ -22,57 +22,35 @@
 #ifndef GOD_H
 #define GOD_H
 
-static bool godTable(Position& solved, MoveList& moves, PieceTypes& datasets, std::set<MovePair>& forbiddenPairs, Position& ignore, std::vector<Block>& blocks, int metric){
-	// compute size of puzzle
-	// this pair<intg,int> holds the piece set name and the type of data:
-	//		0 (orientation with parity constraint),
-	//		1 (orientation without parity constraint),
-	//		2 (unique permutation),
-	//		3 (non-unique permutation)
-	std::map<std::pair<int, int>, long long> subSizes;
-	
-	for (int iter=0; iter<solved.size(); iter++) {
-		int size = solved[iter].size;
-		if (datasets[iter].oparity) {
-			// Orientation, parity constraint
-			long long tablesize = 1;
-			for (int i = 0; i < size - 1; i++)
-				tablesize *= datasets[iter].omod;
-			subSizes.insert(std::pair<std::pair<int, int>, long long>
-					(std::pair<int, int> (iter, 0), tablesize));
-		} else {
-			// Orientation, no parity constraint
-			long long tablesize = 1;
-			for (int i = 0; i < size; i++)
-				tablesize *= datasets[iter].omod;
-			subSizes.insert(std::pair<std::pair<int, int>, long long>
-					(std::pair<int, int> (iter, 1), tablesize));
-		}
-		
-		if (factorial(datasets[iter].size) != -1 && uniquePermutation(solved[iter].permutation, size)){
-			// Permutation, unique pieces
-			std::vector<int> temp_perm (size);
-			for (int i = 0; i < size; i++)
-				temp_perm[i] = solved[iter].permutation[i];
-			long long tablesize = factorial(size);
-			if (datasets[iter].pparity && size > 1) {
-			   subSizes.insert(std::pair<std::pair<int, int>, long long>
-				(std::pair<int, int> (iter, 4), tablesize>>1));
-			} else {
-			   subSizes.insert(std::pair<std::pair<int, int>, long long>
-				(std::pair<int, int> (iter, 2), tablesize));
-			}
-		}
-		else {
-			// Permutation, not unique pieces
-			std::vector<int> temp_perm (size);
-			for (int i = 0; i < size; i++)
-				temp_perm[i] = solved[iter].permutation[i];
-			long long tablesize = combinations(temp_perm);
-			subSizes.insert(std::pair<std::pair<int, int>, long long>
-				(std::pair<int, int> (iter, 3), tablesize));
+// Written at the start of God's Algorithm checkpoints; others are not resumed.
+static const int GOD_CHECKPOINT_VERSION = 2;
+// Number of depth counts kept by godTable and in its checkpoints
+static const int GOD_DEPTHS = 128;
+
+static bool godTable(Position& solved, MoveList& moves, PieceTypes& datasets, std::set<MovePair>& forbiddenPairs, Position& ignore, std::vector<Block>& blocks, int metric, string defFileName, const solverOptions &options){
+	// with -I, positions that differ only in what the Ignore command ignores
+	// are one position; the table is kept apart from the one of the puzzle
+	if (options.godIgnore && ignoresAnything(ignore)) {
+		Position quotient, none;
+		PieceTypes quotientSets;
+		std::vector<std::vector<int> > relabel;
+		if (!quotientPuzzle(solved, datasets, ignore, blocks, quotient, quotientSets, relabel, true))
+			exit(-1);
+		std::cout << "Leaving out what the Ignore command ignores.\n";
+		bool done = godTable(quotient, moves, quotientSets, forbiddenPairs, none, blocks, metric, defFileName + ".ignore", options);
+		for (int iter = 0; iter < quotient.size(); iter++) {
+			delete []quotient[iter].permutation;
+			delete []quotient[iter].orientation;
 		}
+		return done;
 	}
+	string checkpointFile = defFileName + (metric == 0 ? ".god" : ".godq");
+	unsigned long long hash = puzzleHash(solved, moves, datasets, blocks);
+	string oracleFile = defFileName + (metric == 0 ? ".oracle" : ".oracleq");
+	
+	// compute size of puzzle
+	std::map<std::pair<int, int>, long long> subSizes;
+	computeSubSizes(solved, datasets, subSizes);
 	
 	long long totalSize = 1;
 	double logSize = 0;
@@ -94,15 +72,67 @@ static bool godTable(Position& solved, MoveList& moves, PieceTypes& datasets, st
 	
 	// try to initialize an array of sufficient size and set all to -1
 	int dataStructure = 0; // 0 = array, 1 = map<longlong,char>,
-	                        // 2 = map<vector<longlong>,char>
+	                        // 2 = map<vector<longlong>,char>, 3 = 2-bit array,
+	                        // 4 = runs on disk, 5 = sorted positions in memory,
+	                        // 6 = cosets on disk
 	signed char* distance = NULL;
-	if (logSize < 50 && totalSize <= maxmem)
+	unsigned long long* codes = NULL;
+	// bandaged puzzles reach only a small part of the index, so only the
+	// positions reached are kept, unless they are to go on disk
+	bool sparseStore = using_blocks && options.scratchDir == "" && options.cosetSet == "";
+	if (options.cosetSet != "" && (options.scratchDir == "" || logSize >= 63*log(2))) {
+		std::cerr << "Splitting into cosets needs a scratch directory (-T), and a puzzle with fewer than 2^63 positions.\n";
+		exit(-1);
+	}
+	if (!sparseStore && options.cosetSet == "" && logSize < 50 && totalSize <= options.maxmem)
 		distance = new (std::nothrow) signed char[(std::size_t) totalSize];
+	// failing that, 2 bits per position (the depth mod 3) are enough when
+	// every move changes the depth by at most one
+	bool unitMoves = true;
+	for (MoveList::iterator m = moves.begin(); m != moves.end(); m++)
+		if (metric == 1 && m->second.qtm != 1)
+			unitMoves = false;
+	if (distance == NULL && !sparseStore && options.cosetSet == "" && unitMoves && logSize < 50 && (totalSize + 3) / 4 <= options.maxmem)
+		codes = new (std::nothrow) unsigned long long[(std::size_t) ((totalSize + 31) / 32)];
+	// and if it fits as well, a bit per position for the positions already
+	// expanded, a word of them for each word of codes
+	unsigned int* expanded = NULL;
+	if (codes != NULL && (totalSize + 3) / 4 + (totalSize + 7) / 8 <= options.maxmem)
+		expanded = new (std::nothrow) unsigned int[(std::size_t) ((totalSize + 31) / 32)];
 	std::map<long long, signed char> distMap1;
 	std::map<std::vector<long long>, signed char> distMap2;
+	// the positions found at each depth, for the maps. A position that is
+	// found again closer to solved (QTM) is also left in its old bucket, and
+	// skipped there, so every position is expanded once.
+	std::vector<std::vector<long long> > buckets1(128);
+	std::vector<std::vector<std::vector<long long> > > buckets2(128);
+	std::vector<long long> antipodeIndices; // smallest indices at the last depth, for dataStructure 3
+	diskBFS *disk = NULL;
+	sparseBFS *sparse = NULL;
+	cosetBFS *cosets = NULL;
 	long long i;
 	
-	if (distance == NULL) {
+	if (options.cosetSet != "") {
+		dataStructure = 6;
+		cosets = new cosetBFS(solved, moves, datasets, blocks, subSizes, metric, options.scratchDir, options.cosetSet, hash, options.maxmem);
+		std::cout << "Splitting the positions by " << options.cosetSet << " into " << cosets->cosets << " cosets of " << cosets->cosetSize << ",\n";
+		std::cout << "working on " << cosets->threads << " at once, in " << options.scratchDir << ".\n";
+	} else if (codes != NULL) {
+		std::cout << "Allocated 2-bit array of size " << totalSize << "\n";
+		dataStructure = 3;
+		for (i=0; i<(totalSize + 31) / 32; i++) {
+			codes[i] = ~0ULL; // all unvisited
+		}
+	} else if (sparseStore) {
+		std::cout << "Keeping only the positions reached, in memory.\n";
+		dataStructure = 5;
+		sparse = new sparseBFS(solved, moves, datasets, blocks, subSizes, metric, logSize < 63*log(2), options.maxmem);
+	} else if (distance == NULL && options.scratchDir != "") {
+		std::cout << "Could not allocate array of size " << totalSize << "\n";
+		std::cout << "Keeping the positions in " << options.scratchDir << ".\n";
+		dataStructure = 4;
+		disk = new diskBFS(solved, moves, datasets, blocks, subSizes, metric, options.scratchDir, logSize < 63*log(2), options.maxmem);
+	} else if (distance == NULL) {
 		std::cout << "Could not allocate array of size " << totalSize << "\n";
 		if (logSize >= 63*log(2)) {
 			std::cout << "Puzzle cannot fit in a long long int.\n";
@@ -120,8 +150,8 @@ static bool godTable(Position& solved, MoveList& moves, PieceTypes& datasets, st
 	
 	// Set the solved position to a depth of 0
 	int depth = 0;
-	long long* cnt = new long long[128]; // signed char only goes up to 127 anyway...
-	for (i=0; i<128; i++) {
+	long long* cnt = new long long[GOD_DEPTHS]; // signed char only goes up to 127 anyway...
+	for (i=0; i<GOD_DEPTHS; i++) {
 		cnt[i] = 0;
 	}
 	cnt[0] = 1;
@@ -135,136 +165,364 @@ static bool godTable(Position& solved, MoveList& moves, PieceTypes& datasets, st
 		distance[packPosition(solved, subSizes, datasets)] = 0;
 	} else if (dataStructure==1) {
 		distMap1[packPosition(solved, subSizes, datasets)] = 0;
+		buckets1[0].push_back(packPosition(solved, subSizes, datasets));
 	} else if (dataStructure==2) {
 		distMap2[packPosition2(solved, datasets, 0)] = 0;
+		buckets2[0].push_back(packPosition2(solved, datasets, 0));
+	} else if (dataStructure==3) {
+		antipodeIndices.push_back(packPosition(solved, subSizes, datasets));
+		claimCode(codes, antipodeIndices[0], 0);
+	} else if (dataStructure==4) {
+		disk->start();
+	} else if (dataStructure==5) {
+		sparse->start();
 	}
 	std::cout << "Moves\tPositions\n";
 	std::cout << depth << "\t" << cnt[depth] << "\n"<<std::flush;
 	
+	// Pick up where an earlier run left off. Only the arrays and the runs
+	// on disk are checkpointed; the cosets keep their own progress.
+	char *checkpointData = dataStructure == 0 ? (char *)distance : (char *)codes;
+	long long checkpointBytes = dataStructure == 0 ? totalSize : dataStructure == 3 ? 8 * ((totalSize + 31) / 32) : 0;
+	bool checkpointed = dataStructure == 0 || dataStructure == 3 || dataStructure == 4;
+	// a forked writer can end up with its own copy of the whole array, so it
+	// is only used when that copy fits in -M as well
+	long long expandedBytes = expanded != NULL ? 4 * ((totalSize + 31) / 32) : 0;
+	bool background = checkpointBytes > 0 && 2 * (checkpointBytes + expandedBytes) <= options.maxmem;
+	if (options.writeCheckpoints && !checkpointed && dataStructure != 6)
+		std::cout << "Checkpoints are only written for arrays and runs on disk.\n";
+	if (options.resumeCheckpoint && checkpointed
+			&& loadGodCheckpoint(checkpointFile, hash, metric, dataStructure, totalSize, depth, cnt, checkpointData, checkpointBytes, antipodeIndices, disk)) {
+		std::cout << "Resuming from " << checkpointFile << ".\n";
+		for (int d = 1; d <= depth; d++)
+			std::cout << d << "\t" << cnt[d] << "\n";
+		std::cout << std::flush;
+	} else if (dataStructure == 6 && options.resumeCheckpoint && cosets->resume(depth, cnt)) {
+		std::cout << "Resuming from the cosets in " << options.scratchDir << ".\n";
+		for (int d = 1; d <= depth; d++)
+			std::cout << d << "\t" << cnt[d] << "\n";
+		std::cout << std::flush;
+	} else if (dataStructure == 6) {
+		cosets->start();
+	}
+	
 	// Loop through depths
 	if (dataStructure==0) {
 		while (1) {
-			// look for positions at this depth
-			for (i=0; i<totalSize; i++) {
-				if (distance[i] == depth) {
-					unpackPosition(temp1, i, subSizes, datasets, solved);
+			// look for positions at this depth; threads take ranges of the
+			// array, claim new positions with compare-and-swap so each one
+			// is counted once, and keep their own counts until the level ends
+			#pragma omp parallel
+			{
+				long long localCnt[128];
+				for (int d = 0; d < 128; d++)
+					localCnt[d] = 0;
+				Position from(solved.size()), to(solved.size());
+				for (int iter3 = 0; iter3 < solved.size(); iter3++) {
+					from[iter3] = newSubstate(solved[iter3].size);
+					to[iter3] = newSubstate(solved[iter3].size);
+				}
+
+				#pragma omp for schedule(dynamic, 65536)
+				for (long long j=0; j<totalSize; j++) {
+					if (distance[j] != depth)
+						continue;
+					unpackPosition(from, j, subSizes, datasets, solved);
 					// try all possible moves and see if that position hasn't been visited
-					for (moveIter = moves.begin(); moveIter != moves.end(); moveIter++){
+					MoveList::iterator localIter;
+					for (localIter = moves.begin(); localIter != moves.end(); localIter++){
 						if (using_blocks) // see if the blocks will prevent this move
-							if (!blockLegal(temp1, blocks, moveIter->second.state))
+							if (!blockLegal(from, blocks, localIter->second.state))
 								continue;
 					
 						// apply move and pack new position
-						applyMove(temp1, temp2, moveIter->second.state, datasets);
-						long long packTemp = packPosition(temp2, subSizes, datasets);
+						applyMove(from, to, localIter->second.state, datasets);
+						long long packTemp = packPosition(to, subSizes, datasets);
 						
 						if (metric == 0) { // HTM
-							if (distance[packTemp] == -1) { // not visited yet
-								cnt[depth+1]++;
-								distance[packTemp] = depth+1;
-							}
+							if (distance[packTemp] == -1 // not visited yet
+									&& __sync_bool_compare_and_swap(&distance[packTemp], (signed char)-1, (signed char)(depth+1)))
+								localCnt[depth+1]++;
 						} else if (metric == 1) { // QTM
-							int newDepth = depth + moveIter->second.qtm;
-							if (distance[packTemp] == -1 || distance[packTemp] > newDepth) {
-								cnt[newDepth]++;
-								distance[packTemp] = newDepth;
+							signed char newDepth = depth + localIter->second.qtm;
+							signed char old = distance[packTemp];
+							while (old == -1 || old > newDepth) {
+								if (__sync_bool_compare_and_swap(&distance[packTemp], old, newDepth)) {
+									localCnt[newDepth]++;
+									if (old != -1) // found a shorter way to a position of a later depth
+										localCnt[old]--;
+									break;
+								}
+								old = distance[packTemp];
 							}
 						}
 					}
 				}
+
+				for (int iter3 = 0; iter3 < solved.size(); iter3++) {
+					delete []from[iter3].permutation;
+					delete []from[iter3].orientation;
+					delete []to[iter3].permutation;
+					delete []to[iter3].orientation;
+				}
+				#pragma omp critical
+				{
+					for (int d = 0; d < 128; d++)
+						cnt[d] += localCnt[d];
+				}
 			}
 			
 			// increment depth and print
 			depth++;
-			if (cnt[depth] == 0) break;
+			if (!bucketsLeft(cnt, depth)) break;
 			std::cout << depth << "\t" << cnt[depth] << "\n" << std::flush;
+			if (options.writeCheckpoints)
+				saveGodCheckpoint(checkpointFile, hash, metric, dataStructure, totalSize, depth, cnt, checkpointData, checkpointBytes, antipodeIndices, disk, background);
 		}
 	} else if (dataStructure==1) {
 		while (1) {
-			// look for positions at this depth
-			std::map<long long, signed char>::iterator mapIter;
-			for (mapIter = distMap1.begin(); mapIter != distMap1.end(); mapIter++) {
-				if (mapIter->second == depth) {
-					unpackPosition(temp1, mapIter->first, subSizes, datasets, solved);
-					// try all possible moves and see if that position hasn't been visited
-					
-					for (moveIter = moves.begin(); moveIter != moves.end(); moveIter++){
-						if (using_blocks) // see if the blocks will prevent this move
-							if (!blockLegal(temp1, blocks, moveIter->second.state))
-								continue;
+			// expand the positions at this depth
+			std::vector<long long> bucket;
+			bucket.swap(buckets1[depth]);
+			std::sort(bucket.begin(), bucket.end()); // look them up in the order of the map
+			for (std::size_t b = 0; b < bucket.size(); b++) {
+				if (distMap1[bucket[b]] != depth) // since found closer to solved
+					continue;
+				unpackPosition(temp1, bucket[b], subSizes, datasets, solved);
+				// try all possible moves and see if that position hasn't been visited
+				for (moveIter = moves.begin(); moveIter != moves.end(); moveIter++){
+					if (using_blocks) // see if the blocks will prevent this move
+						if (!blockLegal(temp1, blocks, moveIter->second.state))
+							continue;
+				
+					// apply move and pack new position
+					applyMove(temp1, temp2, moveIter->second.state, datasets);
+					long long packTemp = packPosition(temp2, subSizes, datasets);
 					
-						// apply move and pack new position
-						applyMove(temp1, temp2, moveIter->second.state, datasets);
-						long long packTemp = packPosition(temp2, subSizes, datasets);
-						
-						if (metric == 0) { // HTM
-							if (distMap1.find(packTemp) == distMap1.end()) { // not visited yet
-								cnt[depth+1]++;
-								distMap1[packTemp] = depth+1;
-							}
-						} else if (metric == 1) { // QTM
-							int newDepth = depth + moveIter->second.qtm;
-							if (distMap1.find(packTemp) == distMap1.end()) {
-								cnt[newDepth]++;
-								distMap1[packTemp] = newDepth;
-							} else if (distMap1[packTemp] > newDepth) {
-								cnt[newDepth]++;
-								distMap1[packTemp] = newDepth;
-							}
-						}
+					int newDepth = depth + (metric == 0 ? 1 : moveIter->second.qtm);
+					std::map<long long, signed char>::iterator found = distMap1.find(packTemp);
+					if (found == distMap1.end()) { // not visited yet
+						distMap1[packTemp] = newDepth;
+					} else if (found->second > newDepth) { // QTM: closer than thought
+						cnt[found->second]--;
+						found->second = newDepth;
+					} else {
+						continue;
 					}
+					cnt[newDepth]++;
+					buckets1[newDepth].push_back(packTemp);
 				}
 			}
 			
 			// increment depth and print
 			depth++;
-			if (cnt[depth] == 0) break;
+			if (!bucketsLeft(cnt, depth)) break;
 			std::cout << depth << "\t" << cnt[depth] << "\n" << std::flush;
 		}
 	} else if (dataStructure==2) {
 		while (1) {
-			// look for positions at this depth
-			std::map<std::vector<long long>, signed char>::iterator mapIter;
-			for (mapIter = distMap2.begin(); mapIter != distMap2.end(); mapIter++) {
-				if (mapIter->second == depth) {
-					unpackPosition2(temp1, mapIter->first, datasets);
-					// try all possible moves and see if that position hasn't been visited
-					for (moveIter = moves.begin(); moveIter != moves.end(); moveIter++){
-						if (using_blocks) // see if the blocks will prevent this move
-							if (!blockLegal(temp1, blocks, moveIter->second.state))
-								continue;
+			// expand the positions at this depth
+			std::vector<std::vector<long long> > bucket;
+			bucket.swap(buckets2[depth]);
+			std::sort(bucket.begin(), bucket.end()); // look them up in the order of the map
+			for (std::size_t b = 0; b < bucket.size(); b++) {
+				if (distMap2[bucket[b]] != depth) // since found closer to solved
+					continue;
+				unpackPosition2(temp1, bucket[b], datasets);
+				// try all possible moves and see if that position hasn't been visited
+				for (moveIter = moves.begin(); moveIter != moves.end(); moveIter++){
+					if (using_blocks) // see if the blocks will prevent this move
+						if (!blockLegal(temp1, blocks, moveIter->second.state))
+							continue;
+				
+					// apply move and pack new position
+					applyMove(temp1, temp2, moveIter->second.state, datasets);
+					std::vector<long long> packTemp = packPosition2(temp2, datasets, bucket[b].size());
 					
-						// apply move and pack new position
-						applyMove(temp1, temp2, moveIter->second.state, datasets);
-						std::vector<long long> packTemp = packPosition2(temp2, datasets, mapIter->first.size());
-						
-						if (metric == 0) { // HTM
-							if (distMap2.find(packTemp) == distMap2.end()) { // not visited yet
-								cnt[depth+1]++;
-								distMap2[packTemp] = depth+1;
+					int newDepth = depth + (metric == 0 ? 1 : moveIter->second.qtm);
+					std::map<std::vector<long long>, signed char>::iterator found = distMap2.find(packTemp);
+					if (found == distMap2.end()) { // not visited yet
+						distMap2[packTemp] = newDepth;
+					} else if (found->second > newDepth) { // QTM: closer than thought
+						cnt[found->second]--;
+						found->second = newDepth;
+					} else {
+						continue;
+					}
+					cnt[newDepth]++;
+					buckets2[newDepth].push_back(packTemp);
+				}
+			}
+			
+			// increment depth and print
+			depth++;
+			if (!bucketsLeft(cnt, depth)) break;
+			std::cout << depth << "\t" << cnt[depth] << "\n" << std::flush;
+		}
+	} else if (dataStructure==3) {
+		// An expanded position keeps its code, so the positions with the code
+		// of this depth include those 3, 6, ... moves closer. The expanded
+		// bits, where there is room for them, tell those apart. Once there
+		// are fewer unvisited positions than positions to expand, it is
+		// cheaper to look for unvisited positions next to this depth instead.
+		// That needs every move to have an inverse among the moves, and no
+		// blocks.
+		long long words = (totalSize + 31) / 32;
+		long long unvisited = totalSize;
+		for (int d = 0; d <= depth; d++)
+			unvisited -= cnt[d];
+		bool canSearchBackward = !using_blocks && movesHaveInverses(moves, datasets);
+		if (expanded != NULL) {
+			// the depths before this one are done (also when resuming), but
+			// the ones 3, 6, ... closer cannot be told from it by their code
+			#pragma omp parallel for schedule(static)
+			for (long long w = 0; w < words; w++) {
+				unsigned long long done = ~matchCodes(codes[w], 3) & ~matchCodes(codes[w], depth % 3) & 0x5555555555555555ULL;
+				expanded[w] = 0;
+				for (; done; done &= done - 1)
+					expanded[w] |= 1u << (__builtin_ctzll(done) / 2);
+			}
+		}
+		while (1) {
+			int code = depth % 3, nextCode = (depth + 1) % 3;
+			long long toExpand = cnt[depth]; // and without the expanded bits, those 3, 6, ... closer
+			if (expanded == NULL)
+				for (int d = depth - 3; d >= 0; d -= 3)
+					toExpand += cnt[d];
+			bool backward = canSearchBackward && unvisited < toExpand;
+			std::vector<long long> newest; // smallest indices reached at depth+1, kept as antipode candidates
+			
+			#pragma omp parallel
+			{
+				long long localCnt[128];
+				for (int d = 0; d < 128; d++)
+					localCnt[d] = 0;
+				std::vector<long long> localNewest;
+				Position from(solved.size()), to(solved.size());
+				for (int iter3 = 0; iter3 < solved.size(); iter3++) {
+					from[iter3] = newSubstate(solved[iter3].size);
+					to[iter3] = newSubstate(solved[iter3].size);
+				}
+
+				#pragma omp for schedule(dynamic, 4096)
+				for (long long w = 0; w < words; w++) {
+					// skip words with no position to look at
+					for (unsigned long long found = matchCodes(codes[w], backward ? 3 : code); found; found &= found - 1) {
+						int k = __builtin_ctzll(found) / 2;
+						long long j = w * 32 + k;
+						if (j >= totalSize)
+							break;
+						if (!backward && expanded != NULL) { // each word is only looked at by one thread
+							if (expanded[w] >> k & 1)
+								continue;
+							expanded[w] |= 1u << k;
+						}
+						unpackPosition(from, j, subSizes, datasets, solved);
+						MoveList::iterator localIter;
+						for (localIter = moves.begin(); localIter != moves.end(); localIter++){
+							if (using_blocks) // see if the blocks will prevent this move
+								if (!blockLegal(from, blocks, localIter->second.state))
+									continue;
+							
+							applyMove(from, to, localIter->second.state, datasets);
+							long long packTemp = packPosition(to, subSizes, datasets);
+							
+							long long reached = -1;
+							if (backward) {
+								if (getCode(codes, packTemp) == code && claimCode(codes, j, nextCode))
+									reached = j;
+							} else if (getCode(codes, packTemp) == 3 && claimCode(codes, packTemp, nextCode)) {
+								reached = packTemp;
 							}
-						} else if (metric == 1) { // QTM
-							int newDepth = depth + moveIter->second.qtm;
-							if (distMap2.find(packTemp) == distMap2.end()) {
-								cnt[newDepth]++;
-								distMap2[packTemp] = newDepth;
-							} else if (distMap2[packTemp] > newDepth) {
-								cnt[distMap2[packTemp]]--;
-								cnt[newDepth]++;
-								distMap2[packTemp] = newDepth;
+							if (reached >= 0) {
+								localCnt[depth+1]++;
+								keepSmallest(localNewest, reached, 5);
+								if (backward)
+									break;
 							}
 						}
 					}
 				}
+
+				for (int iter3 = 0; iter3 < solved.size(); iter3++) {
+					delete []from[iter3].permutation;
+					delete []from[iter3].orientation;
+					delete []to[iter3].permutation;
+					delete []to[iter3].orientation;
+				}
+				#pragma omp critical
+				{
+					for (int d = 0; d < 128; d++)
+						cnt[d] += localCnt[d];
+					for (unsigned int n = 0; n < localNewest.size(); n++)
+						keepSmallest(newest, localNewest[n], 5);
+				}
 			}
 			
 			// increment depth and print
 			depth++;
 			if (cnt[depth] == 0) break;
+			unvisited -= cnt[depth];
+			antipodeIndices = newest;
+			std::cout << depth << "\t" << cnt[depth] << "\n" << std::flush;
+			if (options.writeCheckpoints)
+				saveGodCheckpoint(checkpointFile, hash, metric, dataStructure, totalSize, depth, cnt, checkpointData, checkpointBytes, antipodeIndices, disk, background);
+		}
+	} else if (dataStructure==4 || dataStructure==5) {
+		while (1) {
+			// expand this depth, then sort out the positions of the next one
+			if (disk)
+				disk->expand(depth);
+			else
+				sparse->expand(depth);
+			
+			// increment depth and print
+			depth++;
+			cnt[depth] = disk ? disk->finish(depth) : sparse->finish(depth);
+			// positions found for later depths (QTM) may still be new
+			if (cnt[depth] == 0 && (disk ? disk->pending.empty() : sparse->pending.empty())) break;
+			if (cnt[depth] != 0) {
+				int empty = depth; // print the empty depths before this one
+				while (cnt[empty - 1] == 0)
+					empty--;
+				for (; empty < depth; empty++)
+					std::cout << empty << "\t0\n";
+				std::cout << depth << "\t" << cnt[depth] << "\n" << std::flush;
+			}
+			if (options.writeCheckpoints && checkpointed)
+				saveGodCheckpoint(checkpointFile, hash, metric, dataStructure, totalSize, depth, cnt, checkpointData, checkpointBytes, antipodeIndices, disk, background);
+			// the runs just merged are only needed to resume from the checkpoint before
+			if (disk)
+				disk->removeMerged();
+		}
+	} else if (dataStructure==6) {
+		while (1) {
+			// fill in each coset from the positions at this depth
+			cosets->expand(depth, cnt);
+			
+			// increment depth and print
+			depth++;
+			if (!bucketsLeft(cnt, depth)) break;
 			std::cout << depth << "\t" << cnt[depth] << "\n" << std::flush;
 		}
 	}
 	
+	while (cnt[depth - 1] == 0) // the runs of the last depths held no new positions
+		depth--;
+	
+	// number the positions reached, and give each its distance
+	perfectHash sparseIndex;
+	std::vector<unsigned char> sparseDistance;
+	if (dataStructure == 5)
+		sparse->buildIndex(sparseIndex, sparseDistance);
+	
+	// keep the distances, so that scrambles of this puzzle can be solved from them
+	if (dataStructure == 0 || dataStructure == 3)
+		saveOracle(oracleFile, hash, metric, dataStructure, totalSize, depth - 1, checkpointData, checkpointBytes, NULL);
+	else if (dataStructure == 5)
+		saveOracle(oracleFile, hash, metric, sparse->ranked ? 6 : 5, sparseIndex.keys, depth - 1,
+				(const char *)&sparseDistance[0], sparseDistance.size(), &sparseIndex);
+	
 	// print total number of positions
 	long long totalPositions = 0;
 	for (i=0; i<128; i++) {
@@ -423,16 +681,130 @@ static bool godTable(Position& solved, MoveList& moves, PieceTypes& datasets, st
 		}
 		
 		distMap2.clear();
+	} else if (dataStructure==3) {
+		// the depth is only known mod 3, but a neighbor one move closer is
+		// the only one with the code of depth-1
+		for (unsigned int n = 0; n < antipodeIndices.size() && n < antipodes; n++) {
+			unpackPosition(temp1, antipodeIndices[n], subSizes, datasets, solved);
+			Position curPos = temp1;
+			Position nextPos(solved.size()) ;
+			
+			// find a solution
+			std::cout << "Antipode solved by";
+			int curDepth = depth - 1;
+			
+			while (curDepth > 0) {
+				// try all moves to see which leads to depth-1
+				int minIndex = -1;
+				for (int iter3=0; iter3<solved.size(); iter3++) {
+					nextPos[iter3] = newSubstate(solved[iter3].size);
+				}
+				for (moveIter = moves.begin(); moveIter != moves.end(); moveIter++){
+					if (using_blocks) // see if the blocks will prevent this move
+						if (!blockLegal(curPos, blocks, moveIter->second.state))
+							continue;
+					
+					applyMove(curPos, nextPos, moveIter->second.state, datasets);
+					if (getCode(codes, packPosition(nextPos, subSizes, datasets)) == (curDepth - 1) % 3) {
+						minIndex = moveIter->first;
+						break;
+					}
+				}
+				
+				// apply best move
+				applyMove(curPos, nextPos, moves[minIndex].state, datasets);
+				curPos = nextPos;
+				curDepth--;
+				std::cout << " " << moves[minIndex].name;
+			}
+			
+			std::cout << ":\n";
+			printPosition(temp1);
+			std::cout << "\n";
+		}
+		delete []codes;
+		delete []expanded;
+	} else if (dataStructure==4) {
+		disk->printAntipodes(depth - 1, antipodes);
+		disk->cleanup(depth);
+		delete disk;
+	} else if (dataStructure==5) {
+		sparse->printAntipodes(depth - 1, antipodes, sparseIndex, sparseDistance);
+		delete sparse;
+	} else if (dataStructure==6) {
+		cosets->printAntipodes(depth - 1, antipodes);
+		cosets->cleanup();
+		delete cosets;
+	}
+	
+	// the table is done, so its checkpoint is not needed any more
+	if (options.writeCheckpoints && checkpointed) {
+		waitForCheckpoint();
+		remove(checkpointFile.c_str());
 	}
 	
 	delete []cnt;
 	return true;
 }
 
+// The parts of the index of a whole-puzzle position, in the order they are packed
+static void computeSubSizes(Position& solved, PieceTypes& datasets, std::map<std::pair<int, int>, long long>& subSizes){
+	// this pair<intg,int> holds the piece set name and the type of data:
+	//		0 (orientation with parity constraint),
+	//		1 (orientation without parity constraint),
+	//		2 (unique permutation),
+	//		3 (non-unique permutation),
+	//		4 (unique permutation with parity constraint),
+	//		5 (unique permutation whose parity follows from other sets)
+	for (int iter=0; iter<solved.size(); iter++) {
+		int size = solved[iter].size;
+		if (datasets[iter].oparity) {
+			// Orientation, parity constraint
+			long long tablesize = 1;
+			for (int i = 0; i < size - 1; i++)
+				tablesize *= datasets[iter].omod;
+			subSizes.insert(std::pair<std::pair<int, int>, long long>
+					(std::pair<int, int> (iter, 0), tablesize));
+		} else {
+			// Orientation, no parity constraint
+			long long tablesize = 1;
+			for (int i = 0; i < size; i++)
+				tablesize *= datasets[iter].omod;
+			subSizes.insert(std::pair<std::pair<int, int>, long long>
+					(std::pair<int, int> (iter, 1), tablesize));
+		}
+		
+		if (factorial(datasets[iter].size) != -1 && uniquePermutation(solved[iter].permutation, size)){
+			// Permutation, unique pieces
+			std::vector<int> temp_perm (size);
+			for (int i = 0; i < size; i++)
+				temp_perm[i] = solved[iter].permutation[i];
+			long long tablesize = factorial(size);
+			if (datasets[iter].pparity && size > 1) {
+			   subSizes.insert(std::pair<std::pair<int, int>, long long>
+				(std::pair<int, int> (iter, 4), tablesize>>1));
+			} else if (datasets[iter].parityWith.size() != 0) {
+			   subSizes.insert(std::pair<std::pair<int, int>, long long>
+				(std::pair<int, int> (iter, 5), tablesize>>1));
+			} else {
+			   subSizes.insert(std::pair<std::pair<int, int>, long long>
+				(std::pair<int, int> (iter, 2), tablesize));
+			}
+		}
+		else {
+			// Permutation, not unique pieces
+			long long tablesize = combinations(solved[iter].permutation, size);
+			subSizes.insert(std::pair<std::pair<int, int>, long long>
+				(std::pair<int, int> (iter, 3), tablesize));
+		}
+	}
+}
+
 // "Pack" a full-puzzle position - convert it from a position into a number
 static long long packPosition(Position& position, std::map<std::pair<int, int>, long long> &subSizes, PieceTypes& datasets) {
 	std::map<std::pair<int, int>, long long>::iterator iter;
 	long long packed = 0;
+	std::vector<int> buffer;
 	for (iter = subSizes.begin(); iter != subSizes.end(); iter++) {
 		// multiply by the size of this part
 		packed *= iter->second;
@@ -441,12 +813,12 @@ static long long packPosition(Position& position, std::map<std::pair<int, int>,
 		if (iter->first.second == 0) {
 			packed += oparVector2Index(position[iter->first.first].orientation, position[iter->first.first].size, datasets[iter->first.first].omod);
 		} else if (iter->first.second == 1) {
-			packed += oVector2Index(position[iter->first.first].orientation, position[iter->first.first].size, datasets[iter->first.first].omod);
+			packed += oVector2Index(keptOrientation(position[iter->first.first], datasets[iter->first.first], buffer), position[iter->first.first].size, datasets[iter->first.first].omod);
 		} else if (iter->first.second == 2) {
 			packed += pVector2Index(position[iter->first.first].permutation, position[iter->first.first].size);
 		} else if (iter->first.second == 3) {
-			packed += pVector3Index(position[iter->first.first].permutation, position[iter->first.first].size);
-		} else if (iter->first.second == 4) {
+			packed += pVector3Index(position[iter->first.first].permutation, position[iter->first.first].size, datasets[iter->first.first].prank);
+		} else if (iter->first.second == 4 || iter->first.second == 5) {
 			packed += pVector2IndexP(position[iter->first.first].permutation, position[iter->first.first].size) ;
 		} else {
 			std::cerr << "Something wrong with these subSizes!\n";
@@ -461,6 +833,7 @@ static long long packPosition(Position& position, std::map<std::pair<int, int>,
 static std::vector<long long> packPosition2(Position& position, PieceTypes& datasets, int siz) {
 	std::vector<long long> packed ;
 	packed.reserve(siz) ;
+	std::vector<int> buffer ;
 	unsigned long long accum = 0 ;
 	int bitAt = 0 ;
 	PieceTypes::iterator iter2;
@@ -481,7 +854,7 @@ static std::vector<long long> packPosition2(Position& position, PieceTypes& data
                 }
 		int oriBits = iter2->second.oribits ;
 		if (oriBits) {
-			int *ori = s.orientation ;
+			int *ori = keptOrientation(s, iter2->second, buffer) ;
 			int oriMask = (1<<oriBits)-1 ;
 			for (int i=0; i<n; i++) {
                         	if (bitAt + oriBits > 64) {
@@ -518,14 +891,21 @@ static void unpackPosition(Position &unpacked, long long position, std::map<std:
 		} else if (iter->first.second == 2) {
 			pIndex2Array(curIndex, size, unpacked[iter->first.first].permutation);
 		} else if (iter->first.second == 3) {
-			pIndex3Array(curIndex, solved[iter->first.first].permutation, solved[iter->first.first].size, unpacked[iter->first.first].permutation);
-		} else if (iter->first.second == 4) {
+			pIndex3Array(curIndex, size, datasets[iter->first.first].prank, unpacked[iter->first.first].permutation);
+		} else if (iter->first.second == 4 || iter->first.second == 5) {
 			pIndex2ArrayP(curIndex, size, unpacked[iter->first.first].permutation);
 		} else {
 			std::cerr << "Something wrong with these subSizes!\n";
 			exit(-1);
 		}	
 	}
+	
+	// the sets packed without their parity get the one the other sets give
+	for (iter = subSizes.rbegin(); iter != subSizes.rend(); iter++) {
+		substate &sub = unpacked[iter->first.first];
+		if (iter->first.second == 5 && permutationParity(sub.permutation, sub.size) != linkedParity(unpacked, solved, datasets, iter->first.first))
+			std::swap(sub.permutation[sub.size - 2], sub.permutation[sub.size - 1]);
+	}
 }
 
 // "Unpack" a full-puzzle position - convert it from a number into a *vector*
@@ -563,8 +943,242 @@ static void unpackPosition2(Position &unpacked, const std::vector<long long> &po
                       	(((unsigned long long)position[positionAt]) >> bitAt) ;
                         	bitAt += oriBits ;
 			}
-                }
+                } else {
+			for (int i=0; i<n; i++)
+				ori[i] = 0 ;
+		}
+	}
+}
+
+// The writer of the last checkpoint, if it may still be running
+static pid_t &checkpointWriter() {
+	static pid_t pid = 0;
+	return pid;
+}
+
+static void waitForCheckpoint() {
+#ifndef __EMSCRIPTEN__
+	if (checkpointWriter() > 0) {
+		int status;
+		waitpid(checkpointWriter(), &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			std::cerr << "Warning: writing the last checkpoint failed.\n";
+		checkpointWriter() = 0;
 	}
+#endif
+}
+
+// Write header and data to filename.tmp, then rename it over filename, so a
+// checkpoint file is always complete
+static bool writeCheckpointFile(const string &filename, const string &header, const char *data, long long bytes) {
+	string temporary = filename + ".tmp";
+	int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return false;
+	const char *parts[2] = {header.data(), data};
+	long long sizes[2] = {(long long)header.size(), bytes};
+	for (int part = 0; part < 2; part++) {
+		for (long long done = 0; done < sizes[part]; ) {
+			ssize_t n = write(fd, parts[part] + done, (std::size_t)std::min(sizes[part] - done, 1LL << 30));
+			if (n <= 0) {
+				close(fd);
+				return false;
+			}
+			done += n;
+		}
+	}
+	if (fsync(fd) != 0 || close(fd) != 0)
+		return false;
+	return rename(temporary.c_str(), filename.c_str()) == 0;
+}
+
+// Save a God's Algorithm run after finishing a depth: the counts (also of
+// the depths beyond it that QTM moves have reached already), the
+// array (or the runs on disk still to be merged) and the antipode
+// candidates of the 2-bit array. In the background, the file is written by
+// a forked copy of the process, which sees the array as it is now while the
+// next depth is computed; otherwise it is written before returning.
+static void saveGodCheckpoint(const string &filename, unsigned long long hash, int metric, int dataStructure, long long totalSize, int depth,
+		long long *cnt, const char *data, long long bytes, std::vector<long long> &indices, diskBFS *disk, bool background) {
+	std::ostringstream header;
+	header << "ksolve-god " << GOD_CHECKPOINT_VERSION << " " << hash << " " << metric << " " << dataStructure << " " << totalSize << " " << depth << "\n";
+	for (int d = 0; d < GOD_DEPTHS; d++)
+		header << cnt[d] << " ";
+	header << "\n" << indices.size();
+	for (unsigned int i = 0; i < indices.size(); i++)
+		header << " " << indices[i];
+	header << "\n";
+	if (disk != NULL) {
+		header << disk->pending.size() << "\n";
+		std::map<int, std::vector<string> >::iterator iter;
+		for (iter = disk->pending.begin(); iter != disk->pending.end(); iter++) {
+			header << iter->first << " " << iter->second.size() << "\n";
+			for (unsigned int i = 0; i < iter->second.size(); i++)
+				header << iter->second[i] << "\n";
+		}
+	}
+	header << "data\n";
+
+	waitForCheckpoint();
+#ifdef __EMSCRIPTEN__
+	background = false; // there is no fork
+#endif
+	if (!background) {
+		if (!writeCheckpointFile(filename, header.str(), data, bytes))
+			std::cerr << "Warning: could not write checkpoint " << filename << ".\n";
+		return;
+	}
+#ifndef __EMSCRIPTEN__
+	pid_t pid = fork();
+	if (pid == 0)
+		_exit(writeCheckpointFile(filename, header.str(), data, bytes) ? 0 : 1);
+	if (pid < 0 && !writeCheckpointFile(filename, header.str(), data, bytes))
+		std::cerr << "Warning: could not write checkpoint " << filename << ".\n";
+	checkpointWriter() = pid > 0 ? pid : 0;
+#endif
+}
+
+// Load a checkpoint written by saveGodCheckpoint for this same table; false
+// if there is none, or it belongs to another table
+static bool loadGodCheckpoint(const string &filename, unsigned long long hash, int metric, int dataStructure, long long totalSize, int &depth,
+		long long *cnt, char *data, long long bytes, std::vector<long long> &indices, diskBFS *disk) {
+	std::ifstream in(filename.c_str(), std::ios::binary);
+	if (!in.good())
+		return false;
+	string magic;
+	int version, savedMetric, savedStructure, savedDepth;
+	long long savedSize;
+	unsigned long long savedHash;
+	in >> magic >> version;
+	if (in.fail() || magic != "ksolve-god" || version != GOD_CHECKPOINT_VERSION) {
+		std::cout << "Checkpoint " << filename << " is from another version, starting over.\n";
+		return false;
+	}
+	in >> savedHash >> savedMetric >> savedStructure >> savedSize >> savedDepth;
+	if (in.fail() || savedHash != hash || savedMetric != metric
+			|| savedStructure != dataStructure || savedSize != totalSize || savedDepth < 0 || savedDepth >= 127) {
+		std::cout << "Checkpoint " << filename << " is for another table, starting over.\n";
+		return false;
+	}
+	for (int d = 0; d < GOD_DEPTHS; d++)
+		in >> cnt[d];
+	std::size_t n;
+	in >> n;
+	indices.resize(n);
+	for (std::size_t i = 0; i < n; i++)
+		in >> indices[i];
+	if (disk != NULL) {
+		int depths;
+		in >> depths;
+		disk->pending.clear();
+		for (int d = 0; d < depths; d++) {
+			int pendingDepth;
+			std::size_t runs;
+			in >> pendingDepth >> runs;
+			std::vector<string> &names = disk->pending[pendingDepth];
+			names.resize(runs);
+			for (std::size_t i = 0; i < runs; i++)
+				in >> names[i];
+		}
+	}
+	string marker;
+	in >> marker;
+	in.get(); // the newline after "data"
+	if (marker != "data")
+		in.setstate(std::ios::failbit);
+	for (long long done = 0; done < bytes && in.good(); ) {
+		std::streamsize chunk = (std::streamsize)std::min(bytes - done, 1LL << 30);
+		in.read(data + done, chunk);
+		done += in.gcount();
+	}
+	if (in.fail()) {
+		std::cerr << "Checkpoint " << filename << " is damaged.\n";
+		exit(-1);
+	}
+	depth = savedDepth;
+	return true;
+}
+
+// Codes of the 2-bit God's Algorithm array: 0, 1, 2 give the depth mod 3,
+// and 3 marks a position not visited yet
+static inline int getCode(const unsigned long long *codes, long long i) {
+	return (codes[i >> 5] >> ((i & 31) * 2)) & 3;
+}
+
+// Give an unvisited position a code; false if it was visited already,
+// possibly by another thread
+static inline bool claimCode(unsigned long long *codes, long long i, int code) {
+	unsigned long long *word = &codes[i >> 5];
+	int shift = (i & 31) * 2;
+	while (1) {
+		unsigned long long old = *word;
+		if (((old >> shift) & 3) != 3)
+			return false;
+		if (__sync_bool_compare_and_swap(word, old, old ^ ((unsigned long long)(3 ^ code) << shift)))
+			return true;
+	}
+}
+
+// Bit 2k of the result is set when position k of a word of codes has code
+static inline unsigned long long matchCodes(unsigned long long word, int code) {
+	unsigned long long x = word ^ (0x5555555555555555ULL * code);
+	return ~(x | (x >> 1)) & 0x5555555555555555ULL;
+}
+
+// Keep the n smallest values seen, in order
+static void keepSmallest(std::vector<long long> &smallest, long long value, unsigned int n) {
+	if (smallest.size() == n && value >= smallest.back())
+		return;
+	smallest.insert(std::lower_bound(smallest.begin(), smallest.end(), value), value);
+	if (smallest.size() > n)
+		smallest.pop_back();
+}
+
+// Is the inverse of every move also a move?
+static bool movesHaveInverses(MoveList& moves, PieceTypes& datasets) {
+	MoveList::iterator m1, m2;
+	for (m1 = moves.begin(); m1 != moves.end(); m1++) {
+		Position &first = m1->second.state;
+		Position product(first.size());
+		for (int iter = 0; iter < first.size(); iter++)
+			product[iter] = newSubstate(first[iter].size);
+		bool found = false;
+		for (m2 = moves.begin(); m2 != moves.end() && !found; m2++) {
+			applyMove(first, product, m2->second.state, datasets);
+			found = true;
+			for (int iter = 0; iter < first.size() && found; iter++)
+				for (int i = 0; i < first[iter].size; i++)
+					if (product[iter].permutation[i] != i + 1
+							|| (datasets[iter].omod > 1 && product[iter].orientation[i] % datasets[iter].omod != 0))
+						found = false;
+		}
+		for (int iter = 0; iter < first.size(); iter++) {
+			delete []product[iter].permutation;
+			delete []product[iter].orientation;
+		}
+		if (!found)
+			return false;
+	}
+	return true;
+}
+
+// The permutation parity a set must have, from the sets it follows
+static int linkedParity(Position& position, Position& solved, PieceTypes& datasets, int set) {
+	std::vector<int> &with = datasets[set].parityWith;
+	int parity = permutationParity(solved[set].permutation, solved[set].size);
+	for (unsigned int i = 0; i < with.size(); i++)
+		parity ^= permutationParity(position[with[i]].permutation, position[with[i]].size)
+			^ permutationParity(solved[with[i]].permutation, solved[with[i]].size);
+	return parity;
+}
+
+// Are there positions at this depth or later? With moves of more than one
+// quarter turn (QTM), a depth can be empty while later ones are not.
+static bool bucketsLeft(const long long *cnt, int depth) {
+	for (int d = depth; d < 128; d++)
+		if (cnt[d] != 0)
+			return true;
+	return false;
 }
 
 #endif
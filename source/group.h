@@ -0,0 +1,200 @@
+/*
+ KSolve+ - Puzzle solving program.
+ Copyright (C) 2007-2013 Kre Krig and Michael Gottlieb
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+// The group the moves generate, for counting the positions that can be
+// reached. Every piece slot, in each of its orientations, is a point; a
+// move permutes these points, and the positions reached from solved are
+// the elements of the group the moves generate.
+
+#ifndef GROUP_H
+#define GROUP_H
+
+typedef std::vector<int> pointPerm;
+
+// Knuth's form of the Schreier-Sims algorithm. Level k keeps the
+// generators that fix the points before k, and for every point j that k
+// can be taken to, one element of the group doing so. The order of the
+// group is the product of the number of such points at every level.
+struct stabilizerChain {
+	int n;
+	std::vector<std::vector<pointPerm> > generators;
+	std::vector<std::vector<pointPerm> > transversal; // empty where k cannot be taken to j
+
+	stabilizerChain(int n) : n(n), generators(n), transversal(n, std::vector<pointPerm>(n)) {
+		for (int k = 0; k < n; k++) {
+			transversal[k][k].resize(n);
+			for (int i = 0; i < n; i++)
+				transversal[k][k][i] = i;
+		}
+	}
+
+	// a, then b
+	pointPerm compose(const pointPerm &a, const pointPerm &b) {
+		pointPerm product(n);
+		for (int i = 0; i < n; i++)
+			product[i] = b[a[i]];
+		return product;
+	}
+
+	pointPerm inverse(const pointPerm &a) {
+		pointPerm inv(n);
+		for (int i = 0; i < n; i++)
+			inv[a[i]] = i;
+		return inv;
+	}
+
+	// Is g, which fixes the points before k, in the group of level k?
+	bool contains(int k, pointPerm g) {
+		for (int i = k; i < n; i++) {
+			int j = g[i];
+			if (transversal[i][j].empty())
+				return false;
+			if (j != i)
+				g = compose(g, inverse(transversal[i][j]));
+		}
+		return true;
+	}
+
+	// Add g to the generators of level k
+	void add(int k, const pointPerm &g) {
+		if (contains(k, g))
+			return;
+		generators[k].push_back(g);
+		std::vector<int> orbit;
+		for (int j = 0; j < n; j++)
+			if (!transversal[k][j].empty())
+				orbit.push_back(j);
+		for (unsigned int j = 0; j < orbit.size(); j++)
+			extend(k, compose(transversal[k][orbit[j]], g));
+	}
+
+	// g is in the group of level k: note where it takes k, or pass what is
+	// left of it on to the next level
+	void extend(int k, const pointPerm &g) {
+		int j = g[k];
+		if (transversal[k][j].empty()) {
+			transversal[k][j] = g;
+			for (unsigned int t = 0; t < generators[k].size(); t++)
+				extend(k, compose(g, generators[k][t]));
+		} else {
+			add(k + 1, compose(g, inverse(transversal[k][j])));
+		}
+	}
+
+	// The order of the group, in decimal
+	string order() {
+		std::vector<unsigned int> digits(1, 1); // base 10^9, lowest first
+		for (int k = 0; k < n; k++) {
+			unsigned long long orbit = 0, carry = 0;
+			for (int j = 0; j < n; j++)
+				if (!transversal[k][j].empty())
+					orbit++;
+			for (unsigned int d = 0; d < digits.size(); d++) {
+				carry += digits[d] * orbit;
+				digits[d] = carry % 1000000000;
+				carry /= 1000000000;
+			}
+			if (carry > 0)
+				digits.push_back(carry);
+		}
+		std::ostringstream out;
+		out << digits.back();
+		for (int d = digits.size() - 2; d >= 0; d--) {
+			out.width(9);
+			out.fill('0');
+			out << digits[d];
+		}
+		return out.str();
+	}
+};
+
+// The group of the moves, on the points of all sets
+static stabilizerChain moveGroup(MoveList& moves, PieceTypes& datasets) {
+	std::vector<int> offset(datasets.size() + 1, 0);
+	for (unsigned int iter = 0; iter < datasets.size(); iter++)
+		offset[iter + 1] = offset[iter] + datasets[iter].size * datasets[iter].omod;
+	stabilizerChain chain(offset.back());
+	MoveList::iterator moveIter;
+	for (moveIter = moves.begin(); moveIter != moves.end(); moveIter++) {
+		Position &move = moveIter->second.state;
+		pointPerm g(offset.back());
+		for (int iter = 0; iter < move.size(); iter++) {
+			int omod = datasets[iter].omod;
+			for (int i = 0; i < move[iter].size; i++) {
+				// the piece in slot from moves to slot i, twisted
+				int from = move[iter].permutation[i] - 1;
+				for (int o = 0; o < omod; o++)
+					g[offset[iter] + from * omod + o] = offset[iter] + i * omod + ((o + move[iter].orientation[i]) % omod + omod) % omod;
+			}
+		}
+		chain.add(0, g);
+	}
+	return chain;
+}
+
+// Print what is known about the size of the puzzle: the constraints on each
+// set, the number of positions the moves reach, and how much of the index
+// used for God's Algorithm tables they fill
+static void puzzleStats(Position& solved, MoveList& moves, PieceTypes& datasets, std::vector<Block>& blocks) {
+	bool identical = false;
+	PieceTypes::iterator iter;
+	for (iter = datasets.begin(); iter != datasets.end(); iter++) {
+		dataset &set = iter->second;
+		std::cout << "Set " << setnameFromIndex(iter->first) << ": " << set.size << " pieces";
+		if (set.omod > 1)
+			std::cout << ", " << set.omod << " orientations" << (set.oparity ? " (sum fixed)" : "");
+		if (!uniquePermutation(solved[iter->first].permutation, set.size)) {
+			identical = true;
+			std::cout << ", some pieces identical";
+		} else if (set.pparity && set.size > 1) {
+			std::cout << ", permutation always even";
+		} else if (set.parityWith.size() != 0) {
+			std::cout << ", permutation parity follows from";
+			for (unsigned int i = 0; i < set.parityWith.size(); i++)
+				std::cout << " " << setnameFromIndex(set.parityWith[i]);
+		}
+		std::cout << "\n";
+	}
+
+	std::map<std::pair<int, int>, long long> subSizes;
+	computeSubSizes(solved, datasets, subSizes);
+	double logIndex = 0;
+	std::map<std::pair<int, int>, long long>::iterator iter2;
+	for (iter2 = subSizes.begin(); iter2 != subSizes.end(); iter2++)
+		logIndex += log((double)iter2->second);
+
+	string order = moveGroup(moves, datasets).order();
+	if (identical)
+		std::cout << "Positions reachable with the moves, telling identical pieces apart: " << order << "\n";
+	else
+		std::cout << "Positions reachable with the moves: " << order << "\n";
+	if (blocks.size() != 0)
+		std::cout << "(Blocks can keep some of them from being reached.)\n";
+	std::cout << "Size of the index for God's Algorithm tables: " << exp(logIndex) << "\n";
+	if (!identical && blocks.size() == 0) {
+		double fill = exp(log(atof(order.c_str())) - logIndex);
+		if (fill < 0.999999) {
+			std::cout << "Only 1 in " << 1 / fill << " of the index can be reached.\n";
+			std::cout << "(The index leaves out parity links only; other constraints are not removed.)\n";
+		} else
+			std::cout << "All of the index can be reached.\n";
+	}
+}
+
+#endif
@@ -171,136 +171,188 @@ static int *pIndex2ArrayP(long long ind, int n, int *perm=0) {
 	return perm ;
 }
 
-// Convert permutation vector (non-unique) into an index
-static long long pVector3Index(std::vector<int> permutation) {
-	return pVector3Index(permutation.data(), permutation.size());
+static long long factorial(long long x) {
+	if (x <= 1)
+		return 1;
+	else if (x > 20)
+		return -1;  // Would overflow a long long
+		
+	static const long long fac[21] = {1LL, 1LL, 2LL, 6LL, 24LL, 120LL,
+		720LL, 5040LL, 40320LL, 362880LL, 3628800LL, 39916800LL, 479001600LL,
+		6227020800LL,  87178291200LL, 1307674368000LL, 20922789888000LL, 355687428096000LL, 6402373705728000LL, 121645100408832000LL, 2432902008176640000LL};
+	return fac[x];
 }
 
-// Convert permutation array (non-unique) into an index
-static long long pVector3Index(int permutation[], unsigned int size) {
-	if (size < 2) return 0;
-	int index = 0;
-	
-	// compute number of times each element appears
-	std::map<int, int> counts;
-	for (unsigned int i = 0; i < size; i++){
-		if (counts.find(permutation[i]) == counts.end())
-			counts[permutation[i]] = 1;
-		else
-			counts[permutation[i]]++;
+// Table of binomial coefficients, n choose k for 0 <= k <= n <= 64
+struct binomialTable {
+	long long c[65][65];
+	binomialTable() {
+		for (int n = 0; n <= 64; n++) {
+			c[n][0] = 1;
+			for (int k = 1; k <= 64; k++)
+				c[n][k] = (k > n) ? 0 : c[n-1][k-1] + (k < n ? c[n-1][k] : 0);
+		}
 	}
-	
-	// compute combinations
-	long long comb = factorial(size);
-	if (comb == -1){ // Too big :(
-		return -1;
+};
+
+static const binomialTable &binomials() {
+	static const binomialTable table;
+	return table;
+}
+
+static long long binomial(int n, int k) {
+	if (k < 0 || k > n || n > 64)
+		return 0;
+	return binomials().c[n][k];
+}
+
+// Build the ranking tables for the given pieces of a solved permutation, where
+// pieces may have copies. Pieces not listed are left out of the rank.
+static multisetRank makeMultisetRank(int solved[], int size, std::vector<int> pieces) {
+	multisetRank rank;
+	int maxPiece = 0;
+	for (int i = 0; i < size; i++)
+		if (solved[i] > maxPiece)
+			maxPiece = solved[i];
+	rank.classOf.assign(maxPiece + 1, -1);
+	rank.combinations = 1;
+	if (size > 64){ // Too big to index
+		rank.combinations = -1;
+		return rank;
 	}
-	std::map<int, int>::iterator iter;
-	for (iter = counts.begin(); iter != counts.end(); iter++)
-		comb /= factorial(iter->second);
-	
-	unsigned int vecsize = size;
-	for (unsigned int ptr = 0; ptr < size; ptr++) {
-		for (int i=1; i < permutation[ptr]; i++) {
-			if (counts[i] > 0) { // i still in permutation
-				// add the number of combinations of our permutation without one i
-				index += (comb * counts[i])/vecsize;
-			}
+	int freePositions = size;
+	for (unsigned int j = 0; j < pieces.size(); j++){
+		int copies = 0;
+		for (int i = 0; i < size; i++)
+			if (solved[i] == pieces[j])
+				copies++;
+		if (copies == 0 || rank.classOf[pieces[j]] != -1){
+			std::cerr << "Piece " << pieces[j] << " is not in the solved state, or listed twice.\n";
+			exit(-1);
 		}
-		// "remove" the first element of the permutation
-		comb = (comb * counts[permutation[ptr]])/vecsize;
-		vecsize--;
-		counts[permutation[ptr]]--;
+		rank.classOf[pieces[j]] = j;
+		rank.pieces.push_back(pieces[j]);
+		rank.count.push_back(copies);
+		rank.radix.push_back(binomial(freePositions, copies));
+		freePositions -= copies;
+		long long r = rank.radix.back();
+		if (rank.combinations == -1 || rank.combinations > (1LL << 62) / r)
+			rank.combinations = -1; // Too big to index
+		else
+			rank.combinations *= r;
 	}
-	
-	return index;
+	return rank;
 }
 
-// Convert index into a permutation array (non-unique)
-static int* pIndex3Array(long long index, std::vector<int> solved) {
-	return pIndex3Array(index, solved.data(), solved.size());
+// Build the ranking tables for all pieces of a solved permutation
+static multisetRank makeMultisetRank(int solved[], int size) {
+	std::set<int> pieces(solved, solved + size);
+	return makeMultisetRank(solved, size, std::vector<int>(pieces.begin(), pieces.end()));
 }
 
-// Convert index into a permutation array (non-unique)
-static int* pIndex3Array(long long index, int* solved, int size, int *vec=0) {
-	if (vec == 0)
-		vec = new int[size] ;
-	// compute number of times each element appears
-	std::map<int, int> counts;
-	std::map<int, int>::iterator iter;
-	for (int i = 0; i < size; i++){
-		if (counts.find(solved[i]) == counts.end())
-			counts[solved[i]] = 1;
-		else
-			counts[solved[i]]++;
+// Convert permutation array (non-unique) into an index. Each piece in turn is
+// placed, as a combination of its copies, among the positions not taken by the
+// pieces before it. Returns -1 if the count of a ranked piece does not match
+// the solved state, which can happen for unknown (?) pieces in a scramble.
+static long long pVector3Index(int *perm, int size, multisetRank &rank) {
+	const binomialTable &choose = binomials();
+	int npieces = rank.pieces.size();
+	int maxPiece = rank.classOf.size();
+	int seen[64];
+	long long digits[64];
+	for (int j = 0; j < npieces; j++) {
+		seen[j] = 0;
+		digits[j] = 0;
 	}
-	
-	// compute combinations
-	long long comb = factorial(size);
-	int combsize = size;
-	if (comb == -1){ // Too big, WTF?
-		return solved;
+	for (int i = 0; i < size; i++) {
+		int piece = perm[i];
+		if (piece <= 0 || piece >= maxPiece)
+			continue;
+		int c = rank.classOf[piece];
+		if (c < 0)
+			continue;
+		// positions before i taken by earlier pieces are not free for this one
+		int taken = 0;
+		for (int j = 0; j < c; j++)
+			taken += seen[j];
+		seen[c]++;
+		digits[c] += choose.c[i - taken][seen[c]];
 	}
-	for (iter = counts.begin(); iter != counts.end(); iter++)
-		comb /= factorial(iter->second);
-	
-	// now build vec
-	for (int i=0; i < size; i++) {
-		// loop over each thing in solved
-		for (iter = counts.begin(); iter != counts.end(); iter++) {
-			// if this thing is still in our permutation
-			if (iter->second > 0) {
-				// get the number of combinations of the permutation without one thing
-				long long num = (comb * iter->second)/combsize;
-				// if we can subtract it from index, do so; otherwise we found the ith thing
-				if (num <= index)
-					index -= num;
-				else
-					break;
-			}
-		}
-		// store this thing, and "remove" the first element of solved
-		vec[i] = iter->first;
-		comb = (comb * iter->second)/combsize;
-		combsize--;
-		counts[iter->first]--;
+	long long index = 0;
+	for (int j = 0; j < npieces; j++) {
+		if (seen[j] != rank.count[j])
+			return -1;
+		index = index * rank.radix[j] + digits[j];
 	}
-	return vec;
+	return index;
 }
 
-static long long combinations(std::vector<int> vec) {
-	return combinations(vec.data(), vec.size());
+// Same index as pVector3Index, from a bitmask of the positions of each piece
+// (where[piece] for 0 < piece < maskPieces). Rank of a copy among the free
+// positions is the number of free positions below it.
+static long long pMasks3Index(const unsigned long long *where, int maskPieces, int size, multisetRank &rank) {
+	const binomialTable &choose = binomials();
+	int npieces = rank.pieces.size();
+	unsigned long long freePositions = size >= 64 ? ~0ULL : (1ULL << size) - 1;
+	long long index = 0;
+	for (int j = 0; j < npieces; j++) {
+		int piece = rank.pieces[j];
+		unsigned long long positions = piece < maskPieces ? where[piece] : 0;
+		long long digit = 0;
+		int k = 0;
+		for (unsigned long long left = positions; left; left &= left - 1) {
+			unsigned long long bit = left & (0 - left);
+			digit += choose.c[__builtin_popcountll(freePositions & (bit - 1))][++k];
+		}
+		freePositions &= ~positions;
+		if (k != rank.count[j])
+			return -1;
+		index = index * rank.radix[j] + digit;
+	}
+	return index;
 }
 
-static long long combinations(int vec[], int size) {
-	std::map<int, int> counter;
-	std::map<int, int>::iterator iter;
-	for (int i = 0; i < size; i++){
-		if (counter.find(vec[i]) == counter.end())
-			counter[vec[i]] = 1;
-		else
-			counter[vec[i]]++;
+// Convert index into a permutation array (non-unique); positions of pieces
+// left out of the rank get 0
+static int* pIndex3Array(long long index, int size, multisetRank &rank, int *vec=0) {
+	if (vec == 0)
+		vec = new int[size] ;
+	const binomialTable &choose = binomials();
+	int npieces = rank.pieces.size();
+	long long digits[64];
+	for (int j = npieces - 1; j >= 0; j--) {
+		digits[j] = index % rank.radix[j];
+		index /= rank.radix[j];
 	}
-	
-	long long comb = factorial(size);
-	if (comb == -1){ // Too big to compute
-		return -1;
+	int freePositions[64];
+	int nfree = size;
+	for (int i = 0; i < size; i++) {
+		vec[i] = 0;
+		freePositions[i] = i;
 	}
-	for (iter = counter.begin(); iter != counter.end(); iter++)
-		comb /= factorial(iter->second);
-	return comb;
+	for (int j = 0; j < npieces; j++) {
+		long long r = digits[j];
+		int c = nfree;
+		for (int k = rank.count[j]; k >= 1; k--) {
+			// largest c with (c choose k) <= r is the rank of this copy among the free positions
+			do
+				c--;
+			while (choose.c[c][k] > r);
+			r -= choose.c[c][k];
+			vec[freePositions[c]] = rank.pieces[j];
+		}
+		int stillFree = 0;
+		for (int t = 0; t < nfree; t++)
+			if (vec[freePositions[t]] == 0)
+				freePositions[stillFree++] = freePositions[t];
+		nfree = stillFree;
+	}
+	return vec;
 }
 
-static long long factorial(long long x) {
-	if (x <= 1)
-		return 1;
-	else if (x > 20)
-		return -1;  // Would overflow a long long
-		
-	static const long long fac[21] = {1LL, 1LL, 2LL, 6LL, 24LL, 120LL,
-		720LL, 5040LL, 40320LL, 362880LL, 3628800LL, 39916800LL, 479001600LL,
-		6227020800LL,  87178291200LL, 1307674368000LL, 20922789888000LL, 355687428096000LL, 6402373705728000LL, 121645100408832000LL, 2432902008176640000LL};
-	return fac[x];
+// Number of different arrangements of a permutation (non-unique), or -1 if too many
+static long long combinations(int vec[], int size) {
+	return makeMultisetRank(vec, size).combinations;
 }
 
 static std::vector<long long> packVector(std::vector<int> vec){
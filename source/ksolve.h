@@ -0,0 +1,68 @@
+/*
+ KSolve+ - Puzzle solving program.
+ Copyright (C) 2007-2013 Kre Krig and Michael Gottlieb
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+/* C interface to the solver, built as libksolve.a and libksolve.so by
+   "make lib". A context owns the puzzles loaded into it and their pruning
+   tables; contexts and puzzles share no state, so different threads may
+   each use their own, and one puzzle may be solved by several threads at
+   once. A mistake in a definition or scramble makes the call fail, and
+   ksolve_error says what it was. */
+
+#ifndef KSOLVE_H
+#define KSOLVE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ksolve_context ksolve_context;
+typedef struct ksolve_puzzle ksolve_puzzle;
+
+/* Called with each solution, shortest first, as moves separated by spaces.
+   Return nonzero to stop searching the current scramble. */
+typedef int (*ksolve_solution_callback)(void *user, const char *scramble, const char *solution);
+
+ksolve_context *ksolve_create(void);
+void ksolve_destroy(ksolve_context *context); /* frees its puzzles too */
+
+/* Why the last call on this thread that failed did, as ksolve prints it. */
+const char *ksolve_error(void);
+
+/* Load a puzzle from the text of a definition, computing its pruning
+   tables. NULL if the definition has a mistake. */
+ksolve_puzzle *ksolve_load(ksolve_context *context, const char *definition);
+
+/* Load a puzzle from a definition file, reusing and saving the compiled
+   rules and pruning tables next to it. NULL if the file can't be read or
+   has a mistake. */
+ksolve_puzzle *ksolve_load_file(ksolve_context *context, const char *path);
+
+void ksolve_unload(ksolve_context *context, ksolve_puzzle *puzzle);
+
+/* Solve the scrambles in scrambles, given as in a scramble file, on the
+   calling thread. Returns the number of solutions passed to found, or -1
+   if a scramble has a mistake; those before it are solved. */
+long long ksolve_solve(ksolve_puzzle *puzzle, const char *scrambles, ksolve_solution_callback found, void *user);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,121 @@
+/*
+ KSolve+ - Puzzle solving program.
+ Copyright (C) 2007-2013 Kre Krig and Michael Gottlieb
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+// The C interface of ksolve.h, over the library functions of library.h
+
+#define KSOLVE_NO_MAIN
+#include "main.cpp"
+#include "ksolve.h"
+
+// A ksolve_puzzle is a ksolve::loadedPuzzle
+struct ksolve_context {
+	ksolve::solverContext context;
+};
+
+// What ksolve_error returns
+static thread_local std::string lastError;
+
+// A solution callback and where it stops the search
+struct callbackSink {
+	ksolve_solution_callback found;
+	void *user;
+	const std::string *scramble;
+	std::atomic<bool> stop;
+	long long solutions;
+};
+
+static void passSolution(void *context, const std::string &solution) {
+	callbackSink &sink = *(callbackSink *)context;
+	size_t first = solution.find_first_not_of(' ');
+	sink.solutions++;
+	if (sink.found(sink.user, sink.scramble->c_str(), first == std::string::npos ? "" : solution.c_str() + first) != 0)
+		sink.stop = true;
+}
+
+extern "C" ksolve_context *ksolve_create(void) {
+	ksolve_context *context = new ksolve_context;
+	context->context.options.randomSeed = time(NULL); // as the program does without --seed
+	return context;
+}
+
+extern "C" const char *ksolve_error(void) {
+	return lastError.c_str();
+}
+
+extern "C" void ksolve_destroy(ksolve_context *context) {
+	ksolve::freeContext(context->context);
+	delete context;
+}
+
+extern "C" ksolve_puzzle *ksolve_load(ksolve_context *context, const char *definition) {
+	std::istringstream definitionStream(definition);
+	try {
+		return (ksolve_puzzle *)ksolve::loadPuzzle(context->context, definitionStream, "", false);
+	} catch (ksolve::inputError &error) {
+		lastError = error.what();
+		return NULL;
+	}
+}
+
+extern "C" ksolve_puzzle *ksolve_load_file(ksolve_context *context, const char *path) {
+	std::ifstream definitionStream(path);
+	if (!definitionStream.good()) {
+		lastError = std::string("Can't open ") + path + ".";
+		return NULL;
+	}
+	try {
+		return (ksolve_puzzle *)ksolve::loadPuzzle(context->context, definitionStream, path, true);
+	} catch (ksolve::inputError &error) {
+		lastError = error.what();
+		return NULL;
+	}
+}
+
+extern "C" void ksolve_unload(ksolve_context *context, ksolve_puzzle *puzzle) {
+	ksolve::freePuzzle(context->context, (ksolve::loadedPuzzle *)puzzle);
+}
+
+extern "C" long long ksolve_solve(ksolve_puzzle *handle, const char *scrambles, ksolve_solution_callback found, void *user) {
+	ksolve::loadedPuzzle &puzzle = *(ksolve::loadedPuzzle *)handle;
+	ksolve::puzzleScope scope(puzzle, true);
+	std::istringstream scrambleStream(scrambles);
+	ksolve::Scramble states(scrambleStream, puzzle.solved, puzzle.moves, puzzle.datasets, puzzle.blocks, *puzzle.options);
+	callbackSink context;
+	context.found = found;
+	context.user = user;
+	context.solutions = 0;
+	ksolve::solutionSink sink(passSolution, &context);
+	sink.stop = &context.stop;
+
+	try {
+		ksolve::ScrambleDef scramble = states.getScramble();
+		while (scramble.state.size() != 0) {
+			context.scramble = &scramble.name;
+			context.stop = false;
+			ksolve::solveScramble(puzzle, scramble, sink);
+			ksolve::freeScramble(scramble);
+			scramble = states.getScramble();
+		}
+	} catch (ksolve::inputError &error) {
+		lastError = error.what();
+		return -1;
+	}
+	return context.solutions;
+}
@@ -0,0 +1,162 @@
+/*
+ KSolve+ - Puzzle solving program.
+ Copyright (C) 2007-2013 Kre Krig and Michael Gottlieb
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+// The solver as a library: a context holds loaded puzzles, each with its own
+// set names and pruning tables, which are solved on the calling thread with
+// every solution passed to a callback. libksolve.cpp wraps it in a C interface.
+
+#ifndef LIBRARY_H
+#define LIBRARY_H
+
+// A puzzle ready to be solved
+struct loadedPuzzle {
+	string defFileName;
+	setNameTable setNames;
+	PieceTypes datasets;
+	Position solved;
+	MoveList moves;
+	std::set<MovePair> forbidden;
+	std::vector<Block> blocks;
+	PruneTable tables;
+	const solverOptions *options; // those of the context it was loaded into
+};
+
+// What a program embedding the solver holds: the puzzles it has loaded, and
+// the options they are loaded and solved with
+struct solverContext {
+	std::vector<loadedPuzzle *> puzzles;
+	solverOptions options;
+};
+
+// While in scope, the puzzle's set names are the ones this thread uses,
+// and if quiet, its progress messages are dropped
+struct puzzleScope {
+	setNameTable *names;
+	std::ostream *stream;
+
+	puzzleScope(loadedPuzzle &puzzle, bool quiet) : names(setNames), stream(messageStream) {
+		static thread_local std::ostream discard(NULL);
+		setNames = &puzzle.setNames;
+		if (quiet)
+			messageStream = &discard;
+	}
+	~puzzleScope() {
+		setNames = names;
+		messageStream = stream;
+	}
+};
+
+// Load a puzzle into the context. If defFileName is the file the definition
+// was read from, compiled rules and pruning tables are kept next to it as
+// the program does; otherwise they are computed every time. A mistake in
+// the definition is thrown as an inputError.
+static loadedPuzzle *loadPuzzle(solverContext &context, std::istream &definition, const string &defFileName, bool useFiles) {
+	loadedPuzzle *puzzle = new loadedPuzzle;
+	puzzleScope scope(*puzzle, true);
+	puzzleRules rules;
+	try {
+		readRules(definition, defFileName, useFiles, rules, context.options.verbose);
+	} catch (inputError &) {
+		delete puzzle;
+		throw;
+	}
+	puzzle->defFileName = defFileName;
+	puzzle->options = &context.options;
+	puzzle->datasets = rules.datasets;
+	puzzle->solved = rules.solved;
+	puzzle->moves = rules.moves;
+	puzzle->forbidden = rules.forbidden;
+	puzzle->blocks = rules.blocks;
+	puzzle->tables = getCompletePruneTables(puzzle->solved, puzzle->moves, puzzle->datasets, rules.ignore, rules.subsets, defFileName, useFiles);
+	updateDatasets(puzzle->datasets, puzzle->tables);
+	buildChildMoves(puzzle->tables, puzzle->moves, puzzle->datasets);
+	buildPieceMasks(puzzle->tables, puzzle->moves, puzzle->datasets);
+	for (int iter = 0; iter < rules.ignore.size(); iter++) {
+		delete []rules.ignore[iter].permutation;
+		delete []rules.ignore[iter].orientation;
+	}
+	context.puzzles.push_back(puzzle);
+	return puzzle;
+}
+
+// Remove a puzzle from the context and free it
+static void freePuzzle(solverContext &context, loadedPuzzle *puzzle) {
+	context.puzzles.erase(std::remove(context.puzzles.begin(), context.puzzles.end(), puzzle), context.puzzles.end());
+	std::set<int *> arrays; // moves may share their arrays, so free each once
+	for (int iter = 0; iter < puzzle->solved.size(); iter++) {
+		arrays.insert(puzzle->solved[iter].permutation);
+		arrays.insert(puzzle->solved[iter].orientation);
+	}
+	for (MoveList::iterator move = puzzle->moves.begin(); move != puzzle->moves.end(); move++)
+		for (int iter = 0; iter < move->second.state.size(); iter++) {
+			arrays.insert(move->second.state[iter].permutation);
+			arrays.insert(move->second.state[iter].orientation);
+		}
+	for (std::set<int *>::iterator array = arrays.begin(); array != arrays.end(); array++)
+		delete [](*array);
+	delete puzzle;
+}
+
+static void freeContext(solverContext &context) {
+	while (!context.puzzles.empty())
+		freePuzzle(context, context.puzzles.back());
+}
+
+// Find the optimal solutions of one scramble, and any up to its slack
+// longer, as ksolveWrapped does, until the sink stops it or there are as
+// many as the scramble's MaxSolutions: on this thread, or on all OpenMP
+// threads with splitThreads. Returns the optimal length, or -1 if no
+// solution was found.
+static int solveScramble(loadedPuzzle &puzzle, ScrambleDef &scramble, solutionSink &outerSink, bool splitThreads = false) {
+	return solveScramble(scramble, puzzle.solved, puzzle.moves, puzzle.datasets, puzzle.tables, puzzle.forbidden, puzzle.blocks, outerSink, splitThreads);
+}
+
+// The same for a puzzle held in parts, as ksolveWrapped holds it
+static int solveScramble(ScrambleDef &scramble, Position& solved, MoveList& puzzleMoves, PieceTypes& datasets, PruneTable& tables,
+		std::set<MovePair>& forbidden, std::vector<Block>& blocks, solutionSink &outerSink, bool splitThreads) {
+	std::atomic<bool> stopped(false);
+	std::atomic<long long> found(0);
+	solutionSink sink = outerSink;
+	if (sink.stop == NULL)
+		sink.stop = &stopped;
+	sink.solutions = &found;
+	sink.maxSolutions = scramble.max_solutions;
+	MoveList moves = puzzleMoves;
+	processMoveLimits(moves, scramble.moveLimits);
+	positionRanks ranks;
+	rankPosition(scramble.state, tables, ranks);
+	int depth = 0, length = -1, usedSlack = 0;
+	while (!*sink.stop) {
+		if (treeSolve(scramble.state, ranks, solved, moves, datasets, tables, forbidden, scramble.ignore, blocks, depth, scramble.metric, scramble.moveLimits, " ", -1, splitThreads, &sink) && length < 0)
+			length = depth;
+		if (sink.depthDone != NULL)
+			sink.depthDone(sink.context, depth);
+		if (length >= 0 || usedSlack > 0) {
+			usedSlack++;
+			if (usedSlack > scramble.slack) break;
+		}
+		depth++;
+		if (depth > scramble.max_depth)
+			break;
+	}
+	return length;
+}
+
+#endif
@@ -20,40 +20,96 @@
 // Main struct and control flow of program, with all includes used in it
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <random>
 #include <set>
 #include <sstream>
+#include <stdexcept>
 #include <stdlib.h>
 #include <string>
 #include <vector>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
+#ifndef __EMSCRIPTEN__
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#endif
 #include <time.h>
 #include <string.h>
-
-std::map<std::string, int> setnameLookup ;
-std::vector<std::string> setNames ;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && (__GNUC__ >= 5 || defined(__clang__)) && !defined(__EMSCRIPTEN__)
+#define KSOLVE_X86_KERNELS // runtime-selected AVX2/AVX-512 kernels in simd.h
+#include <immintrin.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Set names are numbered as they are first seen, per puzzle: the program
+// has one table, and each puzzle loaded through library.h has its own,
+// made current on the thread working on it.
+struct setNameTable {
+   std::map<std::string, int> lookup ;
+   std::vector<std::string> names ;
+} ;
+setNameTable programSetNames ;
+thread_local setNameTable *setNames = &programSetNames ;
 int setnameIndex(const std::string &s) {
-   std::map<std::string, int>::iterator it = setnameLookup.find(s) ;
-   if (it == setnameLookup.end()) {
-      setnameLookup[s] = setNames.size() ;
-      it = setnameLookup.find(s) ;
-      setNames.push_back(s) ;
+   std::map<std::string, int>::iterator it = setNames->lookup.find(s) ;
+   if (it == setNames->lookup.end()) {
+      setNames->lookup[s] = setNames->names.size() ;
+      it = setNames->lookup.find(s) ;
+      setNames->names.push_back(s) ;
    }
    return it->second ;
 }
+int setnameFind(const std::string &s) { // -1 for a set never named
+   std::map<std::string, int>::iterator it = setNames->lookup.find(s) ;
+   return it == setNames->lookup.end() ? -1 : it->second ;
+}
 std::string setnameFromIndex(int i) {
-   return setNames[i] ;
+   return setNames->names[i] ;
+}
+// Progress messages; the library sends them nowhere
+thread_local std::ostream *messageStream = &std::cout ;
+std::ostream &messages() {
+   return *messageStream ;
 }
-long long maxmem = 8000000000LL ;
-int verbose = 0 ;
+// The command line options, passed down to what uses them
+struct solverOptions {
+   long long maxmem = 8000000000LL ;
+   int verbose = 0 ;
+   std::string scratchDir ; // directory for God's Algorithm runs on disk, if any
+   bool writeCheckpoints = false ; // save God's Algorithm runs after every depth
+   bool resumeCheckpoint = false ; // and continue from the last one saved
+   std::string cosetSet ; // piece set splitting God's Algorithm runs into cosets, if any
+   bool godIgnore = false ; // leave what the Ignore command ignores out of God's Algorithm tables
+   long long sampleCount = 100 ; // random positions solved by !sample
+   long long sampleNodes = 0 ; // and the nodes each search may visit, if limited
+   double sampleSeconds = 0 ; // or the seconds it may take
+   long long randomSeed = -1 ; // seed for random positions, or -1 to take one from the clock
+   std::string serverSocket ; // socket !serve listens on, or empty for stdin
+   int serverWorkers = 0 ; // threads solving requests for !serve, or 0 for one per core
+   bool jsonOutput = false ; // a line of JSON per scramble on stdout, everything else on stderr
+   long long maxSolutions = 0 ; // solutions per scramble before the search stops, or 0 for all
+} ;
 
 struct ksolve {
 	#include "data.h"
+	#include "simd.h"
 	#include "move.h"
 	#include "blocks.h"
 	#include "checks.h"
@@ -61,18 +117,73 @@ struct ksolve {
 	#include "pruning.h"
 	#include "search.h"
 	#include "readdef.h"
+	#include "defcache.h"
 	#include "readscramble.h"
+	#include "diskbfs.h"
+	#include "sparse.h"
+	#include "cosetbfs.h"
+	#include "quotient.h"
+	#include "oracle.h"
 	#include "god.h"
+	#include "group.h"
+	#include "random.h"
+	#include "sample.h"
+	#include "report.h"
+	#include "library.h"
+	#include "server.h"
 
 	static int ksolveMain(int argc, char *argv[]) {
 
-		srand(time(NULL)); // initialize RNG in case we need it
+		solverOptions options;
 		while (argc > 3 && argv[1][0] == '-') {
 			argc-- ;
 			argv++ ;
 			switch (argv[0][1]) {
-case 'M': maxmem = 1048576 * atoll(argv[1]) ; argc-- ; argv++ ; break ;
-case 'v': verbose++ ; break ;
+case 'M': options.maxmem = 1048576 * atoll(argv[1]) ; argc-- ; argv++ ; break ;
+case 'v': options.verbose++ ; break ;
+case 'T': options.scratchDir = argv[1] ; argc-- ; argv++ ; break ;
+case 'C': options.writeCheckpoints = true ; break ;
+case 'P': options.cosetSet = argv[1] ; argc-- ; argv++ ; break ;
+case 'I': options.godIgnore = true ; break ;
+case '-':
+   if (strcmp(argv[0], "--resume") == 0) {
+      options.writeCheckpoints = true ;
+      options.resumeCheckpoint = true ;
+      break ;
+   }
+   if (strcmp(argv[0], "--socket") == 0) {
+      options.serverSocket = argv[1] ; argc-- ; argv++ ;
+      break ;
+   }
+   if (strcmp(argv[0], "--workers") == 0) {
+      options.serverWorkers = atoi(argv[1]) ; argc-- ; argv++ ;
+      break ;
+   }
+   if (strcmp(argv[0], "--json") == 0) {
+      options.jsonOutput = true ;
+      break ;
+   }
+   if (strcmp(argv[0], "--max-solutions") == 0) {
+      options.maxSolutions = atoll(argv[1]) ; argc-- ; argv++ ;
+      break ;
+   }
+   if (strcmp(argv[0], "--seed") == 0) {
+      options.randomSeed = atoll(argv[1]) ; argc-- ; argv++ ;
+      break ;
+   }
+   if (strcmp(argv[0], "--samples") == 0) {
+      options.sampleCount = atoll(argv[1]) ; argc-- ; argv++ ;
+      break ;
+   }
+   if (strcmp(argv[0], "--nodes") == 0) {
+      options.sampleNodes = atoll(argv[1]) ; argc-- ; argv++ ;
+      break ;
+   }
+   if (strcmp(argv[0], "--seconds") == 0) {
+      options.sampleSeconds = atof(argv[1]) ; argc-- ; argv++ ;
+      break ;
+   }
+   // fall through
 default: std::cout << "Did not understand argument " << argv[0] << std::endl ;
 			}
 		}
@@ -90,7 +201,11 @@ default: std::cout << "Did not understand argument " << argv[0] << std::endl ;
 			std::cout << "Can't open definition file!\n";
 			exit(-1);
 		}
-		std::ifstream scrambleStream(argv[2]);
+		std::ifstream scrambleFile;
+		bool fromStdin = strcmp(argv[2], "-") == 0; // scrambles piped in
+		if (!fromStdin)
+			scrambleFile.open(argv[2]);
+		std::istream &scrambleStream = fromStdin ? std::cin : scrambleFile;
 		if (argv[2][0] != '!' && !scrambleStream.good()){
 			std::cout << "Can't open scramble file!\n";
 			exit(-1);
@@ -98,7 +213,7 @@ default: std::cout << "Did not understand argument " << argv[0] << std::endl ;
 
 		string defFileName(argv[1]);
 		string scrambleFileName(argv[2]);
-		return ksolveWrapped(definitionStream, scrambleStream, defFileName, scrambleFileName, true);
+		return ksolveWrapped(definitionStream, scrambleStream, defFileName, scrambleFileName, true, options);
 
 	}
 
@@ -106,20 +221,28 @@ default: std::cout << "Did not understand argument " << argv[0] << std::endl ;
 													 std::istream &scrambleStream,
 													 string defFileName,
 													 string scrambleFileName,
-													 bool usePruneTable)
+													 bool usePruneTable,
+													 solverOptions options)
 	{
 
 		clock_t start;
 		start = clock();
+		if (options.randomSeed < 0)
+			options.randomSeed = time(NULL); // initialize RNG in case we need it
+		std::ostream results(std::cout.rdbuf());
+		if (scrambleFileName == "!serve" || options.jsonOutput)
+			std::cout.rdbuf(std::cerr.rdbuf()); // stdout is for the answers
 
 		// Load the puzzle rules
-		Rules ruleset(definitionStream);
-		PieceTypes datasets = ruleset.getDatasets();
-		Position solved = ruleset.getSolved();
-		MoveList moves = ruleset.getMoves();
-		std::set<MovePair> forbidden = ruleset.getForbiddenPairs();
-		Position ignore = ruleset.getIgnore();
-		std::vector<Block> blocks = ruleset.getBlocks();
+		puzzleRules rules;
+		readRules(definitionStream, defFileName, usePruneTable, rules, options.verbose);
+		PieceTypes datasets = rules.datasets;
+		Position solved = rules.solved;
+		MoveList moves = rules.moves;
+		std::set<MovePair> forbidden = rules.forbidden;
+		Position ignore = rules.ignore;
+		std::vector<Block> blocks = rules.blocks;
+		PatternSubsets subsets = rules.subsets;
 		std::cout << "Ruleset loaded.\n";
 
 		// Print all generated moves
@@ -135,33 +258,88 @@ default: std::cout << "Did not understand argument " << argv[0] << std::endl ;
 		}
 		std::cout << ".\n";
 
+		// Puzzle statistics, which need no tables
+		if (scrambleFileName == "!stats") {
+			puzzleStats(solved, moves, datasets, blocks);
+			std::cout << "Time: " << (clock() - start) / (double)CLOCKS_PER_SEC << "s\n";
+			return EXIT_SUCCESS;
+		}
+
 		// Compute or load the pruning tables
 		PruneTable tables;
-		tables = getCompletePruneTables(solved, moves, datasets, ignore, defFileName, usePruneTable);
+		tables = getCompletePruneTables(solved, moves, datasets, ignore, subsets, defFileName, usePruneTable);
 		std::cout << "Pruning tables loaded.\n";
 
 		//datasets = updateDatasets(datasets, tables);
 		updateDatasets(datasets, tables);
+		buildChildMoves(tables, moves, datasets);
+		buildPieceMasks(tables, moves, datasets);
+		if (options.verbose)
+			std::cout << "Using " << kernels().name << " kernels.\n";
 
 		// God's Algorithm tables
 		std::string godHTM = "!";
 		std::string godQTM = "!q";
 		if (0==godHTM.compare(scrambleFileName)) {
 			std::cout << "Computing God's Algorithm tables (HTM)\n";
-			godTable(solved, moves, datasets, forbidden, ignore, blocks, 0);
+			godTable(solved, moves, datasets, forbidden, ignore, blocks, 0, defFileName, options);
 			std::cout << "Time: " << (clock() - start) / (double)CLOCKS_PER_SEC << "s\n";
 			return EXIT_SUCCESS;
 		} else if (0==godQTM.compare(scrambleFileName)) {
 			std::cout << "Computing God's Algorithm tables (QTM)\n";
-			godTable(solved, moves, datasets, forbidden, ignore, blocks, 1);
+			godTable(solved, moves, datasets, forbidden, ignore, blocks, 1, defFileName, options);
+			std::cout << "Time: " << (clock() - start) / (double)CLOCKS_PER_SEC << "s\n";
+			return EXIT_SUCCESS;
+		}
+
+		// Distance distribution estimated from random positions
+		if (scrambleFileName == "!sample" || scrambleFileName == "!sampleq") {
+			int metric = (scrambleFileName == "!sample") ? 0 : 1;
+			std::cout << "Solving " << options.sampleCount << " random positions (" << (metric == 0 ? "HTM" : "QTM") << ")\n";
+			sampleDistances(solved, moves, datasets, tables, forbidden, blocks, metric, options.sampleCount, options.sampleNodes, options.sampleSeconds, options.randomSeed);
 			std::cout << "Time: " << (clock() - start) / (double)CLOCKS_PER_SEC << "s\n";
 			return EXIT_SUCCESS;
 		}
 
+#ifndef __EMSCRIPTEN__
+		// Keep the tables loaded and solve requests as they come
+		if (scrambleFileName == "!serve") {
+			loadedPuzzle puzzle = {defFileName, *setNames, datasets, solved, moves, forbidden, blocks, std::move(tables), &options};
+			serveRequests(puzzle, options.serverSocket, options.serverWorkers);
+			return EXIT_SUCCESS;
+		}
+#endif
+
 		// Load the scramble to be solved
-		Scramble states(scrambleStream, solved, moves, datasets, blocks);
+		Scramble states(scrambleStream, solved, moves, datasets, blocks, options);
 		std::cout << "Scrambles loaded.\n";
 
+		// saved God's Algorithm tables (see god.h), if any, solve without search
+		godOracle oracles[2];
+		bool haveOracle[2];
+		unsigned long long hash = puzzleHash(solved, moves, datasets, blocks);
+		for (int metric = 0; metric < 2; metric++) {
+			haveOracle[metric] = openOracle(defFileName + (metric == 0 ? ".oracle" : ".oracleq"), hash, metric, solved, datasets, oracles[metric]);
+			if (haveOracle[metric] && options.verbose)
+				std::cout << "Using God's Algorithm table " << defFileName << (metric == 0 ? ".oracle" : ".oracleq") << ".\n";
+		}
+		// and those made with -I, for scrambles that ignore what the Ignore command does
+		godOracle quotientOracles[2];
+		bool haveQuotientOracle[2] = {false, false};
+		Position quotientSolved;
+		PieceTypes quotientSets;
+		std::vector<std::vector<int> > relabel;
+		bool haveQuotient = ignoresAnything(ignore) && quotientPuzzle(solved, datasets, ignore, blocks, quotientSolved, quotientSets, relabel, false);
+		if (haveQuotient) {
+			unsigned long long quotientHash = puzzleHash(quotientSolved, moves, quotientSets, blocks);
+			for (int metric = 0; metric < 2; metric++) {
+				string filename = defFileName + (metric == 0 ? ".ignore.oracle" : ".ignore.oracleq");
+				haveQuotientOracle[metric] = openOracle(filename, quotientHash, metric, quotientSolved, quotientSets, quotientOracles[metric]);
+				if (haveQuotientOracle[metric] && options.verbose)
+					std::cout << "Using God's Algorithm table " << filename << ".\n";
+			}
+		}
+
 		ScrambleDef scramble = states.getScramble();
 
 		while(scramble.state.size() != 0){
@@ -201,12 +379,60 @@ default: std::cout << "Did not understand argument " << argv[0] << std::endl ;
 			}
 			processMoveLimits(moves2, scramble.moveLimits);
 
+			if (options.jsonOutput) {
+				results << jsonSolve(scramble, solved, moves, datasets, tables, forbidden, blocks) << std::endl;
+				freeScramble(scramble);
+				scramble = states.getScramble();
+				continue;
+			}
+
+			if (haveOracle[scramble.metric] && solveFromOracle(oracles[scramble.metric], scramble, solved, moves, datasets, forbidden, blocks, options.verbose)) {
+				std::cout << "\n";
+				freeScramble(scramble);
+				scramble = states.getScramble();
+				continue;
+			}
+			if (haveQuotientOracle[scramble.metric] && sameIgnore(scramble.ignore, ignore, datasets)) {
+				ScrambleDef quotientScramble = scramble;
+				quotientScramble.state = quotientPosition(scramble.state, quotientSets, relabel);
+				quotientScramble.ignore.clear();
+				bool done = solveFromOracle(quotientOracles[scramble.metric], quotientScramble, quotientSolved, moves, quotientSets, forbidden, blocks, options.verbose);
+				freeScramble(quotientScramble);
+				if (done) {
+					std::cout << "\n";
+					freeScramble(scramble);
+					scramble = states.getScramble();
+					continue;
+				}
+			}
+
 			std::cout << "Depth 0\n";
 
 			// The tree-search for the solution(s)
+			positionRanks ranks;
+			rankPosition(scramble.state, tables, ranks);
 			int usedSlack = 0;
+			std::vector<searchThread> counts(searchThreads()); // for the statistics of -DKSOLVE_STATS builds
+			std::atomic<bool> enough(false);
+			std::atomic<long long> solutions(0);
+			solutionSink countingSink(printSolution, NULL);
+			countingSink.stop = &enough;
+			countingSink.threads = SEARCH_STATS ? &counts : NULL;
+			countingSink.solutions = &solutions;
+			countingSink.maxSolutions = scramble.max_solutions;
+			bool useSink = SEARCH_STATS || scramble.max_solutions > 0; // otherwise solutions are printed directly
+			std::vector<depthReport> reports;
 			while(1) {
-				bool foundSolution = treeSolve(scramble.state, solved, moves, datasets, tables, forbidden, scramble.ignore, blocks, depth, scramble.metric, scramble.moveLimits, temp_a, -1, true);
+				double depthStart = wallSeconds();
+				bool foundSolution = treeSolve(scramble.state, ranks, solved, moves, datasets, tables, forbidden, scramble.ignore, blocks, depth, scramble.metric, scramble.moveLimits, temp_a, -1, true, useSink ? &countingSink : NULL);
+				if (SEARCH_STATS) {
+					reports.push_back(mergeCounts(counts, depth, wallSeconds() - depthStart));
+					std::cout << statsText(reports.back(), reports.size() > 1 ? &reports[reports.size() - 2] : NULL);
+				}
+				if (enough) {
+					std::cout << "\nMaxSolutions reached, stopping.\n";
+					break;
+				}
 				if (foundSolution || usedSlack > 0) {
 					usedSlack++;
 					if (usedSlack > scramble.slack) break;
@@ -220,21 +446,40 @@ default: std::cout << "Did not understand argument " << argv[0] << std::endl ;
 			}
 			std::cout << "\n";
 
+			freeScramble(scramble);
 			scramble = states.getScramble();
 		}
 
+		for (int metric = 0; metric < 2; metric++) {
+			if (haveOracle[metric])
+				closeOracle(oracles[metric]);
+			if (haveQuotientOracle[metric])
+				closeOracle(quotientOracles[metric]);
+		}
+
 		std::cout << "Time: " << (clock() - start) / (double)CLOCKS_PER_SEC << "s\n";
 
 		return EXIT_SUCCESS;
 	}
 };
 
+#ifndef KSOLVE_NO_MAIN
 int main(int argc, char *argv[]) {
-	ksolve::ksolveMain(argc, argv);
+	try {
+		ksolve::ksolveMain(argc, argv);
+	} catch (ksolve::inputError &error) {
+		std::cerr << error.what() << "\n";
+		exit(-1);
+	}
 }
+#endif
 
 extern "C" void solve(char* definition, char* state) {
 	std::istringstream definitionStream(definition);
 	std::istringstream scrambleStream(state);
-	ksolve::ksolveWrapped(definitionStream, scrambleStream, "dummy", "dummy", false);
+	try {
+		ksolve::ksolveWrapped(definitionStream, scrambleStream, "dummy", "dummy", false, solverOptions());
+	} catch (ksolve::inputError &error) {
+		std::cerr << error.what() << "\n";
+	}
 }
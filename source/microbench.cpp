@@ -0,0 +1,446 @@
+/*
+ KSolve+ - Puzzle solving program.
+ Copyright (C) 2007-2013 Kre Krig and Michael Gottlieb
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+// Timing of the indexing and move functions on their own, outside of any
+// search, with checks that each of them round-trips.
+// Build with "make microbench" and run without arguments.
+
+#define KSOLVE_NO_MAIN
+#include "main.cpp"
+
+static const int BENCH_POSITIONS = 4096;
+static const int BENCH_ROUNDS = 200;
+static const int MAX_RANKED_ORIENTATIONS = 1 << 30;
+static const int MAX_RANKED_PERMUTATION = 20; // 21! does not fit in a long long
+
+static std::mt19937 benchRandom(1); // the same positions every run
+
+static int randomBelow(int n) {
+	return std::uniform_int_distribution<int>(0, n - 1)(benchRandom);
+}
+
+// Nanoseconds per call since start
+static double nanoseconds(clock_t start, double calls) {
+	return 1e9 * (clock() - start) / CLOCKS_PER_SEC / calls;
+}
+
+// Time ranking and unranking of random arrangements of a non-unique solved
+// permutation, checking that every rank unranks to the same arrangement.
+static void benchMultiset(const char *name, std::vector<int> solved) {
+	int size = solved.size();
+	ksolve::multisetRank rank = ksolve::makeMultisetRank(solved.data(), size);
+	std::vector<std::vector<int> > perms(BENCH_POSITIONS, solved);
+	for (int i = 0; i < BENCH_POSITIONS; i++)
+		std::shuffle(perms[i].begin(), perms[i].end(), benchRandom);
+	std::vector<long long> ranks(BENCH_POSITIONS);
+	std::vector<int> unranked(size);
+
+	long long checksum = 0;
+	clock_t start = clock();
+	for (int r = 0; r < BENCH_ROUNDS; r++)
+		for (int i = 0; i < BENCH_POSITIONS; i++) {
+			ranks[i] = ksolve::pVector3Index(perms[i].data(), size, rank);
+			checksum += ranks[i];
+		}
+	double rankTime = (clock() - start) / (double)CLOCKS_PER_SEC;
+
+	start = clock();
+	for (int r = 0; r < BENCH_ROUNDS; r++)
+		for (int i = 0; i < BENCH_POSITIONS; i++) {
+			ksolve::pIndex3Array(ranks[i], size, rank, unranked.data());
+			checksum += unranked[0];
+		}
+	double unrankTime = (clock() - start) / (double)CLOCKS_PER_SEC;
+
+	for (int i = 0; i < BENCH_POSITIONS; i++) {
+		ksolve::pIndex3Array(ranks[i], size, rank, unranked.data());
+		if (ranks[i] < 0 || ranks[i] >= rank.combinations || unranked != perms[i]) {
+			std::cerr << name << ": rank " << ranks[i] << " does not round-trip.\n";
+			exit(-1);
+		}
+	}
+
+	double calls = (double)BENCH_ROUNDS * BENCH_POSITIONS;
+	std::cout << name << " (" << rank.combinations << " arrangements): rank "
+		<< 1e9 * rankTime / calls << " ns, unrank " << 1e9 * unrankTime / calls
+		<< " ns (checksum " << checksum << ")\n";
+}
+
+// Random permutations of 1..size, all of them even if asked
+static std::vector<std::vector<int> > randomPermutations(int size, bool even) {
+	std::vector<std::vector<int> > perms(BENCH_POSITIONS, std::vector<int>(size));
+	for (int i = 0; i < BENCH_POSITIONS; i++) {
+		for (int j = 0; j < size; j++)
+			perms[i][j] = j + 1;
+		std::shuffle(perms[i].begin(), perms[i].end(), benchRandom);
+		int inversions = 0;
+		for (int j = 0; j < size; j++)
+			for (int k = j + 1; k < size; k++)
+				inversions += perms[i][j] > perms[i][k];
+		if (even && inversions % 2 == 1)
+			std::swap(perms[i][size - 2], perms[i][size - 1]);
+	}
+	return perms;
+}
+
+// Time ranking and unranking of random permutations of unique pieces, with
+// and without the parity constraint, checking that every rank round-trips.
+static void benchPermutations(int size) {
+	if (size > MAX_RANKED_PERMUTATION) {
+		std::cout << "permutations, " << size << " pieces: too many to rank\n";
+		return;
+	}
+	for (int parity = 0; parity < 2; parity++) {
+		std::vector<std::vector<int> > perms = randomPermutations(size, parity);
+		std::vector<long long> ranks(BENCH_POSITIONS);
+		std::vector<int> unranked(size);
+		double calls = (double)BENCH_ROUNDS * BENCH_POSITIONS;
+
+		long long checksum = 0;
+		clock_t start = clock();
+		for (int r = 0; r < BENCH_ROUNDS; r++)
+			for (int i = 0; i < BENCH_POSITIONS; i++) {
+				ranks[i] = parity ? ksolve::pVector2IndexP(perms[i].data(), size) : ksolve::pVector2Index(perms[i].data(), size);
+				checksum += ranks[i];
+			}
+		double rankTime = nanoseconds(start, calls);
+
+		start = clock();
+		for (int r = 0; r < BENCH_ROUNDS; r++)
+			for (int i = 0; i < BENCH_POSITIONS; i++) {
+				if (parity)
+					ksolve::pIndex2ArrayP(ranks[i], size, unranked.data());
+				else
+					ksolve::pIndex2Array(ranks[i], size, unranked.data());
+				checksum += unranked[0];
+			}
+		double unrankTime = nanoseconds(start, calls);
+
+		long long count = parity ? ksolve::factorial(size) / 2 : ksolve::factorial(size);
+		for (int i = 0; i < BENCH_POSITIONS; i++) {
+			if (parity)
+				ksolve::pIndex2ArrayP(ranks[i], size, unranked.data());
+			else
+				ksolve::pIndex2Array(ranks[i], size, unranked.data());
+			if (ranks[i] < 0 || ranks[i] >= count || unranked != perms[i]) {
+				std::cerr << (parity ? "pVector2IndexP" : "pVector2Index") << ", " << size << " pieces: rank "
+					<< ranks[i] << " does not round-trip.\n";
+				exit(-1);
+			}
+		}
+
+		std::cout << (parity ? "pVector2IndexP" : "pVector2Index") << ", " << size << " pieces: rank "
+			<< rankTime << " ns, unrank " << unrankTime << " ns (checksum " << checksum << ")\n";
+	}
+}
+
+// Time ranking and unranking of random orientations, with and without the
+// constraint that they add up to a multiple of omod, checking round-trips.
+static void benchOrientations(int size, int omod) {
+	for (int parity = 0; parity < 2; parity++) {
+		std::vector<std::vector<int> > orients(BENCH_POSITIONS, std::vector<int>(size));
+		for (int i = 0; i < BENCH_POSITIONS; i++) {
+			int sum = 0;
+			for (int j = 0; j < size; j++) {
+				orients[i][j] = randomBelow(omod);
+				sum += orients[i][j];
+			}
+			if (parity)
+				orients[i][size - 1] = (orients[i][size - 1] + omod - sum % omod) % omod;
+		}
+		std::vector<long long> ranks(BENCH_POSITIONS);
+		std::vector<int> unranked(size);
+		double calls = (double)BENCH_ROUNDS * BENCH_POSITIONS;
+
+		long long checksum = 0;
+		clock_t start = clock();
+		for (int r = 0; r < BENCH_ROUNDS; r++)
+			for (int i = 0; i < BENCH_POSITIONS; i++) {
+				ranks[i] = parity ? ksolve::oparVector2Index(orients[i].data(), size, omod)
+					: ksolve::oVector2Index(orients[i].data(), size, omod);
+				checksum += ranks[i];
+			}
+		double rankTime = nanoseconds(start, calls);
+
+		start = clock();
+		for (int r = 0; r < BENCH_ROUNDS; r++)
+			for (int i = 0; i < BENCH_POSITIONS; i++) {
+				if (parity)
+					ksolve::oparIndex2Array(ranks[i], size, omod, unranked.data());
+				else
+					ksolve::oIndex2Array(ranks[i], size, omod, unranked.data());
+				checksum += unranked[size - 1];
+			}
+		double unrankTime = nanoseconds(start, calls);
+
+		for (int i = 0; i < BENCH_POSITIONS; i++) {
+			if (parity)
+				ksolve::oparIndex2Array(ranks[i], size, omod, unranked.data());
+			else
+				ksolve::oIndex2Array(ranks[i], size, omod, unranked.data());
+			if (ranks[i] < 0 || unranked != orients[i]) {
+				std::cerr << (parity ? "oparVector2Index" : "oVector2Index") << ", " << size << " pieces mod " << omod
+					<< ": rank " << ranks[i] << " does not round-trip.\n";
+				exit(-1);
+			}
+		}
+
+		std::cout << (parity ? "oparVector2Index" : "oVector2Index") << ", " << size << " pieces mod " << omod
+			<< ": rank " << rankTime << " ns, unrank " << unrankTime << " ns (checksum " << checksum << ")\n";
+	}
+}
+
+// Time packing and unpacking of random permutations, checking round-trips.
+static void benchPacking(int size) {
+	std::vector<std::vector<int> > perms = randomPermutations(size, false);
+	std::vector<std::vector<long long> > packed(BENCH_POSITIONS);
+	double calls = (double)BENCH_ROUNDS * BENCH_POSITIONS;
+
+	long long checksum = 0;
+	clock_t start = clock();
+	for (int r = 0; r < BENCH_ROUNDS; r++)
+		for (int i = 0; i < BENCH_POSITIONS; i++) {
+			packed[i] = ksolve::packVector(perms[i].data(), size);
+			checksum += packed[i][0];
+		}
+	double packTime = nanoseconds(start, calls);
+
+	start = clock();
+	for (int r = 0; r < BENCH_ROUNDS; r++)
+		for (int i = 0; i < BENCH_POSITIONS; i++)
+			checksum += ksolve::unpackVector(packed[i])[0];
+	double unpackTime = nanoseconds(start, calls);
+
+	for (int i = 0; i < BENCH_POSITIONS; i++)
+		if (ksolve::unpackVector(packed[i]) != perms[i]) {
+			std::cerr << "packVector, " << size << " pieces: position " << i << " does not round-trip.\n";
+			exit(-1);
+		}
+
+	std::cout << "packVector, " << size << " pieces: pack " << packTime << " ns, unpack "
+		<< unpackTime << " ns (checksum " << checksum << ")\n";
+}
+
+// A random position or move of one set
+static ksolve::substate randomSubstate(int size, int omod) {
+	ksolve::substate s;
+	s.size = size;
+	s.permutation = new int[size];
+	s.orientation = new int[size];
+	for (int i = 0; i < size; i++)
+		s.permutation[i] = i + 1;
+	std::shuffle(s.permutation, s.permutation + size, benchRandom);
+	for (int i = 0; i < size; i++)
+		s.orientation[i] = randomBelow(omod);
+	return s;
+}
+
+static void freePosition(ksolve::Position &p) {
+	for (unsigned int i = 0; i < p.size(); i++) {
+		delete[] p[i].permutation;
+		delete[] p[i].orientation;
+	}
+}
+
+// Time applyMove and mergeMoves on a puzzle of one set, checking that the
+// merge of two moves does the same as applying one after the other.
+static void benchMoves(int size, int omod) {
+	ksolve::PieceTypes datasets;
+	datasets[0].size = size;
+	datasets[0].omod = omod;
+	ksolve::Position state(1, randomSubstate(size, omod)), next(1, randomSubstate(size, omod));
+	ksolve::Position move1(1, randomSubstate(size, omod)), move2(1, randomSubstate(size, omod));
+	ksolve::Position twice(1, randomSubstate(size, omod)), merged;
+
+	int calls = BENCH_ROUNDS * BENCH_POSITIONS;
+	clock_t start = clock();
+	for (int r = 0; r < calls; r++) {
+		ksolve::applyMove(state, next, (r & 1) ? move2 : move1, datasets);
+		state.swap(next);
+	}
+	double applyTime = nanoseconds(start, calls);
+
+	long long checksum = 0;
+	int merges = calls / 16; // each merge allocates its result
+	start = clock();
+	for (int r = 0; r < merges; r++) {
+		merged = ksolve::mergeMoves(move1, move2, datasets);
+		checksum += merged[0].permutation[r % size];
+		freePosition(merged);
+	}
+	double mergeTime = nanoseconds(start, merges);
+
+	merged = ksolve::mergeMoves(move1, move2, datasets);
+	ksolve::applyMove(state, next, move1, datasets);
+	ksolve::applyMove(next, twice, move2, datasets);
+	ksolve::applyMove(state, next, merged, datasets);
+	for (int i = 0; i < size; i++)
+		if (next[0].permutation[i] != twice[0].permutation[i] || next[0].orientation[i] != twice[0].orientation[i]) {
+			std::cerr << "mergeMoves, " << size << " pieces mod " << omod << ": merged move does not match its two moves.\n";
+			exit(-1);
+		}
+
+	std::cout << "applyMove, " << size << " pieces mod " << omod << " (" << ksolve::kernels().name << " kernels): "
+		<< applyTime << " ns, mergeMoves " << mergeTime << " ns (checksum " << checksum << ")\n";
+	freePosition(state);
+	freePosition(next);
+	freePosition(move1);
+	freePosition(move2);
+	freePosition(twice);
+	freePosition(merged);
+}
+
+// The kernel sets this CPU can run, scalar first
+static std::vector<ksolve::simdKernels> availableKernels() {
+	std::vector<ksolve::simdKernels> sets;
+	ksolve::simdKernels k;
+	k.name = "scalar";
+	k.applySubmove = ksolve::applySubmoveScalar;
+	k.equal = ksolve::equalScalar;
+	k.rankChildOrientations = ksolve::rankChildOrientationsScalar;
+	sets.push_back(k);
+#ifdef KSOLVE_X86_KERNELS
+	if (__builtin_cpu_supports("avx2")) {
+		k.name = "AVX2";
+		k.applySubmove = ksolve::applySubmoveAVX2;
+		k.equal = ksolve::equalAVX2;
+		k.rankChildOrientations = ksolve::rankChildOrientationsAVX2;
+		sets.push_back(k);
+	}
+	if (__builtin_cpu_supports("avx512f")) {
+		k.name = "AVX-512";
+		k.applySubmove = ksolve::applySubmoveAVX512;
+		k.equal = ksolve::equalAVX512;
+		k.rankChildOrientations = ksolve::rankChildOrientationsAVX512;
+		sets.push_back(k);
+	}
+#endif
+	return sets;
+}
+
+// Random moves of one set, as the orientation ranking kernel takes them
+static ksolve::childMoves randomChildMoves(int nmoves, int size, int omod) {
+	ksolve::childMoves children;
+	children.nmoves = nmoves;
+	children.size = size;
+	children.omod = omod;
+	std::vector<int> perm(size);
+	for (int m = 0; m < nmoves; m++) {
+		for (int i = 0; i < size; i++)
+			perm[i] = i;
+		std::shuffle(perm.begin(), perm.end(), benchRandom);
+		for (int i = 0; i < size; i++) {
+			children.from.push_back(perm[i]);
+			children.twist.push_back(randomBelow(omod));
+		}
+	}
+	children.weight.resize(size);
+	for (int i = size - 1, w = 1; i >= 0; i--, w *= omod)
+		children.weight[i] = w;
+	return children;
+}
+
+// Time the move kernels of every kernel set on a set of the given size,
+// checking each result against the scalar kernels first.
+static void benchKernels(int size, int omod) {
+	std::vector<ksolve::simdKernels> sets = availableKernels();
+	ksolve::childMoves children = randomChildMoves(18, size, omod);
+	std::vector<int> p(size), o(size), mp(size), mo(size);
+	for (int i = 0; i < size; i++) {
+		p[i] = i + 1;
+		mp[i] = children.from[i] + 1;
+		mo[i] = children.twist[i];
+	}
+	std::vector<int> pout(size), oout(size), pref(size), oref(size);
+	std::vector<int> ranks(children.nmoves), rankref(children.nmoves);
+	bool rankable = size * log(omod) < log(MAX_RANKED_ORIENTATIONS); // ranks must fit in an int
+	for (unsigned int s = 0; s < sets.size(); s++) {
+		ksolve::simdKernels &k = sets[s];
+		// check against scalar on a few random positions first
+		for (int t = 0; t < 100; t++) {
+			std::shuffle(p.begin(), p.end(), benchRandom);
+			for (int i = 0; i < size; i++)
+				o[i] = randomBelow(omod);
+			sets[0].applySubmove(pref.data(), oref.data(), p.data(), o.data(), mp.data(), mo.data(), size, omod);
+			k.applySubmove(pout.data(), oout.data(), p.data(), o.data(), mp.data(), mo.data(), size, omod);
+			if (rankable) {
+				sets[0].rankChildOrientations(o.data(), children, rankref.data());
+				k.rankChildOrientations(o.data(), children, ranks.data());
+			}
+			if (pout != pref || oout != oref || ranks != rankref || !k.equal(pout.data(), pref.data(), size)
+					|| (size > 0 && k.equal(p.data(), pout.data(), size) != sets[0].equal(p.data(), pout.data(), size))) {
+				std::cerr << k.name << " kernels disagree with scalar for size " << size << ", omod " << omod << ".\n";
+				exit(-1);
+			}
+		}
+
+		int calls = BENCH_ROUNDS * BENCH_POSITIONS;
+		clock_t start = clock();
+		for (int r = 0; r < calls; r++) {
+			k.applySubmove(pout.data(), oout.data(), p.data(), o.data(), mp.data(), mo.data(), size, omod);
+			p.swap(pout);
+			o.swap(oout);
+		}
+		double applyTime = (clock() - start) / (double)CLOCKS_PER_SEC;
+
+		std::cout << k.name << " kernels, " << size << " pieces mod " << omod << ": apply move "
+			<< 1e9 * applyTime / calls << " ns";
+		if (!rankable) {
+			std::cout << "\n";
+			continue;
+		}
+		start = clock();
+		long long checksum = 0;
+		for (int r = 0; r < calls / children.nmoves; r++) {
+			k.rankChildOrientations(o.data(), children, ranks.data());
+			checksum += ranks[r % children.nmoves];
+			o[r % size] = (o[r % size] + 1) % omod;
+		}
+		double rankTime = (clock() - start) / (double)CLOCKS_PER_SEC;
+
+		std::cout << ", rank children " << 1e9 * rankTime / (calls / children.nmoves)
+			<< " ns for " << children.nmoves << " moves (checksum " << checksum << ")\n";
+	}
+}
+
+int main(int argc, char *argv[]) {
+	int corners3[] = {1, 2, 1, 2, 2, 1, 2, 1};
+	int edges3[] = {1, 2, 1, 2, 3, 3, 3, 3, 1, 2, 1, 2};
+	int centers4[] = {1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6};
+	benchMultiset("3x3x3_3color corners", std::vector<int>(corners3, corners3 + 8));
+	benchMultiset("3x3x3_3color edges", std::vector<int>(edges3, edges3 + 12));
+	benchMultiset("4x4x4 centers", std::vector<int>(centers4, centers4 + 24));
+	int sizes[] = {8, 12, 20, 24};
+	int omods[] = {2, 3, 5};
+	for (int i = 0; i < 4; i++) {
+		benchPermutations(sizes[i]);
+		for (int j = 0; j < 3; j++)
+			benchOrientations(sizes[i], omods[j]);
+		benchPacking(sizes[i]);
+		for (int j = 0; j < 3; j++)
+			benchMoves(sizes[i], omods[j]);
+	}
+	benchKernels(8, 3);
+	benchKernels(12, 2);
+	benchKernels(20, 2);
+	benchKernels(24, 1);
+	benchKernels(40, 1);
+	benchKernels(40, 3);
+	return EXIT_SUCCESS;
+}
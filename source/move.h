@@ -25,28 +25,11 @@
 // faster version of original applyMove
 static void applyMove(Position& state, Position& new_state, Position& move, PieceTypes& datasets){
 	Position::iterator iter;
+	const simdKernels &k = kernels();
         for (int iter=0; iter<move.size(); iter++) {
-		int size = move[iter].size;
-		int omod = datasets[iter].omod;
-		int* orientOut = new_state[iter].orientation;
-		int* permute1 = state[iter].permutation;
-		int* permute2 = move[iter].permutation;
-		int* permuteOut = new_state[iter].permutation;
-		
-		if (omod == 1) {
-			for (int i=0; i < size; i++) {
-				orientOut[i] = 0;
-				permuteOut[i] = permute1[permute2[i] - 1];
-			}
-		} else {
-			int* orient1 = state[iter].orientation;
-			int* orient2 = move[iter].orientation;
-			for (int i=0; i < size; i++) {
-				int permuted = permute2[i] - 1;
-				orientOut[i] = (orient1[permuted] + orient2[permuted]) % omod;
-				permuteOut[i] = permute1[permuted];
-			}
-		}
+		k.applySubmove(new_state[iter].permutation, new_state[iter].orientation,
+			state[iter].permutation, state[iter].orientation,
+			move[iter].permutation, move[iter].orientation, move[iter].size, datasets[iter].omod);
 	}
 }
 
@@ -94,14 +77,11 @@ static Position mergeMoves(Position move1, Position move2, PieceTypes& datasets)
 		temp.permutation = applySubmoveP(move1[iter].permutation, move2[iter].permutation, move2[iter].size);
 
 		int* pinv = new int[move1[iter].size];
-		for (int i = 0; i < move1[iter].size; i++){
-			for (int j = 0; j < move1[iter].size; j++){
-				if (move1[iter].permutation[j] == i + 1)
-					pinv[i] = j + 1;
-			}
-		}
+		for (int j = 0; j < move1[iter].size; j++)
+			pinv[move1[iter].permutation[j] - 1] = j + 1;
 		
 		temp.orientation = applySubmoveP(move2[iter].orientation, pinv, move2[iter].size);
+		delete []pinv;
 		for (int i = 0; i < move1[iter].size; i++)
 			temp.orientation[i] += move1[iter].orientation[i];
 		if (datasets[iter].omod > 1) // fix for bandaged puzzle centers
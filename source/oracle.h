@@ -0,0 +1,401 @@
+/*
+ KSolve+ - Puzzle solving program.
+ Copyright (C) 2007-2013 Kre Krig and Michael Gottlieb
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+// Finished God's Algorithm tables saved to disk, and optimal solving from
+// them without any search.
+
+#ifndef ORACLE_H
+#define ORACLE_H
+
+// Written at the start of oracle files, which are ignored if it differs.
+static const int ORACLE_FILE_VERSION = 4;
+static const int ORACLE_HEADER_SIZE = 4096; // the distances start here
+
+// A God's Algorithm table mapped from its file
+struct godOracle {
+	int metric; // 0 = HTM, 1 = QTM
+	int format; // 0 = one byte per position, 3 = 2-bit codes (depth mod 3, 3 = not reachable),
+	            // 5 = one byte per position reached, numbered by a perfect hash of packPosition2,
+	            // 6 = the same, hashing the index of the array
+	perfectHash sparseIndex; // for formats 5 and 6
+	long long totalSize;
+	int maxDepth;
+	const unsigned char *data;
+	std::map<std::pair<int, int>, long long> subSizes;
+	void *mapping;
+	long long mappingSize;
+	std::vector<unsigned char> copy; // the data, where files cannot be mapped
+};
+
+// FNV-1a hash of everything the distances depend on: the sets, the solved
+// state, the moves and the blocks
+static unsigned long long puzzleHash(Position& solved, MoveList& moves, PieceTypes& datasets, std::vector<Block>& blocks) {
+	unsigned long long hash = 14695981039346656037ULL;
+	std::vector<long long> words;
+	for (int iter = 0; iter < solved.size(); iter++) {
+		words.push_back(solved[iter].size);
+		words.push_back(datasets[iter].omod);
+		for (unsigned int i = 0; i < datasets[iter].freeOrientation.size(); i++)
+			words.push_back(-2 - datasets[iter].freeOrientation[i]);
+		for (int i = 0; i < solved[iter].size; i++) {
+			words.push_back(solved[iter].permutation[i]);
+			words.push_back(solved[iter].orientation[i]);
+		}
+	}
+	MoveList::iterator moveIter;
+	for (moveIter = moves.begin(); moveIter != moves.end(); moveIter++) {
+		words.push_back(moveIter->first);
+		words.push_back(moveIter->second.qtm);
+		Position &move = moveIter->second.state;
+		for (int iter = 0; iter < move.size(); iter++)
+			for (int i = 0; i < move[iter].size; i++) {
+				words.push_back(move[iter].permutation[i]);
+				words.push_back(move[iter].orientation[i]);
+			}
+	}
+	for (unsigned int b = 0; b < blocks.size(); b++) {
+		Block::iterator iter;
+		for (iter = blocks[b].begin(); iter != blocks[b].end(); iter++) {
+			words.push_back(-1 - iter->first);
+			std::set<int>::iterator piece;
+			for (piece = iter->second.begin(); piece != iter->second.end(); piece++)
+				words.push_back(*piece);
+		}
+	}
+	for (unsigned int w = 0; w < words.size(); w++)
+		for (int byte = 0; byte < 8; byte++) {
+			hash ^= (words[w] >> (8 * byte)) & 255;
+			hash *= 1099511628211ULL;
+		}
+	return hash;
+}
+
+// Save a finished table: a text header padded to ORACLE_HEADER_SIZE bytes,
+// the perfect hash numbering the positions (if any), then the distances as
+// the table kept them
+static void saveOracle(const string &filename, unsigned long long hash, int metric, int format, long long totalSize, int maxDepth,
+		const char *data, long long bytes, const perfectHash *index) {
+	std::ostringstream header;
+	header << "ksolve-oracle " << ORACLE_FILE_VERSION << " " << hash << " " << metric << " " << format
+		<< " " << totalSize << " " << maxDepth;
+	if (index != NULL)
+		header << " " << index->width << " " << index->seed << " " << index->slots;
+	header << "\n";
+	string text = header.str();
+	text.resize(ORACLE_HEADER_SIZE, ' ');
+	text[ORACLE_HEADER_SIZE - 1] = '\n';
+	string temporary = filename + ".tmp";
+	std::ofstream out(temporary.c_str(), std::ios::binary);
+	out.write(text.data(), text.size());
+	if (index != NULL)
+		index->write(out);
+	out.write(data, bytes);
+	out.close();
+	if (out.fail() || rename(temporary.c_str(), filename.c_str()) != 0) {
+		std::cout << "Could not save God's Algorithm table to " << filename << ".\n";
+		remove(temporary.c_str());
+		return;
+	}
+	std::cout << "Saved God's Algorithm table to " << filename << ".\n";
+}
+
+// Map a saved table for this puzzle and metric; false if there is none
+static bool openOracle(const string &filename, unsigned long long hash, int metric, Position& solved, PieceTypes& datasets, godOracle &oracle) {
+	std::ifstream in(filename.c_str(), std::ios::binary);
+	if (!in.good())
+		return false;
+	string magic;
+	int version;
+	unsigned long long savedHash;
+	in >> magic >> version >> savedHash >> oracle.metric >> oracle.format >> oracle.totalSize >> oracle.maxDepth;
+	if (in.fail() || magic != "ksolve-oracle" || version != ORACLE_FILE_VERSION || savedHash != hash || oracle.metric != metric)
+		return false;
+	long long bytes = oracle.format == 3 ? 8 * ((oracle.totalSize + 31) / 32) : oracle.totalSize;
+	long long offset = ORACLE_HEADER_SIZE; // where the distances start
+	if (oracle.format >= 5) {
+		perfectHash &index = oracle.sparseIndex;
+		in >> index.width >> index.seed >> index.slots;
+		index.keys = oracle.totalSize;
+		in.seekg(ORACLE_HEADER_SIZE);
+		if (in.fail() || index.keys <= 0 || index.slots <= index.keys || index.width <= 0 || !index.read(in))
+			return false;
+		offset += index.bytes();
+	}
+	oracle.subSizes.clear();
+	computeSubSizes(solved, datasets, oracle.subSizes);
+	in.seekg(0, std::ios::end);
+	if ((long long)in.tellg() != offset + bytes)
+		return false;
+	in.close();
+
+#ifdef __EMSCRIPTEN__
+	oracle.mapping = NULL;
+	oracle.copy.resize(bytes);
+	std::ifstream data(filename.c_str(), std::ios::binary);
+	data.seekg(offset);
+	data.read((char *)&oracle.copy[0], bytes);
+	if (data.fail())
+		return false;
+	oracle.data = &oracle.copy[0];
+#else
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	oracle.mappingSize = offset + bytes;
+	oracle.mapping = mmap(NULL, (std::size_t)oracle.mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (oracle.mapping == MAP_FAILED)
+		return false;
+	oracle.data = (const unsigned char *)oracle.mapping + offset;
+#endif
+	return true;
+}
+
+static void closeOracle(godOracle &oracle) {
+#ifndef __EMSCRIPTEN__
+	if (oracle.mapping != NULL)
+		munmap(oracle.mapping, (std::size_t)oracle.mappingSize);
+#endif
+	oracle.mapping = NULL;
+	oracle.copy.clear();
+}
+
+// Can this position be looked up? Pieces must all be known, and the parts
+// packed with a parity constraint must match the solved state there, since
+// the index leaves out what the constraint would fix.
+static bool oracleCanIndex(Position& position, Position& solved, PieceTypes& datasets, godOracle &oracle) {
+	for (int iter = 0; iter < position.size(); iter++)
+		for (int i = 0; i < position[iter].size; i++)
+			if (position[iter].permutation[i] <= 0 || position[iter].permutation[i] > position[iter].size
+					|| position[iter].orientation[i] < 0 || position[iter].orientation[i] >= datasets[iter].omod)
+				return false;
+	if (oracle.format == 5) // packPosition2 keeps everything
+		return true;
+	std::map<std::pair<int, int>, long long>::iterator iter;
+	for (iter = oracle.subSizes.begin(); iter != oracle.subSizes.end(); iter++) {
+		substate &sub = position[iter->first.first];
+		substate &goal = solved[iter->first.first];
+		if (iter->first.second == 4
+				&& permutationParity(sub.permutation, sub.size) != permutationParity(goal.permutation, goal.size))
+			return false;
+		if (iter->first.second == 5
+				&& permutationParity(sub.permutation, sub.size) != linkedParity(position, solved, datasets, iter->first.first))
+			return false;
+		if (iter->first.second == 3 && pVector3Index(sub.permutation, sub.size, datasets[iter->first.first].prank) < 0)
+			return false;
+		if (iter->first.second == 0) {
+			int sum = 0;
+			for (int i = 0; i < sub.size; i++)
+				sum += sub.orientation[i] - goal.orientation[i];
+			if (sum % datasets[iter->first.first].omod != 0)
+				return false;
+		}
+	}
+	return true;
+}
+
+// Where a position is in the table, or -1 if a table of the reached
+// positions does not have it
+static long long oracleIndex(godOracle &oracle, Position& position, PieceTypes& datasets) {
+	if (oracle.format == 5) {
+		std::vector<long long> key = packPosition2(position, datasets, oracle.sparseIndex.width);
+		return oracle.sparseIndex.find((const unsigned long long *)&key[0]);
+	}
+	long long index = packPosition(position, oracle.subSizes, datasets);
+	if (oracle.format == 6)
+		return oracle.sparseIndex.find((const unsigned long long *)&index);
+	return index;
+}
+
+// The 2-bit code of a position
+static inline int oracleCode(godOracle &oracle, long long index) {
+	return (oracle.data[8 * (index >> 5) + ((index & 31) >> 2)] >> (2 * (index & 3))) & 3;
+}
+
+// Is the position at index depth moves from solved? For 2-bit codes this is
+// only right if it is known to be within one move of that depth.
+static bool oracleAt(godOracle &oracle, long long index, int depth) {
+	if (index < 0)
+		return false;
+	if (oracle.format != 3)
+		return oracle.data[index] == depth;
+	return oracleCode(oracle, index) == depth % 3;
+}
+
+// Distance of a position from solved, or -1 if the table does not know it.
+// With 2-bit codes, the distance is found by walking to solved.
+static int oracleDistance(godOracle &oracle, Position& position, Position& solved, MoveList& moves, PieceTypes& datasets, std::vector<Block>& blocks) {
+	if (!oracleCanIndex(position, solved, datasets, oracle))
+		return -1;
+	long long index = oracleIndex(oracle, position, datasets);
+	if (index < 0)
+		return -1;
+	if (oracle.format != 3)
+		return (signed char)oracle.data[index];
+	int code = oracleCode(oracle, index);
+	if (code == 3)
+		return -1;
+
+	// follow codes that step down by one (mod 3) until nothing does
+	Position cur(position.size()), next(position.size());
+	for (int iter = 0; iter < position.size(); iter++) {
+		cur[iter] = newSubstate(position[iter].size);
+		next[iter] = newSubstate(position[iter].size);
+		std::copy(position[iter].permutation, position[iter].permutation + position[iter].size, cur[iter].permutation);
+		std::copy(position[iter].orientation, position[iter].orientation + position[iter].size, cur[iter].orientation);
+	}
+	int distance = 0;
+	while (1) {
+		bool stepped = false;
+		MoveList::iterator moveIter;
+		for (moveIter = moves.begin(); moveIter != moves.end() && !stepped; moveIter++) {
+			if (blocks.size() != 0 && !blockLegal(cur, blocks, moveIter->second.state))
+				continue;
+			applyMove(cur, next, moveIter->second.state, datasets);
+			if (oracleAt(oracle, oracleIndex(oracle, next, datasets), code + 2)) {
+				stepped = true;
+				code = (code + 2) % 3;
+				distance++;
+				cur.swap(next);
+			}
+		}
+		if (!stepped)
+			break;
+	}
+	for (int iter = 0; iter < position.size(); iter++) {
+		delete []cur[iter].permutation;
+		delete []cur[iter].orientation;
+		delete []next[iter].permutation;
+		delete []next[iter].orientation;
+	}
+	return distance;
+}
+
+// Is a position the solved one? Orientations that a table made with -I
+// leaves out do not count.
+static bool oracleSolved(Position& position, Position& solved, PieceTypes& datasets) {
+	std::vector<int> kept, keptSolved;
+	for (int iter = 0; iter < position.size(); iter++) {
+		substate &sub = position[iter];
+		if (!std::equal(sub.permutation, sub.permutation + sub.size, solved[iter].permutation))
+			return false;
+		if (datasets[iter].omod == 1)
+			continue;
+		int *orientation = keptOrientation(sub, datasets[iter], kept);
+		if (!std::equal(orientation, orientation + sub.size, keptOrientation(solved[iter], datasets[iter], keptSolved)))
+			return false;
+	}
+	return true;
+}
+
+// Counts of optimal solutions by index, depth and previous move
+typedef std::map<std::pair<long long, std::pair<int, int> >, long long> oracleMemo;
+
+// Count (and print, if print is set) the optimal solutions of a position
+// depth moves from solved, following only moves to positions one step
+// closer. Forbidden pairs are skipped as in the search, so the solutions
+// are the ones treeSolve would print, in the same order. Counts are
+// memoized by index, depth and previous move.
+static long long oracleSolutions(godOracle &oracle, Position& position, Position& solved, MoveList& moves, PieceTypes& datasets,
+		std::set<MovePair>& forbiddenPairs, std::vector<Block>& blocks, int depth, int old_move, string sequence, bool print,
+		oracleMemo &memo) {
+	if (depth == 0) {
+		if (!oracleSolved(position, solved, datasets))
+			return 0;
+		if (print)
+			std::cout << sequence << "\n";
+		return 1;
+	}
+	long long index = oracleIndex(oracle, position, datasets);
+	std::pair<long long, std::pair<int, int> > key(index, std::make_pair(depth, old_move));
+	if (!print && memo.count(key))
+		return memo[key];
+
+	long long count = 0;
+	Position next(position.size());
+	for (int iter = 0; iter < position.size(); iter++)
+		next[iter] = newSubstate(position[iter].size);
+	MoveList::iterator moveIter;
+	for (moveIter = moves.begin(); moveIter != moves.end(); moveIter++) {
+		if (forbiddenPairs.find(MovePair(old_move, moveIter->first)) != forbiddenPairs.end())
+			continue;
+		if (blocks.size() != 0 && !blockLegal(position, blocks, moveIter->second.state))
+			continue;
+		int newDepth = depth - (oracle.metric == 0 ? 1 : moveIter->second.qtm);
+		if (newDepth < 0)
+			continue;
+		applyMove(position, next, moveIter->second.state, datasets);
+		if (!oracleAt(oracle, oracleIndex(oracle, next, datasets), newDepth))
+			continue;
+		count += oracleSolutions(oracle, next, solved, moves, datasets, forbiddenPairs, blocks, newDepth, moveIter->first,
+				sequence + " " + moveIter->second.name, print, memo);
+	}
+	for (int iter = 0; iter < position.size(); iter++) {
+		delete []next[iter].permutation;
+		delete []next[iter].orientation;
+	}
+	memo[key] = count;
+	return count;
+}
+
+// Number of optimal solutions of a position, or -1 if the table does not
+// know it
+static long long countOptimalSolutions(godOracle &oracle, Position& position, Position& solved, MoveList& moves, PieceTypes& datasets,
+		std::set<MovePair>& forbiddenPairs, std::vector<Block>& blocks) {
+	int depth = oracleDistance(oracle, position, solved, moves, datasets, blocks);
+	if (depth < 0)
+		return -1;
+	oracleMemo memo;
+	return oracleSolutions(oracle, position, solved, moves, datasets, forbiddenPairs, blocks, depth, -1, " ", false, memo);
+}
+
+// Solve a scramble from a saved table, printing what the search would: the
+// depths and then every optimal solution, and with verbose their number.
+// False if the table cannot be used for this scramble (ignored pieces, move
+// limits, slack, a solution limit, or a position or forbidden pairs the
+// table does not cover), so the search is needed.
+static bool solveFromOracle(godOracle &oracle, ScrambleDef& scramble, Position& solved, MoveList& moves, PieceTypes& datasets,
+		std::set<MovePair>& forbiddenPairs, std::vector<Block>& blocks, int verbose) {
+	if (scramble.slack != 0 || scramble.moveLimits.size() != 0 || scramble.max_solutions != 0)
+		return false;
+	for (int iter = 0; iter < scramble.ignore.size(); iter++)
+		for (int i = 0; i < scramble.ignore[iter].size; i++)
+			if (scramble.ignore[iter].permutation[i] != 0 || scramble.ignore[iter].orientation[i] != 0)
+				return false;
+	long long count = countOptimalSolutions(oracle, scramble.state, solved, moves, datasets, forbiddenPairs, blocks);
+	if (count <= 0)
+		return false;
+	int depth = oracleDistance(oracle, scramble.state, solved, moves, datasets, blocks);
+
+	std::cout << "Depth 0\n";
+	for (int d = 1; d <= depth; d++) {
+		if (d > scramble.max_depth) {
+			std::cout << "\nMax depth reached, aborting.\n";
+			return true;
+		}
+		std::cout << "Depth " << d << "\n";
+	}
+	oracleMemo memo;
+	oracleSolutions(oracle, scramble.state, solved, moves, datasets, forbiddenPairs, blocks, depth, -1, " ", true, memo);
+	if (verbose)
+		std::cout << count << " optimal solution" << (count == 1 ? "" : "s") << " from the table.\n";
+	return true;
+}
+
+#endif
@@ -22,7 +22,7 @@
 #ifndef PRUNING_H
 #define PRUNING_H
 
-static PruneTable getCompletePruneTables(Position solved, MoveList moves, PieceTypes datasets, Position ignore, string filename, bool usePruneTable)
+static PruneTable getCompletePruneTables(Position solved, MoveList moves, PieceTypes datasets, Position ignore, PatternSubsets subsets, string filename, bool usePruneTable)
 {
 	PruneTable table;
 	string filename2 = filename + ".tables";
@@ -68,17 +68,24 @@ static PruneTable getCompletePruneTables(Position solved, MoveList moves, PieceT
 		// reopen ifstream
 		fin.open(filename2.c_str(), std::ios::in | std::ios::binary);
 	}
+
+	bool otherVersion = false; // were the tables written in another format?
+	if (tablesExist && !oldTables) {
+		int version;
+		fin.read((char*) (&version), sizeof(version));
+		if (version != TABLE_FILE_VERSION) {
+			otherVersion = true;
+			fin.close();
+		}
+	}
 	
-	if (tablesExist && !oldTables){
-		std::cout << "Pruning tables found on file.\n";
+	if (tablesExist && !oldTables && !otherVersion){
+		messages() << "Pruning tables found on file.\n";
 		
 		// Tables exist
-		int checksum;
-		fin.read((char*) (&checksum), sizeof(checksum)); // Not used yet
-
 		for (int iter=0; iter<solved.size(); iter++) {
 			int size = solved[iter].size;
-			if (datasets[iter].size != size) std::cout << "WTF\n";
+			if (datasets[iter].size != size) messages() << "WTF\n";
 			if (factorial(size) <= MAX_COMPLETE_PERMUTATION_TABLE_SIZE && factorial(size) != -1 && uniquePermutation(solved[iter].permutation, size)){ 
 				// Complete tables, unique pieces
 				// Read permutation table
@@ -123,6 +130,22 @@ static PruneTable getCompletePruneTables(Position solved, MoveList moves, PieceT
 					table[iter].partialpermutation[key] = depth;
 				}
 				table[iter].partialpermutation_depth = maxDepth(table[iter].partialpermutation);
+
+				// Pattern-subset tables
+				int nsubsets;
+				fin.read((char*) (&nsubsets), sizeof(nsubsets));
+				for (int i = 0; i < nsubsets; i++){
+					int npieces;
+					fin.read((char*) (&npieces), sizeof(npieces));
+					std::vector<int> pieces(npieces);
+					for (int j = 0; j < npieces; j++)
+						fin.read((char*) (&pieces[j]), sizeof(pieces[j]));
+					subsetprune subset;
+					subset.rank = makeMultisetRank(solved[iter].permutation, size, pieces);
+					subset.table.resize(subset.rank.combinations);
+					fin.read(&subset.table[0], subset.table.size());
+					table[iter].subsets.push_back(subset);
+				}
 			}
 
 			double osize = log(datasets[iter].omod) * size;
@@ -165,19 +188,21 @@ static PruneTable getCompletePruneTables(Position solved, MoveList moves, PieceT
 		
 	}    
 	else{
-		if (tablesExist) { // tables exist, but they're old
-			std::cout << "Pruning tables older than def file, recomputing.\n";
+		if (otherVersion) { // tables exist, but in another format
+			messages() << "Pruning tables have an old format, recomputing.\n";
+		} else if (tablesExist) { // tables exist, but they're old
+			messages() << "Pruning tables older than def file, recomputing.\n";
 		} else { // no tables on file
-			std::cout << "Pruning tables not found on file, computing.\n";
+			messages() << "Pruning tables not found on file, computing.\n";
 		}
-		table = buildCompletePruneTables(solved, moves, datasets, ignore);
+		table = buildCompletePruneTables(solved, moves, datasets, ignore, subsets);
 		std::ofstream fout;
 		fout.open(filename2.c_str(), std::ios::out | std::ios::binary);
-		int checksum = 1; // Not used yet
-		fout.write((char*) (&checksum), sizeof(checksum));
+		int version = TABLE_FILE_VERSION;
+		fout.write((char*) (&version), sizeof(version));
 		for (int iter=0; iter<solved.size(); iter++) {
 			int size = solved[iter].size;
-			if (datasets[iter].size != size) std::cout << "WTF\n";
+			if (datasets[iter].size != size) messages() << "WTF\n";
 			if (factorial(size) <= MAX_COMPLETE_PERMUTATION_TABLE_SIZE && factorial(size) != -1 && uniquePermutation(solved[iter].permutation, size)){
 
 				// Write permutation table
@@ -211,6 +236,18 @@ static PruneTable getCompletePruneTables(Position solved, MoveList moves, PieceT
 						fout.write((char*) (&(*tmp_iter).first[i]), sizeof(tmp_iter->first[i]));
 						// Keys
 				}
+
+				// Pattern-subset tables
+				int nsubsets = table[iter].subsets.size();
+				fout.write((char*) (&nsubsets), sizeof(nsubsets));
+				for (int i = 0; i < nsubsets; i++){
+					subsetprune &subset = table[iter].subsets[i];
+					int npieces = subset.rank.pieces.size();
+					fout.write((char*) (&npieces), sizeof(npieces));
+					for (int j = 0; j < npieces; j++)
+						fout.write((char*) (&subset.rank.pieces[j]), sizeof(subset.rank.pieces[j]));
+					fout.write(&subset.table[0], subset.table.size());
+				}
 			}
 
 			double osize = log(datasets[iter].omod) * size;
@@ -246,7 +283,7 @@ static PruneTable getCompletePruneTables(Position solved, MoveList moves, PieceT
 	return table;
 }
 				
-static PruneTable buildCompletePruneTables(Position solved, MoveList moves, PieceTypes datasets, Position ignore)
+static PruneTable buildCompletePruneTables(Position solved, MoveList moves, PieceTypes datasets, Position ignore, PatternSubsets subsets)
 {
 	PruneTable table;
 	std::vector<int> tmp_ignore;
@@ -278,7 +315,26 @@ static PruneTable buildCompletePruneTables(Position solved, MoveList moves, Piec
 				temp_perm.push_back(solved[iter].permutation[i]);
 			table[iter].partialpermutation = buildPartialPermutationPruningTable(temp_perm, moves, iter, tmp_ignore);
 			table[iter].partialpermutation_depth = maxDepth(table[iter].partialpermutation);
+
+			// Pattern-subset tables, either from the def file or chosen here
+			std::vector<std::vector<int> > pieceSubsets;
+			if (subsets.find(iter) != subsets.end())
+				pieceSubsets = maskPatternSubsets(subsets[iter], temp_perm, tmp_ignore, iter);
+			else
+				pieceSubsets = choosePatternSubsets(temp_perm, tmp_ignore);
+			for (unsigned int i = 0; i < pieceSubsets.size(); i++){
+				subsetprune subset;
+				subset.rank = makeMultisetRank(solved[iter].permutation, size, pieceSubsets[i]);
+				if (subset.rank.combinations == -1 || subset.rank.combinations > MAX_SUBSET_PERMUTATION_TABLE_SIZE){
+					std::cerr << "Pattern subset " << i+1 << " of set " << setnameFromIndex(iter) << " is too large for a table.\n";
+					exit(-1);
+				}
+				buildSubsetPermutationPruningTable(subset, temp_perm, moves, iter, i);
+				table[iter].subsets.push_back(subset);
+			}
 		}
+		if (table[iter].permutation.size() > 0 && subsets.find(iter) != subsets.end())
+			messages() << "Set " << setnameFromIndex(iter) << " has a complete permutation table, ignoring its pattern subsets.\n";
 
 		tmp_ignore.clear();
 		if (iter < ignore.size() && ignore[iter].size > 0)
@@ -304,7 +360,7 @@ static PruneTable buildCompletePruneTables(Position solved, MoveList moves, Piec
 
 static std::vector<char> buildCompleteOrientationPruningTable(std::vector<int> solved, MoveList moves, int setname, int omod, std::vector<int> ignore)
 {
-	std::cout << "Building pruning for " << setnameFromIndex(setname) << " orientation.\n";
+	messages() << "Building pruning for " << setnameFromIndex(setname) << " orientation.\n";
 	std::vector<char> table;
 	int vector_size = solved.size();
 	MoveList::iterator iter;
@@ -317,7 +373,7 @@ static std::vector<char> buildCompleteOrientationPruningTable(std::vector<int> s
 	for (int i = 0; i < tablesize; i++)
 		table[i] = -1;
 		
-	std::cout << "tablesize " << tablesize << "\n";
+	messages() << "tablesize " << tablesize << "\n";
 
 	table[oVector2Index(solved, omod)] = 0; // Put solved position in table
 
@@ -339,7 +395,7 @@ static std::vector<char> buildCompleteOrientationPruningTable(std::vector<int> s
 		}
 		len++;
 		if (ignore.empty()) // Dont write if first pass
-			std::cout << c << " positions at depth " << len << "\n"; 
+			messages() << c << " positions at depth " << len << "\n"; 
 	}while(c > 0);
 	
 	if (!ignore.empty()){ // If some pieces are to be ignored, use first pass to generate all
@@ -360,7 +416,7 @@ static std::vector<char> buildCompleteOrientationPruningTable(std::vector<int> s
 					table[i] = -1;
 			}
 		}
-		std::cout << c << " solved positions.\n";
+		messages() << c << " solved positions.\n";
 		
 		int len = 0;
 		int c;
@@ -379,7 +435,7 @@ static std::vector<char> buildCompleteOrientationPruningTable(std::vector<int> s
 				}
 			}      
 			len++;
-			std::cout << c << " positions at depth " << len << "\n"; 
+			messages() << c << " positions at depth " << len << "\n"; 
 		}while(c > 0);
 	}
 	
@@ -389,7 +445,7 @@ static std::vector<char> buildCompleteOrientationPruningTable(std::vector<int> s
 // Complete table, unique pieces
 static std::vector<char> buildCompletePermutationPruningTable(std::vector<int> solved, MoveList moves, int setname, std::vector<int> ignore)
 {
-	std::cout << "Building pruning for " << setnameFromIndex(setname) << " permutation.\n";
+	messages() << "Building pruning for " << setnameFromIndex(setname) << " permutation.\n";
 	std::vector<char> table;
 	int vector_size = solved.size();
 	MoveList::iterator iter;
@@ -400,7 +456,7 @@ static std::vector<char> buildCompletePermutationPruningTable(std::vector<int> s
 	for (int i = 0; i < tablesize; i++)
 		table[i] = -1;
 		
-	std::cout << "tablesize " << tablesize << "\n";
+	messages() << "tablesize " << tablesize << "\n";
 
 	table[pVector2Index(solved)] = 0; // Put solved position in table
 
@@ -422,9 +478,9 @@ static std::vector<char> buildCompletePermutationPruningTable(std::vector<int> s
 		}
 		len++;
 		if (ignore.empty())
-			std::cout << c << " positions at depth " << len << "\n";
+			messages() << c << " positions at depth " << len << "\n";
 		else
-			std::cout << c << " positions in phase one, depth " << len << "\n"; 
+			messages() << c << " positions in phase one, depth " << len << "\n"; 
 	}while(c > 0);
 
 	if (!ignore.empty()){
@@ -445,7 +501,7 @@ static std::vector<char> buildCompletePermutationPruningTable(std::vector<int> s
 				delete tmp_p;
 			}
 		}
-		std::cout << c << " solved positions.\n";
+		messages() << c << " solved positions.\n";
 		int len = 0;
 		int c;
 		do
@@ -463,7 +519,7 @@ static std::vector<char> buildCompletePermutationPruningTable(std::vector<int> s
 				}      
 			}
 			len++;
-			std::cout << c << " positions at depth " << len << "\n"; 
+			messages() << c << " positions at depth " << len << "\n"; 
 		}while(c > 0);
 	}
 
@@ -473,62 +529,46 @@ static std::vector<char> buildCompletePermutationPruningTable(std::vector<int> s
 // Complete table, not unique pieces
 static std::vector<char> buildCompletePermutationPruningTable3(std::vector<int> solved, MoveList moves, int setname, std::vector<int> ignore)
 {
-	std::cout << "Building pruning for " << setnameFromIndex(setname) << " permutation\n";
+	messages() << "Building pruning for " << setnameFromIndex(setname) << " permutation\n";
 	std::vector<char> table;
 	int vector_size = solved.size();
-	MoveList::iterator iter;
-	int tablesize = combinations(solved);
+	multisetRank rank = makeMultisetRank(solved.data(), vector_size);
+	int tablesize = rank.combinations;
 		
 	table.resize(tablesize);
 	for (int i = 0; i < tablesize; i++)
 		table[i] = -1;
 		
-	std::cout << "tablesize " << tablesize << "\n";
+	messages() << "tablesize " << tablesize << "\n";
 
-	table[pVector3Index(solved)] = 0; // Put solved position in table
+	std::vector<int*> movePerms;
+	MoveList::iterator iter;
+	for (iter = moves.begin(); iter != moves.end(); iter++)
+		movePerms.push_back(iter->second.state[setname].permutation);
+	std::vector<int> perm(vector_size), moved(vector_size);
 
-	int len = 0;
-	int c;
-	do
-	{
-		c = 0;
-		for (int p = 0; p < tablesize; p++){
-			if (table[p] == len){
-				for (iter = moves.begin(); iter != moves.end(); iter++){
-					// FIX, assumes that inverses to all moves are also one move
-					int q = pVector3Index(applySubmoveP(pIndex3Array(p, solved), iter->second.state[setname].permutation, vector_size), vector_size);
-					// FIX
-					if (table[q] == -1){
-						table[q] = len + 1;
+	table[pVector3Index(solved.data(), vector_size, rank)] = 0; // Put solved position in table
+
+	for (int phase = ignore.empty() ? 1 : 0; phase < 2; phase++){
+		if (phase == 1 && !ignore.empty()){
+			int c = 0;
+			for (int i = 0; i < tablesize; i++){
+				if (table[i] != -1){
+					pIndex3Array(i, vector_size, rank, perm.data());
+					bool solved_pos = true;
+					for (int j = 0; j < vector_size; j++)
+						if (ignore[j] == 0 && perm[j] != solved[j])
+							solved_pos = false;
+					if (solved_pos){
+						table[i] = 0;
 						c++;
 					}
+					else
+						table[i] = -1;
 				}
-			}      
-		}
-		len++;
-		if (ignore.empty())
-			std::cout << c << " positions at depth " << len << "\n"; 
-	}while(c > 0);
-	
-	if (!ignore.empty()){
-		c = 0;
-		for (int i = 0; i < tablesize; i++){
-			if (table[i] != -1){
-				int* tmp_p = pIndex3Array(i, solved);
-				bool solved_pos = true;
-				for (int j = 0; j < vector_size; j++)
-					if (ignore[j] == 0 && tmp_p[j] != solved[j])
-						solved_pos = false;
-				if (solved_pos){
-					table[i] = 0;
-					c++;
-				}
-				else
-					table[i] = -1;
-				delete tmp_p;
 			}
+			messages() << c << " solved positions.\n";
 		}
-		std::cout << c << " solved positions.\n";
 
 		int len = 0;
 		int c;
@@ -537,10 +577,12 @@ static std::vector<char> buildCompletePermutationPruningTable3(std::vector<int>
 			c = 0;
 			for (int p = 0; p < tablesize; p++){
 				if (table[p] == len){
-					for (iter = moves.begin(); iter != moves.end(); iter++){
+					pIndex3Array(p, vector_size, rank, perm.data());
+					for (unsigned int m = 0; m < movePerms.size(); m++){
 						// FIX, assumes that inverses to all moves are also one move
-						int q = pVector3Index(applySubmoveP(pIndex3Array(p, solved), iter->second.state[setname].permutation, vector_size), vector_size);
-						// FIX
+						for (int i = 0; i < vector_size; i++)
+							moved[i] = perm[movePerms[m][i] - 1];
+						int q = pVector3Index(moved.data(), vector_size, rank);
 						if (table[q] == -1){
 							table[q] = len + 1;
 							c++;
@@ -549,16 +591,16 @@ static std::vector<char> buildCompletePermutationPruningTable3(std::vector<int>
 				}      
 			}
 			len++;
-			std::cout << c << " positions at depth " << len << "\n"; 
+			if (phase == 1)
+				messages() << c << " positions at depth " << len << "\n"; 
 		}while(c > 0);
-
 	}
 	return table;
 }
 
 static std::map<std::vector<long long>, char> buildPartialOrientationPruningTable(std::vector<int> solved, MoveList moves, int setname, int omod, std::vector<int> ignore)
 {
-	std::cout << "Building partial pruning table for " << setnameFromIndex(setname) << " orientation.\n";
+	messages() << "Building partial pruning table for " << setnameFromIndex(setname) << " orientation.\n";
 	std::map<std::vector<long long>, char> table;
 	std::map<std::vector<long long>, char> old_table;
 	std::map<std::vector<long long>, char>::iterator iter2, iter3;
@@ -595,11 +637,11 @@ static std::map<std::vector<long long>, char> buildPartialOrientationPruningTabl
 		if (!abort)
 			old_table = table;
 		len++;
-		std::cout << c << " positions at depth " << len << "\n"; 
+		messages() << c << " positions at depth " << len << "\n"; 
 			
 	}while(c > 0 && !abort);
 	if (abort){
-		std::cout << "Too many positions at depth " << len << ", removing.\n";
+		messages() << "Too many positions at depth " << len << ", removing.\n";
 		return old_table;
 	}
 	
@@ -609,7 +651,7 @@ static std::map<std::vector<long long>, char> buildPartialOrientationPruningTabl
 
 static std::map<std::vector<long long>, char> buildPartialPermutationPruningTable(std::vector<int> solved, MoveList moves, int setname, std::vector<int> ignore)
 {
-	std::cout << "Building partial pruning for " << setnameFromIndex(setname) << " permutation.\n";
+	messages() << "Building partial pruning for " << setnameFromIndex(setname) << " permutation.\n";
 	std::map<std::vector<long long>, char> table;
 	std::map<std::vector<long long>, char> old_table;
 
@@ -626,8 +668,8 @@ static std::map<std::vector<long long>, char> buildPartialPermutationPruningTabl
 			if (ignore[i] == 1)
 				repermutation.push_back(i);
 		if (repermutation.size() > 8){
-			std::cout << "Can't ignore permutation of more than 8 pieces in a big set.\n";
-			std::cout << "Set: " << setname << "\n";
+			std::cerr << "Can't ignore permutation of more than 8 pieces in a big set.\n";
+			std::cerr << "Set: " << setname << "\n";
 			exit(-1);
 		}
 		while(next_permutation(repermutation.begin(), repermutation.end())){
@@ -643,7 +685,7 @@ static std::map<std::vector<long long>, char> buildPartialPermutationPruningTabl
 			}
 			table[packVector(tmp_perm)] = 0;
 		}
-		std::cout << table.size() << " solved positions.\n";
+		messages() << table.size() << " solved positions.\n";
 	}
 
 	int len = 0;
@@ -674,17 +716,121 @@ static std::map<std::vector<long long>, char> buildPartialPermutationPruningTabl
 		if (!abort)
 			old_table = table;
 		len++;
-		std::cout << c << " positions at depth " << len << "\n";
+		messages() << c << " positions at depth " << len << "\n";
 	}while(c > 0 && !abort);
 	
 	if (abort){
-		std::cout << "Too many positions at depth " << len << ", removing.\n";
+		messages() << "Too many positions at depth " << len << ", removing.\n";
 		return old_table;
 	}
 
 	return table;
 }
 
+// Split the pieces of a big set into groups whose pattern tables fit in memory.
+// Pieces that sit at ignored positions when solved are left out.
+static std::vector<std::vector<int> > choosePatternSubsets(std::vector<int> solved, std::vector<int> ignore)
+{
+	std::vector<std::vector<int> > subsets;
+	int size = solved.size();
+	if (size > 64)
+		return subsets;
+	std::set<int> pieces(solved.begin(), solved.end());
+	for (int i = 0; i < size; i++)
+		if (!ignore.empty() && ignore[i] == 1)
+			pieces.erase(solved[i]);
+
+	std::vector<int> current;
+	std::set<int>::iterator iter;
+	for (iter = pieces.begin(); iter != pieces.end(); iter++){
+		std::vector<int> bigger = current;
+		bigger.push_back(*iter);
+		long long tablesize = makeMultisetRank(solved.data(), size, bigger).combinations;
+		if (tablesize != -1 && tablesize <= MAX_SUBSET_PERMUTATION_TABLE_SIZE){
+			current = bigger;
+			continue;
+		}
+		if (!current.empty())
+			subsets.push_back(current);
+		current.clear();
+		tablesize = makeMultisetRank(solved.data(), size, std::vector<int>(1, *iter)).combinations;
+		if (tablesize != -1 && tablesize <= MAX_SUBSET_PERMUTATION_TABLE_SIZE)
+			current.push_back(*iter);
+	}
+	if (!current.empty())
+		subsets.push_back(current);
+	return subsets;
+}
+
+// Leave the pieces that sit at ignored positions when solved out of the pattern
+// subsets given in the def file, as choosePatternSubsets does: a table that
+// tracks them counts moves the ignored pieces don't need, and would prune
+// away real solutions.
+static std::vector<std::vector<int> > maskPatternSubsets(std::vector<std::vector<int> > subsets, std::vector<int> solved, std::vector<int> ignore, int setname)
+{
+	std::set<int> ignored;
+	for (unsigned int i = 0; i < solved.size(); i++)
+		if (!ignore.empty() && ignore[i] == 1)
+			ignored.insert(solved[i]);
+	std::vector<std::vector<int> > masked;
+	for (unsigned int i = 0; i < subsets.size(); i++){
+		std::vector<int> pieces;
+		for (unsigned int j = 0; j < subsets[i].size(); j++)
+			if (ignored.find(subsets[i][j]) == ignored.end())
+				pieces.push_back(subsets[i][j]);
+		if (pieces.size() != subsets[i].size())
+			messages() << "Pattern subset " << i+1 << " of set " << setnameFromIndex(setname) << " has ignored pieces, leaving them out.\n";
+		if (!pieces.empty())
+			masked.push_back(pieces);
+	}
+	return masked;
+}
+
+// Complete table for the positions of a subset of the pieces
+static void buildSubsetPermutationPruningTable(subsetprune &subset, std::vector<int> solved, MoveList moves, int setname, int number)
+{
+	messages() << "Building pruning for " << setnameFromIndex(setname) << " permutation subset " << number+1 << " (pieces";
+	for (unsigned int i = 0; i < subset.rank.pieces.size(); i++)
+		messages() << " " << subset.rank.pieces[i];
+	messages() << ").\n";
+	int vector_size = solved.size();
+	long long tablesize = subset.rank.combinations;
+	std::vector<char> &table = subset.table;
+	table.assign(tablesize, -1);
+	messages() << "tablesize " << tablesize << "\n";
+
+	std::vector<int*> movePerms;
+	MoveList::iterator iter;
+	for (iter = moves.begin(); iter != moves.end(); iter++)
+		movePerms.push_back(iter->second.state[setname].permutation);
+	std::vector<int> pattern(vector_size), moved(vector_size);
+
+	table[pVector3Index(solved.data(), vector_size, subset.rank)] = 0; // Put solved position in table
+
+	int len = 0;
+	long long c;
+	do
+	{
+		c = 0;
+		for (long long p = 0; p < tablesize; p++){
+			if (table[p] == len){
+				pIndex3Array(p, vector_size, subset.rank, pattern.data());
+				for (unsigned int m = 0; m < movePerms.size(); m++){
+					for (int i = 0; i < vector_size; i++)
+						moved[i] = pattern[movePerms[m][i] - 1];
+					long long q = pVector3Index(moved.data(), vector_size, subset.rank);
+					if (table[q] == -1){
+						table[q] = len + 1;
+						c++;
+					}
+				}
+			}
+		}
+		len++;
+		messages() << c << " positions at depth " << len << "\n";
+	}while(c > 0);
+}
+
 static int maxDepth(std::map<std::vector<long long>, char> table){
 	int maxdepth = 0;
 	std::map<std::vector<long long>, char>::iterator iter;
@@ -705,6 +851,7 @@ static void updateDatasets(PieceTypes& datasets, PruneTable& tables)
 			datasets[iter->first].ptabletype = TABLE_TYPE_PARTIAL;
 		else
 			datasets[iter->first].ptabletype = TABLE_TYPE_NONE;
+		datasets[iter->first].subsettables = iter->second.subsets.size();
 
 		double tablesize = 1.0;
 		for (int i = 0; i < datasets[iter->first].size; i++)
@@ -719,14 +866,181 @@ static void updateDatasets(PieceTypes& datasets, PruneTable& tables)
 	}
 }
 
-static bool prune(Position& state, int depth, PieceTypes& datasets, PruneTable& prunetables){
+// Lay out the moves of every set with a complete orientation table, so that
+// the orientations of all children of a position can be ranked at once
+static void buildChildMoves(PruneTable& tables, MoveList& moves, PieceTypes& datasets)
+{
+	int nmoves = moves.empty() ? 0 : moves.rbegin()->first + 1; // move IDs are 0, 1, 2, ...
+	PruneTable::iterator iter;
+	for (iter = tables.begin(); iter != tables.end(); iter++){
+		int setname = iter->first;
+		int size = datasets[setname].size;
+		int omod = datasets[setname].omod;
+		childMoves &children = iter->second.children;
+		children.nmoves = 0;
+		if (datasets[setname].otabletype != TABLE_TYPE_COMPLETE || omod <= 1)
+			continue;
+		children.nmoves = nmoves;
+		children.size = size;
+		children.omod = omod;
+		children.from.resize(nmoves*size);
+		children.twist.assign(nmoves*size, 0);
+		for (int m = 0; m < nmoves; m++)
+			for (int i = 0; i < size; i++)
+				children.from[m*size + i] = i;
+		MoveList::iterator moveIter;
+		for (moveIter = moves.begin(); moveIter != moves.end(); moveIter++){
+			substate &move = moveIter->second.state[setname];
+			for (int i = 0; i < size; i++){
+				int from = move.permutation[i] - 1;
+				children.from[moveIter->first*size + i] = from;
+				children.twist[moveIter->first*size + i] = move.orientation[from];
+			}
+		}
+		children.weight.resize(size);
+		for (int i = size - 1, w = 1; i >= 0; i--, w *= omod)
+			children.weight[i] = w;
+	}
+}
+
+// Lay out the piece masks that the multiset-ranked tables of each set are
+// looked up from, and note which positions of those sets each move touches.
+static void buildPieceMasks(PruneTable& tables, MoveList& moves, PieceTypes& datasets)
+{
+	int offset = 0;
+	PruneTable::iterator iter;
+	for (iter = tables.begin(); iter != tables.end(); iter++){
+		int setname = iter->first;
+		subprune &sub = iter->second;
+		sub.maskOffset = -1;
+		sub.maskPieces = 0;
+		if (datasets[setname].size > 64)
+			continue;
+		if (datasets[setname].ptabletype == TABLE_TYPE_COMPLETE && !datasets[setname].uniqueperm)
+			sub.maskPieces = datasets[setname].prank.classOf.size();
+		for (unsigned int i = 0; i < sub.subsets.size(); i++)
+			if ((int)sub.subsets[i].rank.classOf.size() > sub.maskPieces)
+				sub.maskPieces = sub.subsets[i].rank.classOf.size();
+		if (sub.maskPieces == 0)
+			continue;
+		sub.maskOffset = offset;
+		offset += sub.maskPieces;
+	}
+
+	MoveList::iterator moveIter;
+	for (moveIter = moves.begin(); moveIter != moves.end(); moveIter++){
+		Position &move = moveIter->second.state;
+		moveIter->second.touched.assign(move.size(), std::vector<int>());
+		for (iter = tables.begin(); iter != tables.end(); iter++){
+			if (iter->second.maskOffset < 0)
+				continue;
+			substate &sub = move[iter->first];
+			for (int i = 0; i < sub.size; i++)
+				if (sub.permutation[i] != i + 1)
+					moveIter->second.touched[iter->first].push_back(i);
+		}
+	}
+}
+
+// word of a set's masks that holds piece
+static inline int maskSlot(int piece, int maskPieces)
+{
+	return (piece > 0 && piece < maskPieces) ? piece : 0;
+}
+
+// Ranks of a position computed from scratch, for the root of a search
+static void rankPosition(Position& state, PruneTable& prunetables, positionRanks& ranks)
+{
+	ranks.orientation.assign(state.size(), -1);
+	ranks.where.clear();
+	PruneTable::iterator iter;
+	for (iter = prunetables.begin(); iter != prunetables.end(); iter++){
+		subprune &sub = iter->second;
+		if (sub.maskOffset < 0)
+			continue;
+		if ((int)ranks.where.size() < sub.maskOffset + sub.maskPieces)
+			ranks.where.resize(sub.maskOffset + sub.maskPieces, 0);
+		substate &set = state[iter->first];
+		for (int i = 0; i < set.size; i++)
+			ranks.where[sub.maskOffset + maskSlot(set.permutation[i], sub.maskPieces)] |= 1ULL << i;
+	}
+}
+
+// Ranks of a child, from those of its parent: the piece masks only change at
+// the positions the move touches, and the orientation ranks of all children
+// were already computed by boundChildren.
+static void rankChild(Position& parent, positionRanks& parentRanks, Position& child, fullmove& move,
+		std::vector<int>& childOrientations, PruneTable& prunetables, positionRanks& ranks)
+{
+	ranks.orientation.assign(child.size(), -1);
+	ranks.where = parentRanks.where;
+	PruneTable::iterator iter;
+	for (iter = prunetables.begin(); iter != prunetables.end(); iter++){
+		int setname = iter->first;
+		subprune &sub = iter->second;
+		if (sub.children.nmoves > 0 && !childOrientations.empty())
+			ranks.orientation[setname] = childOrientations[setname*sub.children.nmoves + move.id];
+		if (sub.maskOffset < 0)
+			continue;
+		unsigned long long *where = &ranks.where[sub.maskOffset];
+		const std::vector<int> &touched = move.touched[setname];
+		int *before = parent[setname].permutation;
+		int *after = child[setname].permutation;
+		for (unsigned int t = 0; t < touched.size(); t++)
+			where[maskSlot(before[touched[t]], sub.maskPieces)] &= ~(1ULL << touched[t]);
+		for (unsigned int t = 0; t < touched.size(); t++)
+			where[maskSlot(after[touched[t]], sub.maskPieces)] |= 1ULL << touched[t];
+	}
+}
+
+// Lower bounds on the depth of all children of a position from the complete
+// orientation tables, ranking the children of each set at once. bounds is
+// indexed by move ID, and left empty if no set has such a table; the ranks
+// themselves are kept in ranks[set*nmoves + move ID] for rankChild.
+static void boundChildren(Position& state, PruneTable& prunetables, std::vector<int>& bounds, std::vector<int>& ranks)
+{
+	const simdKernels &k = kernels();
+	bounds.clear();
+	ranks.clear();
+	PruneTable::iterator iter;
+	for (iter = prunetables.begin(); iter != prunetables.end(); iter++){
+		childMoves &children = iter->second.children;
+		if (children.nmoves == 0)
+			continue;
+		int nmoves = children.nmoves;
+		if (bounds.empty()){
+			bounds.assign(nmoves, 0);
+			ranks.resize(state.size()*nmoves);
+		}
+		int *setRanks = &ranks[iter->first*nmoves];
+		k.rankChildOrientations(state[iter->first].orientation, children, setRanks);
+		std::vector<char> &table = iter->second.orientation;
+		for (int m = 0; m < nmoves; m++)
+			if (table[setRanks[m]] > bounds[m])
+				bounds[m] = table[setRanks[m]];
+	}
+}
+
+// Which table cut a position off, as 2*set + one of these, for the search statistics
+static const int CUT_BY_ORIENTATION = 0;
+static const int CUT_BY_PERMUTATION = 1;
+
+static bool cutOff(int *cutBy, int set, int table){
+	if (cutBy != NULL)
+		*cutBy = 2*set + table;
+	return true;
+}
+
+static bool prune(Position& state, positionRanks& ranks, int depth, PieceTypes& datasets, PruneTable& prunetables, int *cutBy = NULL){
 	for (int iter2=0; iter2<state.size(); iter2++) {
 
 		// Orientation pruning
 		if (datasets[iter2].otabletype == TABLE_TYPE_COMPLETE){
-			int index = oVector2Index(state[iter2].orientation, state[iter2].size, datasets[iter2].omod);
+			long long index = ranks.orientation[iter2];
+			if (index < 0)
+				index = oVector2Index(state[iter2].orientation, state[iter2].size, datasets[iter2].omod);
 			if (prunetables[iter2].orientation[index]  > depth){
-				return true;
+				return cutOff(cutBy, iter2, CUT_BY_ORIENTATION);
 			}
 		}
 		else if (datasets[iter2].otabletype == TABLE_TYPE_PARTIAL){
@@ -735,11 +1049,11 @@ static bool prune(Position& state, int depth, PieceTypes& datasets, PruneTable&
 			if (prunetables[iter2].partialorientation_depth >= depth){
 				if (prunetables[iter2].partialorientation.count(index) == 1){ // If the position exist in the table then...
 					if (prunetables[iter2].partialorientation[index] > depth){
-						return true;
+						return cutOff(cutBy, iter2, CUT_BY_ORIENTATION);
 					}                         
 				}
 				else{
-					return true;
+					return cutOff(cutBy, iter2, CUT_BY_ORIENTATION);
 				}
 			}
 		}
@@ -747,13 +1061,16 @@ static bool prune(Position& state, int depth, PieceTypes& datasets, PruneTable&
 		if (datasets[iter2].ptabletype == TABLE_TYPE_COMPLETE && datasets[iter2].uniqueperm){
 			int index = pVector2Index(state[iter2].permutation, state[iter2].size);
 			if (prunetables[iter2].permutation[index]  > depth){
-				return true;
+				return cutOff(cutBy, iter2, CUT_BY_PERMUTATION);
 			}
 		}
 		else if (datasets[iter2].ptabletype == TABLE_TYPE_COMPLETE && !datasets[iter2].uniqueperm){
-			long long index = pVector3Index(state[iter2].permutation, state[iter2].size);
-			if (prunetables[iter2].permutation[index]  > depth){
-				return true;
+			subprune &sub = prunetables[iter2];
+			long long index = sub.maskOffset >= 0
+				? pMasks3Index(&ranks.where[sub.maskOffset], sub.maskPieces, state[iter2].size, datasets[iter2].prank)
+				: pVector3Index(state[iter2].permutation, state[iter2].size, datasets[iter2].prank);
+			if (index >= 0 && sub.permutation[index]  > depth){
+				return cutOff(cutBy, iter2, CUT_BY_PERMUTATION);
 			}
 		}
 		else if (datasets[iter2].ptabletype == TABLE_TYPE_PARTIAL){;
@@ -762,11 +1079,23 @@ static bool prune(Position& state, int depth, PieceTypes& datasets, PruneTable&
 			if (prunetables[iter2].partialpermutation_depth >= depth){
 				if (prunetables[iter2].partialpermutation.find(index) != prunetables[iter2].partialpermutation.end()){
 					if (prunetables[iter2].partialpermutation[index] > depth){
-						return true;
+						return cutOff(cutBy, iter2, CUT_BY_PERMUTATION);
 					}
 				}
 				else{
-					return true;
+					return cutOff(cutBy, iter2, CUT_BY_PERMUTATION);
+				}
+			}
+		}
+		if (datasets[iter2].subsettables > 0){
+			subprune &sub = prunetables[iter2];
+			std::vector<subsetprune> &subsets = sub.subsets;
+			for (unsigned int i = 0; i < subsets.size(); i++){
+				long long index = sub.maskOffset >= 0
+					? pMasks3Index(&ranks.where[sub.maskOffset], sub.maskPieces, state[iter2].size, subsets[i].rank)
+					: pVector3Index(state[iter2].permutation, state[iter2].size, subsets[i].rank);
+				if (index >= 0 && subsets[i].table[index] > depth){
+					return cutOff(cutBy, iter2, CUT_BY_PERMUTATION);
 				}
 			}
 		}
@@ -0,0 +1,197 @@
+/*
+ KSolve+ - Puzzle solving program.
+ Copyright (C) 2007-2013 Kre Krig and Michael Gottlieb
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+// God's Algorithm tables of a puzzle as its Ignore command sees it, where
+// positions that differ only in what may be ignored are one position.
+
+#ifndef QUOTIENT_H
+#define QUOTIENT_H
+
+// Is anything ignored?
+static bool ignoresAnything(Position& ignore) {
+	for (int iter = 0; iter < ignore.size(); iter++)
+		for (int i = 0; i < ignore[iter].size; i++)
+			if (ignore[iter].permutation[i] != 0 || ignore[iter].orientation[i] != 0)
+				return true;
+	return false;
+}
+
+// Do two Ignore commands ignore the same things? Sets left out ignore nothing.
+static bool sameIgnore(Position& ignore1, Position& ignore2, PieceTypes& datasets) {
+	PieceTypes::iterator iter;
+	for (iter = datasets.begin(); iter != datasets.end(); iter++) {
+		int set = iter->first;
+		bool has1 = set < ignore1.size() && ignore1[set].size > 0;
+		bool has2 = set < ignore2.size() && ignore2[set].size > 0;
+		for (int i = 0; i < iter->second.size; i++) {
+			if ((has1 && ignore1[set].permutation[i] != 0) != (has2 && ignore2[set].permutation[i] != 0))
+				return false;
+			if ((has1 && ignore1[set].orientation[i] != 0) != (has2 && ignore2[set].orientation[i] != 0))
+				return false;
+		}
+	}
+	return true;
+}
+
+// The puzzle with what the Ignore command allows left out. The pieces solved
+// where the permutation is ignored get one number, so they can no longer be
+// told apart, and pieces whose orientation is only ever checked where it is
+// ignored lose it (the whole set's orientation, if that holds for all of
+// them). relabel gives each old piece number its new one. False (saying
+// why, if explain is set) if the Ignore command cannot be written this way.
+static bool quotientPuzzle(Position& solved, PieceTypes& datasets, Position& ignore, std::vector<Block>& blocks,
+		Position& quotient, PieceTypes& quotientSets, std::vector<std::vector<int> >& relabel, bool explain) {
+	if (blocks.size() != 0) {
+		if (explain)
+			std::cerr << "Ignored pieces cannot be left out of God's Algorithm tables for puzzles with Blocks.\n";
+		return false;
+	}
+	quotientSets = datasets;
+	quotient.resize(solved.size());
+	relabel.resize(solved.size());
+	std::vector<int> merged; // sets with pieces that can no longer be told apart
+	for (int iter = 0; iter < solved.size(); iter++) {
+		int size = solved[iter].size;
+		int *perm = solved[iter].permutation;
+		dataset &ds = quotientSets[iter];
+		bool ignored = iter < ignore.size() && ignore[iter].size > 0;
+		quotient[iter] = newSubstate(size);
+		std::copy(solved[iter].orientation, solved[iter].orientation + size, quotient[iter].orientation);
+
+		// number the pieces again, with all the ignored ones the same
+		int maxLabel = 0;
+		for (int i = 0; i < size; i++)
+			maxLabel = std::max(maxLabel, perm[i]);
+		std::vector<char> present(maxLabel + 1, 0), wild(maxLabel + 1, 0);
+		for (int i = 0; i < size; i++) {
+			present[perm[i]] = 1;
+			if (ignored && ignore[iter].permutation[i] != 0)
+				wild[perm[i]] = 1;
+		}
+		for (int i = 0; i < size; i++)
+			if (wild[perm[i]] && !(ignored && ignore[iter].permutation[i] != 0)) {
+				if (explain)
+					std::cerr << "The pieces of " << setnameFromIndex(iter) << " that look alike must all be ignored, or none of them.\n";
+				return false;
+			}
+		relabel[iter].assign(maxLabel + 1, 0);
+		int labels = 0, wildLabel = 0;
+		for (int l = 1; l <= maxLabel; l++) {
+			if (!present[l])
+				continue;
+			if (!wild[l])
+				relabel[iter][l] = ++labels;
+			else if (wildLabel == 0)
+				relabel[iter][l] = wildLabel = ++labels;
+			else
+				relabel[iter][l] = wildLabel;
+		}
+		for (int i = 0; i < size; i++)
+			quotient[iter].permutation[i] = relabel[iter][perm[i]];
+		if (ds.uniqueperm && !uniquePermutation(quotient[iter].permutation, size)) {
+			ds.uniqueperm = false;
+			ds.pparity = false;
+			ds.parityWith.clear();
+			merged.push_back(iter);
+		}
+		if (!ds.uniqueperm) {
+			ds.maxInSolved = labels;
+			ds.permbits = 0;
+			while ((1 << ds.permbits) < labels)
+				ds.permbits++;
+			ds.prank = makeMultisetRank(quotient[iter].permutation, size);
+		}
+
+		// orientations that never matter, by the new piece numbers
+		if (ds.omod == 1 || !ignored)
+			continue;
+		std::vector<int> homes(labels + 1, 0), freeHomes(labels + 1, 0);
+		for (int i = 0; i < size; i++) {
+			homes[quotient[iter].permutation[i]]++;
+			if (ignore[iter].orientation[i] != 0)
+				freeHomes[quotient[iter].permutation[i]]++;
+		}
+		bool anyFree = false, allFree = true;
+		for (int l = 1; l <= labels; l++) {
+			if (freeHomes[l] != 0 && freeHomes[l] != homes[l]) {
+				if (explain)
+					std::cerr << "The orientation of " << setnameFromIndex(iter) << " must be ignored for all pieces that look alike, or none of them.\n";
+				return false;
+			}
+			if (freeHomes[l] != 0)
+				anyFree = true;
+			else
+				allFree = false;
+		}
+		if (allFree) {
+			ds.omod = 1;
+			ds.oribits = 0;
+			ds.oparity = false;
+		} else if (anyFree) {
+			ds.freeOrientation.assign(size + 1, 0);
+			for (int l = 1; l <= labels; l++)
+				ds.freeOrientation[l] = freeHomes[l] != 0;
+			ds.oparity = false;
+		}
+		for (int i = 0; i < size; i++)
+			if (ds.omod == 1 || (anyFree && ds.freeOrientation[quotient[iter].permutation[i]]))
+				quotient[iter].orientation[i] = 0;
+	}
+
+	// a set whose parity followed from one of those now has its own
+	PieceTypes::iterator iter;
+	for (iter = quotientSets.begin(); iter != quotientSets.end(); iter++)
+		for (unsigned int m = 0; m < merged.size(); m++)
+			if (std::find(iter->second.parityWith.begin(), iter->second.parityWith.end(), merged[m]) != iter->second.parityWith.end())
+				iter->second.parityWith.clear();
+	return true;
+}
+
+// A position as the puzzle of quotientPuzzle sees it. Pieces that are not
+// known get the number 0.
+static Position quotientPosition(Position& position, PieceTypes& quotientSets, std::vector<std::vector<int> >& relabel) {
+	Position result(position.size());
+	for (int iter = 0; iter < position.size(); iter++) {
+		int size = position[iter].size;
+		dataset &ds = quotientSets[iter];
+		result[iter] = newSubstate(size);
+		for (int i = 0; i < size; i++) {
+			int piece = position[iter].permutation[i];
+			result[iter].permutation[i] = piece > 0 && piece < (int)relabel[iter].size() ? relabel[iter][piece] : 0;
+			bool free = ds.omod == 1 || (!ds.freeOrientation.empty() && ds.freeOrientation[result[iter].permutation[i]]);
+			result[iter].orientation[i] = free ? 0 : position[iter].orientation[i];
+		}
+	}
+	return result;
+}
+
+// The orientations of a set as they are indexed: those of pieces whose
+// orientation is ignored count as 0
+static int *keptOrientation(substate& sub, dataset& ds, std::vector<int>& buffer) {
+	if (ds.freeOrientation.empty())
+		return sub.orientation;
+	buffer.assign(sub.orientation, sub.orientation + sub.size);
+	for (int i = 0; i < sub.size; i++)
+		if (sub.permutation[i] > 0 && sub.permutation[i] < (int)ds.freeOrientation.size() && ds.freeOrientation[sub.permutation[i]])
+			buffer[i] = 0;
+	return &buffer[0];
+}
+
+#endif
@@ -0,0 +1,207 @@
+/*
+ KSolve+ - Puzzle solving program.
+ Copyright (C) 2007-2013 Kre Krig and Michael Gottlieb
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+// Random positions, for RandomScramble and !sample
+
+#ifndef RANDOM_H
+#define RANDOM_H
+
+// The generator for stream n of a run; the same seed (--seed) and n
+// always give the same numbers, whatever the platform or thread.
+static randomSource randomStream(unsigned long long seed, unsigned long long n)
+{
+	std::seed_seq seq{(unsigned int)seed, (unsigned int)(seed >> 32), (unsigned int)n, (unsigned int)(n >> 32)};
+	return randomSource(seq);
+}
+
+// A number from 0 to n-1, all equally likely
+static long long randomBelow(randomSource& rng, long long n)
+{
+	unsigned long long bound = n;
+	unsigned long long threshold = (0 - bound) % bound; // 2^64 mod n; drop that many values to stay unbiased
+	for (;;) {
+		unsigned long long r = rng();
+		if (r >= threshold)
+			return r % bound;
+	}
+}
+
+// Apply a bunch of random moves to state, using new_state as scratch space
+static void randomWalk(Position& state, Position& new_state, MoveList& moves, PieceTypes& datasets, std::vector<Block>& blocks, randomSource& rng)
+{
+	int RANDOM_MOVES = 10000 + randomBelow(rng, 2);
+	int nMoves = moves.size();
+	for (int i=0; i<RANDOM_MOVES; i++) {
+		// get random move
+		MoveList::iterator iter2 = moves.begin();
+		std::advance(iter2, randomBelow(rng, nMoves));
+
+		if (blocks.size() != 0) {
+			if (!blockLegal(state, blocks, iter2->second.state)) {
+				i--;
+				continue;
+			}
+		}
+
+		applyMove(state, new_state, iter2->second.state, datasets);
+		state.swap(new_state); // rather than copying new_state back
+	}
+}
+
+// Can uniform random positions be made set by set, drawing each set's
+// coordinates on their own? Only if the moves reach every position that
+// the orientation sums and permutation parities found in readdef.h allow,
+// which is the case if the group of the moves is exactly that big.
+// Parity constraints involving a set with identical pieces don't matter,
+// as swapping two of those gives the other parity.
+static bool coordinatesReachable(Position& solved, MoveList& moves, PieceTypes& datasets, std::vector<Block>& blocks)
+{
+	if (blocks.size() != 0)
+		return false;
+	double logIndex = 0;
+	std::vector<int> sets, unique; // sets whose parity counts, and those of unique pieces among them
+	int enforced = 0; // parity constraints a random position is made to meet
+	PieceTypes::iterator iter;
+	for (iter = datasets.begin(); iter != datasets.end(); iter++) {
+		dataset &set = iter->second;
+		logIndex += (set.oparity ? set.size - 1 : set.size) * log((double)set.omod) + lgamma(set.size + 1.0);
+		if (set.size < 2)
+			continue;
+		sets.push_back(iter->first);
+		if (set.uniqueperm) {
+			unique.push_back(iter->first);
+			if (set.pparity || set.parityWith.size() != 0)
+				enforced++;
+		} else {
+			std::vector<int> pieces(solved[iter->first].permutation, solved[iter->first].permutation + set.size);
+			std::sort(pieces.begin(), pieces.end());
+			if (std::adjacent_find(pieces.begin(), pieces.end()) == pieces.end())
+				return false; // no two pieces alike after all
+		}
+	}
+	// the constraints between parities are the sets less the rank of their parities under the moves
+	int constraints[2];
+	for (int pass = 0; pass < 2; pass++) {
+		std::vector<int> &columns = (pass == 0) ? sets : unique;
+		std::vector<std::vector<char> > basis;
+		std::vector<int> pivots;
+		for (unsigned int s = 0; s < columns.size(); s++) {
+			std::vector<char> column;
+			MoveList::iterator moveIter;
+			for (moveIter = moves.begin(); moveIter != moves.end(); moveIter++) {
+				substate &move = moveIter->second.state[columns[s]];
+				column.push_back(permutationParity(move.permutation, move.size));
+			}
+			for (unsigned int b = 0; b < basis.size(); b++)
+				if (column[pivots[b]])
+					for (unsigned int m = 0; m < column.size(); m++)
+						column[m] ^= basis[b][m];
+			int pivot = std::find(column.begin(), column.end(), 1) - column.begin();
+			if (pivot != (int)column.size()) {
+				basis.push_back(column);
+				pivots.push_back(pivot);
+			}
+		}
+		constraints[pass] = columns.size() - basis.size();
+	}
+	if (constraints[1] != enforced)
+		return false;
+	logIndex -= constraints[0] * log(2.0);
+
+	string order = moveGroup(moves, datasets).order();
+	double logOrder = log(atof(order.substr(0, 15).c_str()));
+	if (order.size() > 15)
+		logOrder += (order.size() - 15) * log(10.0);
+	return fabs(logOrder - logIndex) < 1e-6;
+}
+
+// A position of all those the moves reach, all equally likely. If
+// byCoordinates (see coordinatesReachable), each set's orientation and
+// permutation are drawn as a random index and unranked, then made to meet
+// the parity constraints; otherwise random moves are applied to solved.
+static void randomPosition(Position& state, Position& new_state, Position& solved, MoveList& moves, PieceTypes& datasets, std::vector<Block>& blocks, bool byCoordinates, randomSource& rng)
+{
+	for (int iter = 0; iter < solved.size(); iter++)
+		for (int i = 0; i < solved[iter].size; i++) {
+			state[iter].permutation[i] = solved[iter].permutation[i];
+			state[iter].orientation[i] = solved[iter].orientation[i];
+		}
+	if (!byCoordinates) {
+		randomWalk(state, new_state, moves, datasets, blocks, rng);
+		return;
+	}
+
+	for (int iter = 0; iter < solved.size(); iter++) {
+		dataset &set = datasets[iter];
+		substate &sub = state[iter];
+		int size = sub.size;
+		if (size == 0)
+			continue;
+
+		// orientation, with the last one fixed by the others if their sum is
+		int digits = set.oparity ? size - 1 : size;
+		if (set.omod > 1 && digits * log((double)set.omod) < 62 * log(2.0)) {
+			long long range = 1;
+			for (int i = 0; i < digits; i++)
+				range *= set.omod;
+			if (set.oparity)
+				oparIndex2Array(randomBelow(rng, range), size, set.omod, sub.orientation);
+			else
+				oIndex2Array(randomBelow(rng, range), size, set.omod, sub.orientation);
+		} else if (set.omod > 1) {
+			int sum = 0;
+			for (int i = 0; i < digits; i++) {
+				sub.orientation[i] = randomBelow(rng, set.omod);
+				sum += sub.orientation[i];
+			}
+			if (set.oparity)
+				sub.orientation[size - 1] = (set.omod - sum % set.omod) % set.omod;
+		}
+		if (set.oparity) {
+			int solvedSum = 0;
+			for (int i = 0; i < size; i++)
+				solvedSum += solved[iter].orientation[i];
+			sub.orientation[size - 1] = (sub.orientation[size - 1] + solvedSum) % set.omod;
+		}
+
+		// permutation, by index where it fits in one, or else shuffled
+		long long range = set.uniqueperm ? factorial(size) : combinations(solved[iter].permutation, size);
+		if (range > 0 && set.uniqueperm)
+			pIndex2Array(randomBelow(rng, range), size, sub.permutation);
+		else if (range > 0)
+			pIndex3Array(randomBelow(rng, range), size, set.prank, sub.permutation);
+		else
+			for (int i = size - 1; i > 0; i--)
+				std::swap(sub.permutation[i], sub.permutation[randomBelow(rng, i + 1)]);
+	}
+
+	// unique pieces get the permutation parity their set must have, by
+	// swapping the last two if needed, which is one to one on each parity
+	for (int iter = 0; iter < solved.size(); iter++) {
+		dataset &set = datasets[iter];
+		substate &sub = state[iter];
+		if (!set.uniqueperm || sub.size < 2 || (!set.pparity && set.parityWith.size() == 0))
+			continue;
+		int parity = set.pparity ? permutationParity(solved[iter].permutation, sub.size) : linkedParity(state, solved, datasets, iter);
+		if (permutationParity(sub.permutation, sub.size) != parity)
+			std::swap(sub.permutation[sub.size - 2], sub.permutation[sub.size - 1]);
+	}
+}
+
+#endif
@@ -24,7 +24,7 @@
 
 class Rules {
 public:
-	Rules(std::istream &fin){
+	Rules(std::istream &fin, int verbose){
 		moveid = 0;
 			
 		while(!fin.eof()){
@@ -41,25 +41,22 @@ public:
 					fin >> setname;
 					int setindex = setnameIndex(setname) ;
 					if (datasets.find(setindex) != datasets.end()) {
-						std::cerr << "Set " << setname << " declared more than once.\n";
-						exit(-1);
+						fail("Set " + setname + " declared more than once.");
 					}
 					if (moves.size() > 0 || solved.size() > 0 || ignore.size() > 0) {
-						std::cerr << "You must define all sets first!\n";
-						exit(-1);
+						fail("You must define all sets first!");
 					}
 					fin >> datasets[setindex].size;
 					if (fin.fail() || datasets[setindex].size < 1){
-						std::cerr << "Set " << setname << " does not have positive size.\n";
-						exit(-1);
+						fail("Set " + setname + " does not have positive size.");
 					}
 					fin >> datasets[setindex].omod;
 					if (fin.fail() || datasets[setindex].omod < 0){
-						std::cerr << "Pieces in " << setname << " does not have a positive (or zero) number of possible orientations.\n";
-						exit(-1);
+						fail("Pieces in " + setname + " does not have a positive (or zero) number of possible orientations.");
 					}
 					datasets[setindex].ptabletype = TABLE_TYPE_NONE;
 					datasets[setindex].otabletype = TABLE_TYPE_NONE;
+					datasets[setindex].subsettables = 0;
 					datasets[setindex].oparity = true; // adjust later if necessary
 					datasets[setindex].pparity = true; // adjust later if necessary
 				}
@@ -67,8 +64,7 @@ public:
 					string movename, setname;
 					fin >> movename;
 					if (moveIn(movename, moves)) {
-						std::cerr << "Move " << movename << " declared more than once.\n";
-						exit(-1);
+						fail("Move " + movename + " declared more than once.");
 					}
 					
 					fullmove newMove;
@@ -78,6 +74,12 @@ public:
 					newMove.parentID = moveid;
 					newMove.qtm = 1;
 					newMove.state = readPosition(fin, true, false, "move "+movename);
+					for (int iter=0; iter<newMove.state.size(); iter++) { // orientations in 0..omod-1, as the move kernels expect
+						int omod = datasets[iter].omod;
+						if (omod > 1)
+							for (int i=0; i<newMove.state[iter].size; i++)
+								newMove.state[iter].orientation[i] = ((newMove.state[iter].orientation[i] % omod) + omod) % omod;
+					}
 					parentMoves.push_back(moveid);
 					moves[moveid] = newMove;
 					moveid++;
@@ -93,22 +95,18 @@ public:
 					fin >> movename1;
 					while(movename1 != "End") {
 						if (fin.fail()){
-							std::cerr << "Error reading forbidden pairs.\n";
-							exit(-1);
+							fail("Error reading forbidden pairs.");
 						}
 						if (moveIn(movename1, moves)){
-							std::cerr << "Move " << movename1 << " used in forbidden pairs is not previously declared.\n";
-							exit(-1);
+							fail("Move " + movename1 + " used in forbidden pairs is not previously declared.");
 						}
 						
 						fin >> movename2;
 						if (fin.fail()){
-							std::cerr << "Error reading forbidden pairs.\n";
-							exit(-1);
+							fail("Error reading forbidden pairs.");
 						}
 						if (moveIn(movename2, moves)){
-							std::cerr << "Move " << movename2 << " used in forbidden pairs is not previously declared.\n";
-							exit(-1);
+							fail("Move " + movename2 + " used in forbidden pairs is not previously declared.");
 						}
 						
 						forbidden.insert(MovePair(getMoveID(movename1, moves), 
@@ -117,7 +115,7 @@ public:
 					}
 				}
 				else if (command == "ParallelMoves"){
-					std::cout << "ParallelMoves command is deprecated!\n";
+					messages() << "ParallelMoves command is deprecated!\n";
 					string newmove;
 					fin >> newmove;
 					while(newmove != "End") {
@@ -133,8 +131,7 @@ public:
 					input >> move1;
 					while(move1 != "End"){
 						if (!moveIn(move1, moves)){
-							std::cerr << "Move " << move1 << " used in ForbiddeGroups is not previously declared.\n";
-							exit(-1);
+							fail("Move " + move1 + " used in ForbiddeGroups is not previously declared.");
 						}
 							 
 						group.clear();
@@ -143,8 +140,7 @@ public:
 							input >> move1;
 							if (!input.fail()){
 								if (!moveIn(move1, moves)){
-									std::cerr << "Move " << move1 << " used in ForbiddenGroups is not previously declared.\n";
-									exit(-1);
+									fail("Move " + move1 + " used in ForbiddenGroups is not previously declared.");
 								}
 								group.push_back(getMoveID(move1, moves));
 							}
@@ -163,7 +159,7 @@ public:
 					}
 				}
 				else if (command == "Multiplicators"){
-					std::cout << "Multiplicators command is deprecated!\n";
+					messages() << "Multiplicators command is deprecated!\n";
 					string newmove;
 					fin >> newmove;
 					while(newmove != "End") {
@@ -181,8 +177,7 @@ public:
 					        int setindex = setnameIndex(setname) ;
 						std::set<int> tmp;
 						if (datasets.find(setindex) == datasets.end()) {
-							std::cerr << "Set " << setname << " used in Block is not previously declared.\n";
-							exit(-1);
+							fail("Set " + setname + " used in Block is not previously declared.");
 						}
 						getline(fin, line); // To get past the linefeed
 						getline(fin, line);
@@ -191,8 +186,7 @@ public:
 						while(!input.eof()){
 							input >> piece;
 							if (piece > datasets[setindex].size || piece <= 0) {
-								std::cerr << "Piece " << piece << " in Block, should not be in set " << setname << "\n";
-								exit(-1);
+								fail("Piece " + std::to_string(piece) + " in Block, should not be in set " + setname);
 							}
 							if (!input.fail()){
 								tmp.insert(piece);
@@ -203,8 +197,41 @@ public:
 					}
 					blocks.push_back(tmp_block);
 				}
+				else if (command == "PatternSubsets"){
+					string line, setname;
+					getline(fin, line);
+					getline(fin, line);
+					std::istringstream input(line);
+					input >> setname;
+					while(setname != "End"){
+						int setindex = setnameIndex(setname) ;
+						if (input.fail() || datasets.find(setindex) == datasets.end()) {
+							fail("Set " + setname + " used in PatternSubsets is not previously declared.");
+						}
+						std::vector<int> pieces;
+						int piece;
+						while(input >> piece){
+							if (piece <= 0) {
+								fail("Piece " + std::to_string(piece) + " in PatternSubsets should be positive.");
+							}
+							pieces.push_back(piece);
+						}
+						if (pieces.empty()) {
+							fail("Pattern subset for set " + setname + " has no pieces.");
+						}
+						patternSubsets[setindex].push_back(pieces);
+
+						if (!getline(fin, line)) {
+							fail("Error reading pattern subsets.");
+						}
+						input.str(line);
+						input.clear();
+						setname = "";
+						input >> setname;
+					}
+				}
 				else if (command == "MoveLimits"){
-					std::cout << "MoveLimits command has been moved to scramble file!\n";
+					messages() << "MoveLimits command has been moved to scramble file!\n";
 					string newmove;
 					fin >> newmove;
 					while(newmove != "End") {
@@ -220,6 +247,7 @@ public:
 					std::cerr << "Unknown command " << command << "\n";
 		}
 		processParallelMoves();
+		linkPParity(datasets, moves);
 		if (verbose)
 			print() ;
 	}
@@ -230,7 +258,9 @@ public:
 		PieceTypes::iterator iter;
 		for (iter = datasets.begin(); iter != datasets.end(); iter++)
 		{
-			std::cout << setnameFromIndex(iter->first) << " has type " << iter->second.type << ", " << iter->second.size << " elements and is counted mod " << iter->second.omod << " (oparity = " << iter->second.oparity << " pparity = " << iter->second.pparity << ")\n";     
+			std::cout << setnameFromIndex(iter->first) << " has type " << iter->second.type << ", " << iter->second.size << " elements and is counted mod " << iter->second.omod << " (oparity = " << iter->second.oparity << " pparity = " << iter->second.pparity << ")\n";
+			for (unsigned int i = 0; i < iter->second.parityWith.size(); i++)
+				std::cout << "  its permutation parity follows from " << setnameFromIndex(iter->second.parityWith[i]) << "\n";     
 		}
 		std::cout << "\n";
 		
@@ -288,6 +318,49 @@ public:
 		}
 	}
 
+	// Find sets whose permutation parity follows from those of other sets,
+	// like the corners and edges of a 3x3x3. Each set has a column with the
+	// parity of every move on it; a column that adds up from earlier ones
+	// always has the summed parity of those sets.
+	void linkPParity(PieceTypes& datasets, MoveList& moves) {
+		std::vector<int> sets; // unique pieces without a parity constraint of their own
+		PieceTypes::iterator iter;
+		for (iter = datasets.begin(); iter != datasets.end(); iter++)
+			if (iter->second.uniqueperm && !iter->second.pparity && iter->second.size > 1 && iter->second.size <= 20)
+				sets.push_back(iter->first);
+		
+		std::vector<std::vector<char> > basis; // columns of the independent sets, reduced
+		std::vector<std::vector<char> > sums; // which sets each of them adds up
+		std::vector<int> pivots; // first move with a parity in each of them
+		for (unsigned int s = 0; s < sets.size(); s++) {
+			std::vector<char> column;
+			MoveList::iterator moveIter;
+			for (moveIter = moves.begin(); moveIter != moves.end(); moveIter++) {
+				substate &move = moveIter->second.state[sets[s]];
+				column.push_back(permutationParity(move.permutation, move.size));
+			}
+			std::vector<char> sum(sets.size(), 0);
+			sum[s] = 1;
+			for (unsigned int b = 0; b < basis.size(); b++)
+				if (column[pivots[b]]) {
+					for (unsigned int m = 0; m < column.size(); m++)
+						column[m] ^= basis[b][m];
+					for (unsigned int t = 0; t < sets.size(); t++)
+						sum[t] ^= sums[b][t];
+				}
+			int pivot = std::find(column.begin(), column.end(), 1) - column.begin();
+			if (pivot == (int)column.size()) {
+				for (unsigned int t = 0; t < s; t++)
+					if (sum[t])
+						datasets[sets[s]].parityWith.push_back(sets[t]);
+			} else {
+				basis.push_back(column);
+				sums.push_back(sum);
+				pivots.push_back(pivot);
+			}
+		}
+	}
+
 	PieceTypes getDatasets(){
 		return datasets;
 	}
@@ -311,6 +384,10 @@ public:
 	std::vector<Block> getBlocks(){
 		return blocks;
 	}
+
+	PatternSubsets getPatternSubsets(){
+		return patternSubsets;
+	}
 	
 	std::map<string, int> getMoveLimits() {
 		return moveLimits;
@@ -326,6 +403,7 @@ private:
 	std::vector<int> parentMoves; // IDs of parent moves
 	std::set<MovePair> forbidden;
 	std::vector<Block> blocks;
+	PatternSubsets patternSubsets; // piece groups for pattern-subset pruning tables
 	std::map<string, int> moveLimits; // limits on # of moves
 	
 	// Add all powers of this move
@@ -412,7 +490,14 @@ private:
 				ji.clear();
 				ij = mergeMoves(moves[parentMoves[i]].state, moves[parentMoves[j]].state, datasets);
 				ji = mergeMoves(moves[parentMoves[j]].state, moves[parentMoves[i]].state, datasets);
-				if (isEqual(ij, ji, datasets)) {
+				bool parallel = isEqual(ij, ji, datasets);
+				for (int iter=0; iter<ij.size(); iter++) {
+					delete []ij[iter].permutation;
+					delete []ij[iter].orientation;
+					delete []ji[iter].permutation;
+					delete []ji[iter].orientation;
+				}
+				if (parallel) {
 					
 					// if so, forbid any move with parent i followed by any move with parent j
 					for (iter1 = moves.begin(); iter1 != moves.end(); iter1++) {
@@ -432,6 +517,41 @@ private:
 		}
 	}
 	
+	// A mistake in the definition: free the positions read so far and throw
+	// it as an inputError
+	void fail(const string &message, Position &work) {
+		std::set<int *> arrays; // moves may share their arrays, so free each once
+		for (int iter = 0; iter < work.size(); iter++) {
+			arrays.insert(work[iter].permutation);
+			arrays.insert(work[iter].orientation);
+		}
+		work.clear();
+		fail(message, arrays);
+	}
+	void fail(const string &message) {
+		std::set<int *> arrays;
+		fail(message, arrays);
+	}
+	void fail(const string &message, std::set<int *> &arrays) {
+		Position *positions[] = {&solved, &ignore};
+		for (int p = 0; p < 2; p++)
+			for (int iter = 0; iter < positions[p]->size(); iter++) {
+				arrays.insert((*positions[p])[iter].permutation);
+				arrays.insert((*positions[p])[iter].orientation);
+			}
+		for (MoveList::iterator move = moves.begin(); move != moves.end(); move++)
+			for (int iter = 0; iter < move->second.state.size(); iter++) {
+				arrays.insert(move->second.state[iter].permutation);
+				arrays.insert(move->second.state[iter].orientation);
+			}
+		for (std::set<int *>::iterator array = arrays.begin(); array != arrays.end(); array++)
+			delete [](*array);
+		solved.clear();
+		ignore.clear();
+		moves.clear();
+		throw inputError(message);
+	}
+
 	// read in a position from fin
 	Position readPosition(std::istream& fin, bool checkUnique, bool setUnique, string title) {
 		Position newPosition;
@@ -444,12 +564,10 @@ private:
 			int setindex = setnameIndex(setname) ;
 			// check that this set is defined, but not used in this position yet
 			if (datasets.find(setindex) == datasets.end()) {
-				std::cerr << "Set " << setname << " used in " << title << " is not previously declared.\n";
-				exit(-1);
+				fail("Set " + setname + " used in " + title + " is not previously declared.", newPosition);
 			} 
 			if (setindex < newPosition.size() && newPosition[setindex].size != 0) {
-				std::cerr << "Set " << setname << " defined more than once in " << title << ".\n";
-				exit(-1);
+				fail("Set " + setname + " defined more than once in " + title + ".", newPosition);
 			}
 			if (setindex >= newPosition.size())
 				newPosition.resize(setindex+1) ;
@@ -464,8 +582,7 @@ private:
 			for (i = 0; i < datasets[setindex].size; i++){
 				fin >> tmpInt;
 				if (fin.fail()){
-					std::cerr << "Error reading " << setname << " permutation in " << title << ".\n";
-					exit(-1);
+					fail("Error reading " + setname + " permutation in " + title + ".", newPosition);
 				}
 				newPosition[setindex].permutation[i] = tmpInt;
 			}
@@ -473,13 +590,13 @@ private:
 			// do unique permutation stuff
 			if (checkUnique) {
 				if (!uniquePermutation(newPosition[setindex].permutation, newPosition[setindex].size)){
-					std::cerr << "Permutation for set " << setname << " in " << title << " has repeated numbers.\n";
-					exit(-1);
+					fail("Permutation for set " + setname + " in " + title + " has repeated numbers.", newPosition);
 				}
 			}
 			if (setUnique) {
 				datasets[setindex].uniqueperm = uniquePermutation(newPosition[setindex].permutation, newPosition[setindex].size);
-				calcOtherValues(datasets[setindex], newPosition[setindex].permutation) ;
+				if (!calcOtherValues(datasets[setindex], newPosition[setindex].permutation))
+					fail("Permutation for set " + setname + " in " + title + " has a number below 1.", newPosition);
 			}
 			
 			// set orientation to zeros (in case user did not give it)
@@ -501,8 +618,7 @@ private:
 					fin >> tmpInt;
 				}
 				if (fin.fail()){
-					std::cerr << "Error reading " << setname << " orientation in " << title << ".\n";
-					exit(-1);
+					fail("Error reading " + setname + " orientation in " + title + ".", newPosition);
 				}
 				newPosition[setindex].orientation[i] = tmpInt;
 			}
@@ -547,17 +663,20 @@ private:
 			r++ ;
 		return r ;
 	}
-	void calcOtherValues(dataset &ds, int *perm) {
+	// false if the permutation has a number below 1
+	bool calcOtherValues(dataset &ds, int *perm) {
 		ds.maxInSolved = 1 ;
 		for (int i=0; i<ds.size; i++)
 			if (perm[i] <= 0) {
-				std::cerr << "Saw a nonpositive in perm" << std::endl ;
-				exit(-1) ;
+				return false ;
 			} else if (perm[i] > ds.maxInSolved) {
 				ds.maxInSolved = perm[i] ;
 			}
-		ds.permbits = ceillog2(ds.maxInSolved-1) ;
+		ds.permbits = ceillog2(ds.maxInSolved) ; // for the numbers 0 .. maxInSolved-1
 		ds.oribits = ceillog2(ds.omod) ;
+		if (!ds.uniqueperm)
+			ds.prank = makeMultisetRank(perm, ds.size) ;
+		return true ;
 	}
 };
 
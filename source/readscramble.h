@@ -22,19 +22,27 @@
 #ifndef SCRAMBLE_H
 #define SCRAMBLE_H
 
+// Reads the scramble file one scramble at a time, as each is asked for, so
+// that solving starts at once and only the current scramble is in memory.
+// The caller owns each scramble returned and frees it with freeScramble.
 class Scramble
 {
 public:
-	Scramble(std::istream &fin, Position& solved, MoveList& moves, PieceTypes datasets, std::vector<Block>& blocks){
-		sent = 0;
-		int current_max = 999;
-		int current_slack = 0;
-		int current_metric = 0;
-		Position state(solved.size());
-		Position ignore ;
+	Scramble(std::istream &fin, Position& solved, MoveList& moves, PieceTypes datasets, std::vector<Block>& blocks, const solverOptions &options)
+		: fin(fin), solved(solved), moves(moves), datasets(datasets), blocks(blocks), rng(randomStream(options.randomSeed, 0)) {
+		current_max = 999;
+		current_slack = 0;
+		current_metric = 0;
+		current_solutions = options.maxSolutions;
+		byCoordinates = -1;
+	}
+
+	// The next scramble, or one with an empty state at the end of the file
+	ScrambleDef getScramble(){
+		Position state;
+		Position ignore;
 		string name;
-		moveLimits.clear();
-	   
+
 		while(!fin.eof()){
 			string command;
 			fin >> command;
@@ -50,23 +58,20 @@ public:
 				string setname, tmpStr;
 				long i;
 				fin >> setname;
-				state.clear();
-				ignore.clear();
+				state.assign(solved.size(), substate());
+				ignore.assign(solved.size(), substate());
 				while(setname != "End"){
-					int setindex = setnameIndex(setname) ;
+					int setindex = setnameFind(setname) ;
 					if (fin.fail()){
-						std::cerr << "Error reading scramble sets.\n";
-						exit(-1);
+						fail("Error reading scramble sets.", state, ignore);
 					}
 				
 					// Check set names for consistency
-					if (state[setindex].size != 0){
-						std::cerr << "Set " << setname << " declared more than once in scramble " << name << ".\n";
-						exit(-1);
+					if (setindex < 0 || datasets.find(setindex) == datasets.end()){
+						fail("Unknown set " + setname + " in scramble " + name + ".", state, ignore);
 					}
-					if (datasets.find(setindex) == datasets.end()){
-						std::cerr << "Unknown set " << setname << " in scramble " << name <<".\n";
-						exit(-1);
+					if (state[setindex].size != 0){
+						fail("Set " + setname + " declared more than once in scramble " + name + ".", state, ignore);
 					}
 				
 					// initialize some info
@@ -78,7 +83,7 @@ public:
 					ignore[setindex] = newSubstate(datasets[setindex].size);
 					if (state[setindex].permutation == NULL || state[setindex].orientation == NULL ||
 						ignore[setindex].permutation == NULL || ignore[setindex].orientation == NULL){
-						std::cerr << "Can't allocate memory in Scramble::Scramble(...)\n";
+						std::cerr << "Can't allocate memory in Scramble::getScramble()\n";
 						exit(-1);
 					}
 
@@ -86,8 +91,7 @@ public:
 					for (i = 0; i < datasets[setindex].size; i++){
 						fin >> tmpStr;
 						if (fin.fail()){
-							std::cerr << "Error reading " << setname << " permutation for scramble " << name << ".\n";
-							exit(-1);
+							fail("Error reading " + setname + " permutation for scramble " + name + ".", state, ignore);
 						}
 						if (tmpStr.at(0) == '?') {
 							ignore[setindex].permutation[i] = 1;
@@ -96,17 +100,20 @@ public:
 								
 								// throw an error message if using blocks
 								if (blocks.size() != 0) {
-									std::cerr << "Cannot use unknown permutations on puzzles with blocks!\n";
-									exit(-1);
+									fail("Cannot use unknown permutations on puzzles with blocks!", state, ignore);
 								}
 							} else { // ? and then a number
 								string tmp2 = tmpStr.substr(1);
 								state[setindex].permutation[i] = atol(tmp2.c_str());
 							}
 						} else {
+							if (tmpStr.at(0) < '0' || tmpStr.at(0) > '9')
+								fail("Error reading " + setname + " permutation for scramble " + name + ".", state, ignore);
 							state[setindex].permutation[i] = atol(tmpStr.c_str());
 							ignore[setindex].permutation[i] = 0;
 						}
+						if (state[setindex].permutation[i] != -1 && !inSolved(setindex, state[setindex].permutation[i]))
+							fail("Piece " + tmpStr + " of " + setname + " in scramble " + name + " is not in the solved state.", state, ignore);
 					}
 					
 					// set orientation to zeros (in case user did not give it)
@@ -118,6 +125,8 @@ public:
 					// read something in. if it doesn't look like a number,
 					// use it as the setname. otherwise, read in orientation
 					fin >> tmpStr;
+					if (fin.fail())
+						fail("Error reading scramble " + name + ".", state, ignore);
 					if (tmpStr.at(0) != '?' && (tmpStr.at(0) < '0' || tmpStr.at(0) > '9')) {
 						setname = tmpStr;
 						continue;
@@ -128,8 +137,7 @@ public:
 							fin >> tmpStr;
 						}
 						if (fin.fail()){
-							std::cerr << "Error reading " << setname << " orientation for scramble " << name << ".\n";
-							exit(-1);
+							fail("Error reading " + setname + " orientation for scramble " + name + ".", state, ignore);
 						}
 						if (tmpStr.at(0) == '?') {
 							ignore[setindex].orientation[i] = 1;
@@ -137,7 +145,9 @@ public:
 								state[setindex].orientation[i] = 0;
 							} else { // ? and then a number
 								string tmp2 = tmpStr.substr(1);
-								state[setindex].orientation[i] = atol(tmp2.c_str());
+								state[setindex].orientation[i] = atol(tmp2.c_str()) % datasets[setindex].omod;
+								if (state[setindex].orientation[i] < 0)
+									state[setindex].orientation[i] += datasets[setindex].omod;
 							}
 						} else {
 							int tmp2 = atoi(tmpStr.c_str()) % datasets[setindex].omod;
@@ -158,12 +168,13 @@ public:
 				scramble.max_depth = current_max;
 				scramble.slack = current_slack;
 				scramble.metric = current_metric;
+				scramble.max_solutions = current_solutions;
 				scramble.printState = 0;
 				scramble.moveLimits = std::vector<MoveLimit>();
 				for (unsigned int i=0; i<moveLimits.size(); i++) {
 					scramble.moveLimits.push_back(moveLimits[i]);
 				}
-				states.push_back(scramble);
+				return scramble;
 			}
 			// ScrambleAlg - read a scramble as a set of moves
 			else if (command == "ScrambleAlg"){
@@ -186,7 +197,7 @@ public:
 					if (state[iter->first].permutation == NULL || state[iter->first].orientation == NULL ||
 						ignore[iter->first].permutation == NULL || ignore[iter->first].orientation == NULL ||
 						new_state[iter->first].permutation == NULL || new_state[iter->first].orientation == NULL){
-						std::cerr << "Can't allocate memory in Scramble::Scramble(...)\n";
+						std::cerr << "Can't allocate memory in Scramble::getScramble()\n";
 						exit(-1);
 					}
 					for (int i=0; i<size; i++) {
@@ -201,20 +212,17 @@ public:
 				fin >> movename;
 				while(movename != "End"){
 					if (fin.fail()) {
-						std::cerr << "Error reading scramble " << name << ".\n";
-						exit(-1);
+						fail("Error reading scramble " + name + ".", state, ignore, &new_state);
 					}
 					
 					// apply move called movename to solved, if possible
 					if (!moveIn(movename, moves)) {
-						std::cerr << "Move " << movename << " in scramble " << name << " is unknown.\n";
-						exit(-1);
+						fail("Move " + movename + " in scramble " + name + " is unknown.", state, ignore, &new_state);
 					}
 					
 					if (blocks.size() != 0) {
 						if (!blockLegal(state, blocks, moves[getMoveID(movename, moves)].state)) {
-							std::cerr << "Move " << movename << " in scramble " << name << " is blocked.\n";
-							exit(-1);
+							fail("Move " + movename + " in scramble " + name + " is blocked.", state, ignore, &new_state);
 						}
 					}
 					applyMove(state, new_state, moves[getMoveID(movename, moves)].state, datasets);
@@ -230,6 +238,10 @@ public:
 				
 					fin >> movename;
 				}
+				for (int i = 0; i < new_state.size(); i++) {
+					delete []new_state[i].permutation;
+					delete []new_state[i].orientation;
+				}
 				
 				ScrambleDef scramble;
 				scramble.name = name;
@@ -238,12 +250,13 @@ public:
 				scramble.max_depth = current_max;
 				scramble.slack = current_slack;
 				scramble.metric = current_metric;
+				scramble.max_solutions = current_solutions;
 				scramble.printState = 1;
 				scramble.moveLimits = std::vector<MoveLimit>();
 				for (unsigned int i=0; i<moveLimits.size(); i++) {
 					scramble.moveLimits.push_back(moveLimits[i]);
 				}
-				states.push_back(scramble);
+				return scramble;
 			}
 			// RandomScramble - read a scramble as a set of moves
 			else if (command == "RandomScramble"){
@@ -266,7 +279,7 @@ public:
 					if (state[iter->first].permutation == NULL || state[iter->first].orientation == NULL ||
 						ignore[iter->first].permutation == NULL || ignore[iter->first].orientation == NULL ||
 						new_state[iter->first].permutation == NULL || new_state[iter->first].orientation == NULL){
-						std::cerr << "Can't allocate memory in Scramble::Scramble(...)\n";
+						std::cerr << "Can't allocate memory in Scramble::getScramble()\n";
 						exit(-1);
 					}
 					for (int i=0; i<size; i++) {
@@ -281,39 +294,19 @@ public:
 				fin >> movename;
 				while(movename != "End"){
 					if (fin.fail()){
-						std::cerr << "Error reading scramble " << name << ".\n";
-						exit(-1);
+						fail("Error reading scramble " + name + ".", state, ignore, &new_state);
 					}
 				
 					fin >> movename;
 				}
 				
-				// apply a bunch of random moves
-				int RANDOM_MOVES = 10000 + (rand()%2);
-				int nMoves = moves.size();
-				for (int i=0; i<RANDOM_MOVES; i++) {
-					// get random move
-					MoveList::iterator iter2 = moves.begin();
-					std::advance(iter2, rand() % nMoves);
-					
-					if (blocks.size() != 0) {
-						if (!blockLegal(state, blocks, iter2->second.state)) {
-							i--;
-							continue;
-						}
-					}
-					
-					applyMove(state, new_state, iter2->second.state, datasets);
-					
-					// copy new_state to state
-					for (iter = datasets.begin(); iter != datasets.end(); iter++)
-					{
-						int size = iter->second.size;
-						for (int i=0; i<size; i++) {
-							state[iter->first].permutation[i] = new_state[iter->first].permutation[i];
-							state[iter->first].orientation[i] = new_state[iter->first].orientation[i];
-						}
-					}
+				// draw a random position
+				if (byCoordinates < 0)
+					byCoordinates = coordinatesReachable(solved, moves, datasets, blocks);
+				randomPosition(state, new_state, solved, moves, datasets, blocks, byCoordinates, rng);
+				for (int i = 0; i < new_state.size(); i++) {
+					delete []new_state[i].permutation;
+					delete []new_state[i].orientation;
 				}
 				
 				ScrambleDef scramble;
@@ -323,27 +316,33 @@ public:
 				scramble.max_depth = current_max;
 				scramble.slack = current_slack;
 				scramble.metric = current_metric;
+				scramble.max_solutions = current_solutions;
 				scramble.printState = 1;
 				scramble.moveLimits = std::vector<MoveLimit>();
 				for (unsigned int i=0; i<moveLimits.size(); i++) {
 					scramble.moveLimits.push_back(moveLimits[i]);
 				}
-				states.push_back(scramble);
+				return scramble;
 			}
 			// MaxDepth - maximum depth to search to
 			else if (command == "MaxDepth"){
 				fin >> current_max;
 				if (fin.fail()){
-					std::cerr << "Error reading MaxDepth\n";
-					exit(-1);
+					fail("Error reading MaxDepth.", state, ignore);
 				}
 			}
 			// Slack - extra depth after optimal
 			else if (command == "Slack"){
 				fin >> current_slack;
 				if (fin.fail()){
-					std::cerr << "Error reading Slack\n";
-					exit(-1);
+					fail("Error reading Slack.", state, ignore);
+				}
+			}
+			// MaxSolutions - stop after this many solutions (0 for no limit)
+			else if (command == "MaxSolutions"){
+				fin >> current_solutions;
+				if (fin.fail() || current_solutions < 0){
+					fail("Error reading MaxSolutions.", state, ignore);
 				}
 			}
 			// QTM - use QTM
@@ -362,8 +361,7 @@ public:
 				fin >> movename;
 				while(movename != "End") {
 					if (fin.fail() || movename.size() < 1) {
-						std::cerr << "Error reading move limits.\n";
-						exit(-1);
+						fail("Error reading move limits.", state, ignore);
 					}
 					
 					// get basic elements of movelimit
@@ -373,13 +371,11 @@ public:
 						movename = movename.substr(0, movename.size()-1);
 					
 					if (!moveIn(movename, moves)) {
-						std::cerr << "Move " << movename << " used in move list is not previously declared.\n";
-						exit(-1);
+						fail("Move " + movename + " used in move list is not previously declared.", state, ignore);
 					}
 					fin >> limit;
 					if (fin.fail()){
-						std::cerr << "Error reading move limits.\n";
-						exit(-1);
+						fail("Error reading move limits.", state, ignore);
 					}
 					ml.move = getMoveID(movename, moves);
 					ml.limit = limit;
@@ -423,25 +419,60 @@ public:
 			}
 			else if (command == "") {} // Empty line
 			else {
-				std::cerr << "Unknown command \"" << command << "\" in scramble file.\n";  
-				exit(-1);
+				fail("Unknown command \"" + command + "\" in scramble file.", state, ignore);
 			}
 		}               
-	}
-	
-	ScrambleDef getScramble(){
-		if (states.size() > sent){
-			sent++;
-			return states[sent-1];
-		}
 		ScrambleDef tmp;
 		return tmp;
 	}
 	
 private:
-	std::vector<ScrambleDef> states;
+	// A mistake in the scramble file: free the positions read so far and
+	// throw it as an inputError
+	void fail(const string &message, Position &state, Position &ignore, Position *work = NULL) {
+		ScrambleDef partial;
+		partial.state.swap(state);
+		partial.ignore.swap(ignore);
+		freeScramble(partial);
+		if (work != NULL) {
+			partial.state.swap(*work);
+			freeScramble(partial);
+		}
+		throw inputError(message);
+	}
+
+	// is this piece number used in the solved state of a set?
+	bool inSolved(int setindex, int piece) {
+		substate &sub = solved[setindex];
+		return std::find(sub.permutation, sub.permutation + sub.size, piece) != sub.permutation + sub.size;
+	}
+
+	std::istream &fin;
+	Position &solved;
+	MoveList &moves;
+	PieceTypes datasets;
+	std::vector<Block> &blocks;
+	int current_max;
+	int current_slack;
+	int current_metric;
+	long long current_solutions;
 	std::vector<MoveLimit> moveLimits;
-	unsigned int sent;
+	randomSource rng;
+	int byCoordinates; // can random positions be drawn set by set? found when first needed
 };
 
+// Free the positions of a scramble once it is solved
+static void freeScramble(ScrambleDef &scramble) {
+	for (int iter = 0; iter < scramble.state.size(); iter++) {
+		delete []scramble.state[iter].permutation;
+		delete []scramble.state[iter].orientation;
+	}
+	for (int iter = 0; iter < scramble.ignore.size(); iter++) {
+		delete []scramble.ignore[iter].permutation;
+		delete []scramble.ignore[iter].orientation;
+	}
+	scramble.state.clear();
+	scramble.ignore.clear();
+}
+
 #endif
@@ -0,0 +1,214 @@
+/*
+ KSolve+ - Puzzle solving program.
+ Copyright (C) 2007-2013 Kre Krig and Michael Gottlieb
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+// --json output: one line of JSON per scramble, with its solutions and
+// optimal length, and the time and search effort they took; and the search
+// statistics of builds with -DKSOLVE_STATS, after every depth.
+
+#ifndef REPORT_H
+#define REPORT_H
+
+// s as a JSON string
+static string jsonString(const string &s) {
+	std::ostringstream out;
+	out << '"';
+	for (unsigned int i = 0; i < s.size(); i++) {
+		unsigned char c = s[i];
+		if (c == '"' || c == '\\')
+			out << '\\' << c;
+		else if (c == '\n')
+			out << "\\n";
+		else if (c == '\t')
+			out << "\\t";
+		else if (c < 32) {
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", c);
+			out << buf;
+		} else
+			out << c;
+	}
+	out << '"';
+	return out.str();
+}
+
+static string jsonNumbers(const std::vector<long long> &numbers) {
+	std::ostringstream out;
+	out << '[';
+	for (unsigned int i = 0; i < numbers.size(); i++)
+		out << (i > 0 ? "," : "") << numbers[i];
+	out << ']';
+	return out.str();
+}
+
+// The counts of all threads for one depth of a search
+struct depthReport {
+	int depth;
+	long long nodes, pruned;
+	long long counts[COUNT_KINDS]; // and those of -DKSOLVE_STATS builds, else 0
+	std::vector<long long> cutBy;
+	double seconds;
+};
+
+// Add up the threads' counts for a depth, and clear them for the next; the
+// solutions they kept are left to the caller
+static depthReport mergeCounts(std::vector<searchThread> &threads, int depth, double seconds) {
+	depthReport report;
+	report.depth = depth;
+	report.nodes = report.pruned = 0;
+	for (int kind = 0; kind < COUNT_KINDS; kind++)
+		report.counts[kind] = 0;
+	report.seconds = seconds;
+	for (unsigned int t = 0; t < threads.size(); t++) {
+		report.nodes += threads[t].nodes;
+		report.pruned += threads[t].pruned;
+#ifdef KSOLVE_STATS
+		for (int kind = 0; kind < COUNT_KINDS; kind++)
+			report.counts[kind] += threads[t].counts[kind];
+		if (threads[t].cutBy.size() > report.cutBy.size())
+			report.cutBy.resize(threads[t].cutBy.size());
+		for (unsigned int i = 0; i < threads[t].cutBy.size(); i++)
+			report.cutBy[i] += threads[t].cutBy[i];
+#endif
+		clearCounts(threads[t]);
+	}
+	return report;
+}
+
+static string cutName(int cutBy) {
+	return setnameFromIndex(cutBy / 2) + (cutBy % 2 == CUT_BY_ORIENTATION ? " orientation" : " permutation");
+}
+
+// Nodes of this depth per node of the one before
+static double branchingFactor(const depthReport &report, const depthReport *previous) {
+	return (previous != NULL && previous->nodes > 0) ? (double)report.nodes / previous->nodes : 0;
+}
+
+// The statistics of a -DKSOLVE_STATS build for one depth, as a line of text
+static string statsText(const depthReport &report, const depthReport *previous) {
+	std::ostringstream out;
+	out << "Depth " << report.depth << " statistics: " << report.nodes << " nodes";
+	if (previous != NULL && previous->nodes > 0)
+		out << " (branching factor " << branchingFactor(report, previous) << ")";
+	for (int kind = 0; kind < COUNT_KINDS; kind++)
+		out << ", " << report.counts[kind] << " " << countName(kind);
+	out << ", " << report.pruned << " pruned";
+	bool first = true;
+	for (unsigned int i = 0; i < report.cutBy.size(); i++)
+		if (report.cutBy[i] > 0) {
+			out << (first ? " (" : ", ") << cutName(i) << " " << report.cutBy[i];
+			first = false;
+		}
+	if (!first)
+		out << ")";
+	if (report.seconds > 0)
+		out << ", " << report.nodes / report.seconds << " nodes/s";
+	out << "\n";
+	return out.str();
+}
+
+// The same as a JSON object
+static string statsJson(const depthReport &report, const depthReport *previous) {
+	std::ostringstream out;
+	out << "{\"depth\":" << report.depth << ",\"nodes\":" << report.nodes << ",\"branching\":" << branchingFactor(report, previous);
+	for (int kind = 0; kind < COUNT_KINDS; kind++)
+		out << ",\"" << countName(kind) << "\":" << report.counts[kind];
+	out << ",\"pruned\":" << report.pruned << ",\"cut_by\":{";
+	bool first = true;
+	for (unsigned int i = 0; i < report.cutBy.size(); i++)
+		if (report.cutBy[i] > 0) {
+			out << (first ? "" : ",") << jsonString(cutName(i)) << ":" << report.cutBy[i];
+			first = false;
+		}
+	out << "},\"seconds\":" << report.seconds << ",\"nodes_per_second\":" << (report.seconds > 0 ? report.nodes / report.seconds : 0) << "}";
+	return out.str();
+}
+
+// What jsonSolve collects from the threads after each depth
+struct jsonDepths {
+	std::vector<searchThread> counts;
+	std::vector<depthReport> reports;
+	std::vector<string> solutions;
+	double depthStart;
+};
+
+static void jsonDepthDone(void *context, int depth) {
+	jsonDepths &depths = *(jsonDepths *)context;
+	double now = wallSeconds();
+	depths.reports.push_back(mergeCounts(depths.counts, depth, now - depths.depthStart));
+	depths.depthStart = now;
+	for (unsigned int t = 0; t < depths.counts.size(); t++) {
+		for (unsigned int i = 0; i < depths.counts[t].solutions.size(); i++) {
+			string &solution = depths.counts[t].solutions[i];
+			depths.solutions.push_back(solution.substr(std::min(solution.size(), solution.find_first_not_of(' '))));
+		}
+		depths.counts[t].solutions.clear();
+	}
+}
+
+// Solve a scramble with solveScramble on all threads, keeping each thread's
+// solutions and counts to itself until the depth is done, and describe the
+// whole search in one line of JSON.
+static string jsonSolve(ScrambleDef &scramble, Position& solved, MoveList& moves, PieceTypes& datasets, PruneTable& tables,
+		std::set<MovePair>& forbidden, std::vector<Block>& blocks) {
+	double wallStart = wallSeconds();
+	clock_t cpuStart = clock();
+	jsonDepths depths;
+	depths.counts.resize(searchThreads());
+	for (unsigned int t = 0; t < depths.counts.size(); t++)
+		clearCounts(depths.counts[t]);
+	depths.depthStart = wallStart;
+	solutionSink sink(NULL, &depths);
+	sink.threads = &depths.counts;
+	sink.depthDone = jsonDepthDone;
+	int length = solveScramble(scramble, solved, moves, datasets, tables, forbidden, blocks, sink, true);
+
+	std::vector<depthReport> &reports = depths.reports;
+	std::vector<string> &solutions = depths.solutions;
+	std::vector<long long> nodes, pruned; // per depth
+	for (unsigned int d = 0; d < reports.size(); d++) {
+		nodes.push_back(reports[d].nodes);
+		pruned.push_back(reports[d].pruned);
+	}
+
+	string name = scramble.name;
+	while (!name.empty() && isspace((unsigned char)name[name.size() - 1]))
+		name.erase(name.size() - 1); // a \r from a file with DOS line endings
+	std::ostringstream out;
+	out << "{\"name\":" << jsonString(name) << ",\"length\":";
+	if (length < 0)
+		out << "null";
+	else
+		out << length;
+	out << ",\"solutions\":[";
+	for (unsigned int i = 0; i < solutions.size(); i++)
+		out << (i > 0 ? "," : "") << jsonString(solutions[i]);
+	out << "],\"wall\":" << wallSeconds() - wallStart << ",\"cpu\":" << (clock() - cpuStart) / (double)CLOCKS_PER_SEC
+		<< ",\"nodes\":" << jsonNumbers(nodes) << ",\"pruned\":" << jsonNumbers(pruned);
+	if (SEARCH_STATS) {
+		out << ",\"stats\":[";
+		for (unsigned int d = 0; d < reports.size(); d++)
+			out << (d > 0 ? "," : "") << statsJson(reports[d], d > 0 ? &reports[d - 1] : NULL);
+		out << "]";
+	}
+	out << "}";
+	return out.str();
+}
+
+#endif
@@ -0,0 +1,152 @@
+/*
+ KSolve+ - Puzzle solving program.
+ Copyright (C) 2007-2013 Kre Krig and Michael Gottlieb
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+// Estimates of the distance distribution, from optimal solutions of random positions
+
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+static const int SAMPLE_REPORT = 100; // print the histogram so far this often
+
+// Wilson score interval for count positions out of n, at 95% confidence
+static void wilsonInterval(long long count, long long n, double& low, double& high)
+{
+	const double z = 1.96;
+	double p = count / (double)n;
+	double denom = 1 + z * z / n;
+	double centre = (p + z * z / (2.0 * n)) / denom;
+	double half = z * sqrt(p * (1 - p) / n + z * z / (4.0 * n * n)) / denom;
+	low = std::max(0.0, centre - half);
+	high = std::min(1.0, centre + half);
+}
+
+// The distribution so far: exact[d] positions were solved in d moves, and
+// atLeast[d] ran out of budget after showing they need at least d. With
+// any of those, the average counts them as d and is only a lower bound.
+static void printSampleHistogram(std::vector<long long>& exact, std::vector<long long>& atLeast, long long n)
+{
+	std::cout << "Moves\tPositions\tFraction\t95% interval\n";
+	long long solvedCount = 0, censoredCount = 0;
+	double sum = 0, sumSquares = 0, censoredSum = 0;
+	for (unsigned int d = 0; d < exact.size(); d++) {
+		if (exact[d] > 0) {
+			double low, high;
+			wilsonInterval(exact[d], n, low, high);
+			std::cout << d << "\t" << exact[d] << "\t" << exact[d] / (double)n
+				<< "\t" << low << " - " << high << "\n";
+			solvedCount += exact[d];
+			sum += (double)d * exact[d];
+			sumSquares += (double)d * d * exact[d];
+		}
+		if (atLeast[d] > 0) {
+			std::cout << ">=" << d << "\t" << atLeast[d] << "\t" << atLeast[d] / (double)n << "\tout of budget\n";
+			censoredCount += atLeast[d];
+			censoredSum += (double)d * atLeast[d];
+		}
+	}
+	if (solvedCount + censoredCount == 0)
+		return;
+	if (censoredCount > 0) {
+		std::cout << "Average: at least " << (sum + censoredSum) / (solvedCount + censoredCount)
+			<< " (" << censoredCount << " positions out of budget)\n";
+		return;
+	}
+	double mean = sum / solvedCount;
+	double spread = solvedCount > 1 ? sqrt((sumSquares - sum * mean) / (solvedCount - 1)) : 0;
+	std::cout << "Average: " << mean << " +- " << 1.96 * spread / sqrt((double)solvedCount) << "\n";
+}
+
+// Solve count random positions optimally, in parallel, and estimate how
+// far positions are from solved. Each search stops at maxNodes nodes or
+// after maxSeconds seconds, if those are not 0.
+static void sampleDistances(Position& solved, MoveList& moves, PieceTypes& datasets, PruneTable& tables, std::set<MovePair>& forbidden, std::vector<Block>& blocks, int metric, long long count, long long maxNodes, double maxSeconds, long long seed)
+{
+	std::vector<long long> exact, atLeast;
+	long long done = 0;
+	bool byCoordinates = coordinatesReachable(solved, moves, datasets, blocks);
+	std::cout << "Random positions " << (byCoordinates ? "drawn set by set" : "made with random moves") << ", seed " << seed << "\n";
+	std::cout << "Sample\tMoves\tNodes\tTime\n";
+	#pragma omp parallel
+	{
+		Position state(solved.size()), new_state(solved.size());
+		for (int iter = 0; iter < solved.size(); iter++) {
+			state[iter] = newSubstate(solved[iter].size);
+			new_state[iter] = newSubstate(solved[iter].size);
+		}
+		#pragma omp for schedule(dynamic, 1)
+		for (long long sample = 0; sample < count; sample++) {
+			randomSource rng = randomStream(seed, sample + 1); // stream 0 is for RandomScramble
+			randomPosition(state, new_state, solved, moves, datasets, blocks, byCoordinates, rng);
+
+			double start = wallSeconds();
+			searchBudget budget;
+			budget.nodes = 0;
+			budget.maxNodes = maxNodes;
+			budget.deadline = maxSeconds > 0 ? start + maxSeconds : 0;
+			budget.exhausted = false;
+			positionRanks ranks;
+			rankPosition(state, tables, ranks);
+			// stop at the first solution of a depth, or when the budget is spent
+			std::atomic<bool> stop(false);
+			std::atomic<long long> solutions(0);
+			solutionSink sink(dropSolution, NULL);
+			sink.stop = &stop;
+			sink.solutions = &solutions;
+			sink.maxSolutions = 1;
+			sink.budget = &budget;
+			Position noIgnore;
+			std::vector<MoveLimit> noLimits;
+			int depth = 0;
+			while (!treeSolve(state, ranks, solved, moves, datasets, tables, forbidden, noIgnore, blocks, depth, metric, noLimits, "", -1, false, &sink) && !budget.exhausted)
+				depth++;
+			double elapsed = wallSeconds() - start;
+
+			#pragma omp critical (sampleReport)
+			{
+				if ((int)exact.size() <= depth) {
+					exact.resize(depth + 1, 0);
+					atLeast.resize(depth + 1, 0);
+				}
+				if (budget.exhausted)
+					atLeast[depth]++;
+				else
+					exact[depth]++;
+				done++;
+				std::cout << sample + 1 << "\t" << (budget.exhausted ? ">=" : "") << depth << "\t"
+					<< budget.nodes << "\t" << elapsed << "s\n";
+				if (done % SAMPLE_REPORT == 0 && done < count) {
+					std::cout << "\nAfter " << done << " positions:\n";
+					printSampleHistogram(exact, atLeast, done);
+					std::cout << "\n";
+				}
+				std::cout.flush();
+			}
+		}
+		for (int iter = 0; iter < solved.size(); iter++) {
+			delete []state[iter].permutation;
+			delete []state[iter].orientation;
+			delete []new_state[iter].permutation;
+			delete []new_state[iter].orientation;
+		}
+	}
+	std::cout << "\nDistances of " << count << " random positions:\n";
+	printSampleHistogram(exact, atLeast, count);
+}
+
+#endif
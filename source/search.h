@@ -22,13 +22,218 @@
 #ifndef SEARCH_H
 #define SEARCH_H
 
-static bool treeSolve(Position state, Position& solved, MoveList& moves, PieceTypes& datasets, PruneTable& prunetables, std::set<MovePair>& forbiddenPairs, Position& ignore, std::vector<Block>& blocks, int depth, int metric, std::vector<MoveLimit>& moveLimits, string sequence, int old_move, bool splitThreads){
+// Finer counts of a search, kept only when compiled with -DKSOLVE_STATS
+static const int COUNT_EXPANDED = 0; // positions whose moves were tried
+static const int COUNT_GENERATED = 1; // children made by applying a move
+static const int COUNT_FORBIDDEN = 2; // moves skipped as a forbidden pair
+static const int COUNT_BLOCKED = 3; // moves skipped as breaking a block
+static const int COUNT_LIMITED = 4; // moves skipped for a move limit
+static const int COUNT_KINDS = 5;
+static const char *countName(int kind) {
+	static const char *names[COUNT_KINDS] = {"expanded", "generated", "forbidden", "blocked", "limited"};
+	return names[kind];
+}
+#ifdef KSOLVE_STATS
+static const bool SEARCH_STATS = true;
+#else
+static const bool SEARCH_STATS = false;
+#endif
+
+// What one thread of a search has counted, and the solutions it found if
+// they are kept. Padded so that threads don't write to one cache line.
+struct searchThread {
+	long long nodes; // positions visited
+	long long pruned; // positions cut off by the pruning tables
+	std::vector<string> solutions;
+#ifdef KSOLVE_STATS
+	long long counts[COUNT_KINDS];
+	std::vector<long long> cutBy; // per table, as prune reports it: cut off positions and children
+#endif
+	char padding[64];
+};
+
+// Limits on a search: nodes visited, and a wall clock deadline (0 for none)
+struct searchBudget {
+	long long nodes;
+	long long maxNodes;
+	double deadline;
+	bool exhausted;
+};
+
+// seconds of wall clock time, from some fixed point
+static double wallSeconds(){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+// Where a search sends its solutions, instead of printing them, and a flag
+// that makes it give up as soon as it is set
+struct solutionSink {
+	void (*found)(void *context, const string &solution); // called one solution at a time
+	void *context;
+	std::atomic<bool> *stop; // may be NULL
+	std::vector<searchThread> *threads; // counts for each OpenMP thread, or NULL; without found, solutions are kept here
+	std::atomic<long long> *solutions; // solutions so far, over all threads, or NULL
+	long long maxSolutions; // sets stop once solutions reaches it; 0 for no limit
+	searchBudget *budget; // sets stop and budget->exhausted once spent, or NULL; only for searches on one thread
+	void (*depthDone)(void *context, int depth); // called by solveScramble after each depth, or NULL
+	// everything but found and context is off until set by name
+	solutionSink(void (*found)(void *, const string &), void *context)
+		: found(found), context(context), stop(NULL), threads(NULL), solutions(NULL),
+		  maxSolutions(0), budget(NULL), depthDone(NULL) {}
+};
+
+static int threadNumber() {
+#ifdef _OPENMP
+	return omp_get_thread_num();
+#else
+	return 0;
+#endif
+}
+
+static int searchThreads() {
+#ifdef _OPENMP
+	return omp_get_max_threads();
+#else
+	return 1;
+#endif
+}
+
+static searchThread *threadCounts(solutionSink *sink) {
+	return (sink != NULL && sink->threads != NULL) ? &(*sink->threads)[threadNumber()] : NULL;
+}
+
+static void clearCounts(searchThread &counts) {
+	counts.nodes = counts.pruned = 0;
+#ifdef KSOLVE_STATS
+	for (int kind = 0; kind < COUNT_KINDS; kind++)
+		counts.counts[kind] = 0;
+	counts.cutBy.clear();
+#endif
+}
+
+// These compile to nothing without KSOLVE_STATS
+static void countEvent(searchThread *counts, int kind) {
+#ifdef KSOLVE_STATS
+	if (counts != NULL)
+		counts->counts[kind]++;
+#endif
+}
+
+static void countCut(searchThread *counts, int cutBy) {
+#ifdef KSOLVE_STATS
+	if (counts == NULL || cutBy < 0)
+		return;
+	if (cutBy >= (int)counts->cutBy.size())
+		counts->cutBy.resize(cutBy + 1);
+	counts->cutBy[cutBy]++;
+#endif
+}
+
+// A child that boundChildren cut off, put down to the first orientation table that does
+static void countChildCut(searchThread *counts, PruneTable& prunetables, std::vector<int>& childOrientations, int move, int depth) {
+#ifdef KSOLVE_STATS
+	if (counts == NULL)
+		return;
+	PruneTable::iterator iter;
+	for (iter = prunetables.begin(); iter != prunetables.end(); iter++) {
+		childMoves &children = iter->second.children;
+		if (children.nmoves != 0 && iter->second.orientation[childOrientations[iter->first*children.nmoves + move]] > depth) {
+			countCut(counts, 2*iter->first + CUT_BY_ORIENTATION);
+			return;
+		}
+	}
+#endif
+}
+
+// The buffers a search needs at one depth, kept from node to node so that
+// the search does not allocate them again at every node
+struct searchLevel {
+	std::vector<int> childBounds, childOrientations; // as boundChildren fills them
+	positionRanks childRanks;
+};
+
+// This thread's buffers, with room for every depth up to this one. A node
+// uses the level of its remaining depth, which its children never reach.
+static std::vector<searchLevel> &searchLevels(int depth) {
+	static thread_local std::vector<searchLevel> levels;
+	if ((int)levels.size() <= depth)
+		levels.resize(depth + 1);
+	return levels;
+}
+
+static bool stopRequested(solutionSink *sink) {
+	return sink != NULL && sink->stop != NULL && sink->stop->load(std::memory_order_relaxed);
+}
+
+// Count a node against the budget, if there is one, and stop the search
+// once it is spent. The clock is only read every 65536 nodes.
+static bool budgetSpent(solutionSink *sink) {
+	if (sink == NULL || sink->budget == NULL)
+		return false;
+	searchBudget &budget = *sink->budget;
+	budget.nodes++;
+	if ((budget.maxNodes > 0 && budget.nodes > budget.maxNodes) ||
+		(budget.deadline > 0 && (budget.nodes & 0xffff) == 0 && wallSeconds() > budget.deadline)) {
+		budget.exhausted = true;
+		if (sink->stop != NULL)
+			sink->stop->store(true);
+	}
+	return budget.exhausted;
+}
+
+// Count a solution, and stop the search once there are maxSolutions of them.
+// False for any that other threads find after that, which are dropped.
+static bool countSolution(solutionSink *sink) {
+	if (sink == NULL || sink->solutions == NULL)
+		return true;
+	long long found = sink->solutions->fetch_add(1) + 1;
+	if (sink->maxSolutions <= 0)
+		return true;
+	if (found >= sink->maxSolutions && sink->stop != NULL)
+		sink->stop->store(true);
+	return found <= sink->maxSolutions;
+}
+
+// solutionSink::found for a search that prints as usual but is counted
+static void printSolution(void *context, const string &solution) {
+	std::cout << solution << "\n";
+}
+
+// solutionSink::found for a search that only asks whether there is one
+static void dropSolution(void *context, const string &solution) {
+}
+
+// The moves so far, with one more; not kept when the solutions are dropped
+static string childSequence(solutionSink *sink, const string &sequence, const string &move) {
+	if (sink != NULL && sink->found == dropSolution)
+		return string();
+	return sequence + " " + move;
+}
+
+static bool treeSolve(Position state, positionRanks& ranks, Position& solved, MoveList& moves, PieceTypes& datasets, PruneTable& prunetables, std::set<MovePair>& forbiddenPairs, Position& ignore, std::vector<Block>& blocks, int depth, int metric, std::vector<MoveLimit>& moveLimits, string sequence, int old_move, bool splitThreads, solutionSink *sink = NULL){
+	if (stopRequested(sink) || budgetSpent(sink))
+		return false;
+	searchThread *counts = threadCounts(sink);
+	if (counts != NULL)
+		counts->nodes++;
+
 	// if we ran out of depth, it's either solved or not
 	if (depth <= 0) {
 		if (isSolved(state, solved, ignore, datasets)){
+			if (!countSolution(sink))
+				return true;
+			if (counts != NULL && sink->found == NULL) {
+				counts->solutions.push_back(sequence); // no lock needed
+				return true;
+			}
             #pragma omp critical
             {
-                std::cout << sequence << "\n";
+                if (sink != NULL)
+                    sink->found(sink->context, sequence);
+                else
+                    std::cout << sequence << "\n";
             }
 			return true;
 		} else {
@@ -37,8 +242,19 @@ static bool treeSolve(Position state, Position& solved, MoveList& moves, PieceTy
 	}
 
 	// use pruning tables to see if we don't have enough depth left
-	if (prune(state, depth, datasets, prunetables))
+	int cutBy = -1;
+	if (prune(state, ranks, depth, datasets, prunetables, SEARCH_STATS ? &cutBy : NULL)) {
+		if (counts != NULL)
+			counts->pruned++;
+		countCut(counts, cutBy);
 		return false;
+	}
+	countEvent(counts, COUNT_EXPANDED);
+
+	// bound the depth of all children at once, to skip pruned ones before applying their move
+	searchLevel &level = searchLevels(depth)[depth];
+	std::vector<int> &childBounds = level.childBounds, &childOrientations = level.childOrientations;
+	boundChildren(state, prunetables, childBounds, childOrientations);
 
 	// define variables; initialize room for a new state
 	bool success = false;
@@ -55,19 +271,27 @@ static bool treeSolve(Position state, Position& solved, MoveList& moves, PieceTy
             }
 
             std::vector<MoveLimit> localMoveLimits = moveLimits;
+            positionRanks &childRanks = searchLevels(depth)[depth].childRanks; // each thread's own
+            searchThread *localCounts = threadCounts(sink);
 
             #pragma omp for
             for (int i = 0; i < moves.size(); i++){
+                if (stopRequested(sink))
+                    continue; // an omp for can't break; the other moves are skipped as cheaply
                 MoveList::iterator iter = moves.begin();
                 for(int j = 0; j < i; j++)
                     iter++;
                 // if we have a forbidden pair, try the next move
-                if (forbiddenPairs.find(MovePair(old_move, iter->first)) != forbiddenPairs.end())
+                if (forbiddenPairs.find(MovePair(old_move, iter->first)) != forbiddenPairs.end()) {
+                    countEvent(localCounts, COUNT_FORBIDDEN);
                     continue;
+                }
                 // if this move breaks the blocks, try the next move
                 if (using_blocks)
-                    if (!blockLegal(state, blocks, iter->second.state))
+                    if (!blockLegal(state, blocks, iter->second.state)) {
+                        countEvent(localCounts, COUNT_BLOCKED);
                         continue;
+                    }
                 // if movelimits make this move impossible, try the next move
                 if (using_limits) {
                     bool forbidden = false;
@@ -77,7 +301,10 @@ static bool treeSolve(Position state, Position& solved, MoveList& moves, PieceTy
                             break;
                         }
                     }
-                    if (forbidden) continue;
+                    if (forbidden) {
+                        countEvent(localCounts, COUNT_LIMITED);
+                        continue;
+                    }
                 }
 
                 // compute depth of new position using HTM or QTM
@@ -88,9 +315,16 @@ static bool treeSolve(Position state, Position& solved, MoveList& moves, PieceTy
                     newDepth = depth - iter->second.qtm;
                 }
                 if (newDepth < 0) continue; // not enough depth for this move? try the next one
+                if (newDepth > 0 && !childBounds.empty() && childBounds[iter->first] > newDepth) {
+                    if (localCounts != NULL)
+                        localCounts->pruned++;
+                    countChildCut(localCounts, prunetables, childOrientations, iter->first, newDepth);
+                    continue;
+                }
 
                 // compute new position
                 applyMove(state, new_state, iter->second.state, datasets);
+                countEvent(localCounts, COUNT_GENERATED);
 
                 // decrement applicable move limits, and check if we got into an unsolvable state
                 if (using_limits) {
@@ -107,12 +341,17 @@ static bool treeSolve(Position state, Position& solved, MoveList& moves, PieceTy
                         for (unsigned int i=0; i<moveLimits.size(); i++)
                             if (limitMatches(localMoveLimits[i], iter->second))
                                 localMoveLimits[i].limit++;
+                        countEvent(localCounts, COUNT_LIMITED);
                         continue;
                     }
                 }
 
+                // rank the child from this position, unless it is a leaf
+                if (newDepth > 0)
+                    rankChild(state, ranks, new_state, iter->second, childOrientations, prunetables, childRanks);
+
                 // recurse!
-                if (treeSolve(new_state, solved, moves, datasets, prunetables, forbiddenPairs, ignore, blocks, newDepth, metric, localMoveLimits, sequence + " " + iter->second.name, iter->first, false))
+                if (treeSolve(new_state, childRanks, solved, moves, datasets, prunetables, forbiddenPairs, ignore, blocks, newDepth, metric, localMoveLimits, childSequence(sink, sequence, iter->second.name), iter->first, false, sink))
                     success = true;
 
                 // clean up modified move limits
@@ -123,8 +362,8 @@ static bool treeSolve(Position state, Position& solved, MoveList& moves, PieceTy
             }
             // free new_state memory
             for (int iter2=0; iter2<state.size(); iter2++) {
-                delete new_state[iter2].permutation;
-                delete new_state[iter2].orientation;
+                delete []new_state[iter2].permutation;
+                delete []new_state[iter2].orientation;
             }
         }
 	}
@@ -133,15 +372,20 @@ static bool treeSolve(Position state, Position& solved, MoveList& moves, PieceTy
         for (int iter2 = 0; iter2<state.size(); iter2++) {
             new_state[iter2] = newSubstate(state[iter2].size);
         }
+        positionRanks &childRanks = level.childRanks;
         MoveList::iterator iter = moves.begin();
-        for (iter = moves.begin(); iter != moves.end(); iter++){
+        for (iter = moves.begin(); iter != moves.end() && !stopRequested(sink); iter++){
             // if we have a forbidden pair, try the next move
-            if (forbiddenPairs.find(MovePair(old_move, iter->first)) != forbiddenPairs.end())
+            if (forbiddenPairs.find(MovePair(old_move, iter->first)) != forbiddenPairs.end()) {
+                countEvent(counts, COUNT_FORBIDDEN);
                 continue;
+            }
             // if this move breaks the blocks, try the next move
             if (using_blocks)
-                if (!blockLegal(state, blocks, iter->second.state))
+                if (!blockLegal(state, blocks, iter->second.state)) {
+                    countEvent(counts, COUNT_BLOCKED);
                     continue;
+                }
             // if movelimits make this move impossible, try the next move
             if (using_limits) {
                 bool forbidden = false;
@@ -151,7 +395,10 @@ static bool treeSolve(Position state, Position& solved, MoveList& moves, PieceTy
                         break;
                     }
                 }
-                if (forbidden) continue;
+                if (forbidden) {
+                    countEvent(counts, COUNT_LIMITED);
+                    continue;
+                }
             }
             // compute depth of new position using HTM or QTM
             int newDepth;
@@ -161,9 +408,16 @@ static bool treeSolve(Position state, Position& solved, MoveList& moves, PieceTy
                 newDepth = depth - iter->second.qtm;
             }
             if (newDepth < 0) continue; // not enough depth for this move? try the next one
+            if (newDepth > 0 && !childBounds.empty() && childBounds[iter->first] > newDepth) {
+                if (counts != NULL)
+                    counts->pruned++;
+                countChildCut(counts, prunetables, childOrientations, iter->first, newDepth);
+                continue;
+            }
 
             // compute new position
             applyMove(state, new_state, iter->second.state, datasets);
+            countEvent(counts, COUNT_GENERATED);
 
             // decrement applicable move limits, and check if we got into an unsolvable state
             if (using_limits) {
@@ -180,12 +434,17 @@ static bool treeSolve(Position state, Position& solved, MoveList& moves, PieceTy
                     for (unsigned int i=0; i<moveLimits.size(); i++)
                         if (limitMatches(moveLimits[i], iter->second))
                             moveLimits[i].limit++;
+                    countEvent(counts, COUNT_LIMITED);
                     continue;
                 }
             }
 
+            // rank the child from this position, unless it is a leaf
+            if (newDepth > 0)
+                rankChild(state, ranks, new_state, iter->second, childOrientations, prunetables, childRanks);
+
             // recurse!
-            if (treeSolve(new_state, solved, moves, datasets, prunetables, forbiddenPairs, ignore, blocks, newDepth, metric, moveLimits, sequence + " " + iter->second.name, iter->first, false))
+            if (treeSolve(new_state, childRanks, solved, moves, datasets, prunetables, forbiddenPairs, ignore, blocks, newDepth, metric, moveLimits, childSequence(sink, sequence, iter->second.name), iter->first, false, sink))
                 success = true;
 
             // clean up modified move limits
@@ -196,8 +455,8 @@ static bool treeSolve(Position state, Position& solved, MoveList& moves, PieceTy
         }
         // free new_state memory
         for (int iter2 = 0; iter2<state.size(); iter2++) {
-            delete new_state[iter2].permutation;
-            delete new_state[iter2].orientation;
+            delete []new_state[iter2].permutation;
+            delete []new_state[iter2].orientation;
         }
     }
 	return success;
@@ -228,11 +487,12 @@ static bool isSolved(Position& state1, Position& state2, Position& ignore, Piece
 
 // are these two positions exactly equal?
 static bool isEqual(Position& state1, Position& state2, PieceTypes& datasets){
+	const simdKernels &k = kernels();
 	for (int iter=0; iter<state1.size(); iter++) {
-		if (memcmp(state1[iter].permutation, state2[iter].permutation, state1[iter].size*sizeof(int)) != 0)
+		if (!k.equal(state1[iter].permutation, state2[iter].permutation, state1[iter].size))
 			return false;
 		if (datasets[iter].omod != 1)
-			if (memcmp(state1[iter].orientation, state2[iter].orientation, state1[iter].size*sizeof(int)) != 0)
+			if (!k.equal(state1[iter].orientation, state2[iter].orientation, state1[iter].size))
 				return false;
 	}
 	return true;
@@ -0,0 +1,333 @@
+/*
+ KSolve+ - Puzzle solving program.
+ Copyright (C) 2007-2013 Kre Krig and Michael Gottlieb
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+// A solver that stays running, so that the definition and pruning tables
+// are loaded once for many requests. It reads requests, one JSON object per
+// line, from stdin or from the clients of a Unix domain socket, solves them
+// on a pool of worker threads, and streams back JSON lines as it goes.
+
+#ifndef SERVER_H
+#define SERVER_H
+#ifndef __EMSCRIPTEN__
+
+// A client: where its requests come from and its answers go. The
+// descriptors are closed once it is gone and all its requests are answered.
+struct serverClient {
+	int in, out;
+	std::mutex writing;
+
+	serverClient(int in, int out) : in(in), out(out) {}
+	~serverClient() {
+		if (in > 2)
+			close(in);
+		if (out > 2 && out != in)
+			close(out);
+	}
+
+	// one line at a time, so that answers to different requests don't mix
+	void send(const string &line) {
+		std::lock_guard<std::mutex> lock(writing);
+		string text = line + "\n";
+		for (std::size_t at = 0; at < text.size(); ) {
+			ssize_t n = write(out, text.data() + at, text.size() - at);
+			if (n <= 0)
+				return; // the client is gone; its requests still finish
+			at += n;
+		}
+	}
+};
+
+struct serverRequest {
+	string id; // as the client wrote it, in JSON
+	std::map<string, string> fields;
+	std::shared_ptr<serverClient> client;
+	std::atomic<bool> cancelled;
+	std::atomic<bool> stop; // cancelled, or enough solutions found
+	long long found;
+};
+
+// Requests waiting for a worker, and those a cancel can still reach
+struct serverQueue {
+	std::mutex lock;
+	std::condition_variable ready;
+	std::deque<std::shared_ptr<serverRequest> > waiting;
+	std::map<std::pair<serverClient *, string>, std::shared_ptr<serverRequest> > open;
+	bool closing;
+};
+
+// Read a flat JSON object: each value as text (strings unescaped), and
+// as the JSON it was written in. False if the line is not such an object.
+static bool parseJsonObject(const string &line, std::map<string, string> &values, std::map<string, string> &raw) {
+	unsigned int at = 0;
+	auto skipSpace = [&]() {
+		while (at < line.size() && isspace((unsigned char)line[at]))
+			at++;
+	};
+	skipSpace();
+	if (at >= line.size() || line[at++] != '{')
+		return false;
+	for (;;) {
+		string parsed[2]; // key, value
+		for (int part = 0; part < 2; part++) {
+			skipSpace();
+			if (part == 0 && at < line.size() && line[at] == '}' && values.empty()) {
+				at++;
+				return true;
+			}
+			unsigned int start = at;
+			if (at < line.size() && line[at] == '"') {
+				at++;
+				while (at < line.size() && line[at] != '"') {
+					char c = line[at++];
+					if (c == '\\' && at < line.size()) {
+						c = line[at++];
+						if (c == 'n') c = '\n';
+						else if (c == 't') c = '\t';
+						else if (c == 'r') c = '\r';
+						else if (c == 'u' && at + 4 <= line.size()) {
+							c = (char)strtol(line.substr(at, 4).c_str(), NULL, 16); // only the characters of scramble files matter
+							at += 4;
+						}
+					}
+					parsed[part] += c;
+				}
+				if (at++ >= line.size())
+					return false;
+			} else if (part == 1) {
+				while (at < line.size() && line[at] != ',' && line[at] != '}' && !isspace((unsigned char)line[at]))
+					parsed[part] += line[at++];
+				if (parsed[part].empty())
+					return false;
+			} else {
+				return false;
+			}
+			if (part == 1)
+				raw[parsed[0]] = line.substr(start, at - start);
+			skipSpace();
+			if (part == 0 && (at >= line.size() || line[at++] != ':'))
+				return false;
+		}
+		values[parsed[0]] = parsed[1];
+		if (at < line.size() && line[at] == ',') {
+			at++;
+			continue;
+		}
+		return at < line.size() && line[at] == '}';
+	}
+}
+
+// Each solution as it is found
+static void serverFound(void *context, const string &solution) {
+	std::pair<serverRequest *, string *> &where = *(std::pair<serverRequest *, string *> *)context;
+	serverRequest &request = *where.first;
+	size_t first = solution.find_first_not_of(' ');
+	request.client->send("{\"id\":" + request.id + ",\"scramble\":" + jsonString(*where.second)
+		+ ",\"solution\":" + jsonString(first == string::npos ? "" : solution.substr(first)) + "}");
+	request.found++;
+}
+
+// The last answer to a request that could not be solved
+static void sendError(serverRequest &request, const string &error) {
+	request.client->send("{\"id\":" + request.id + ",\"done\":true,\"status\":\"error\",\"error\":" + jsonString(error) + "}");
+}
+
+// Solve the scrambles of one request, as ksolveWrapped does but on one thread
+static void serverSolve(loadedPuzzle &puzzle, serverRequest &request) {
+	std::map<string, string> &fields = request.fields;
+	if (fields.count("def") && fields["def"] != puzzle.defFileName) {
+		sendError(request, "this server solves " + puzzle.defFileName);
+		return;
+	}
+	string name = fields.count("name") ? fields["name"] : "scramble";
+	string text;
+	if (fields.count("scramble"))
+		text = fields["scramble"];
+	else if (fields.count("state"))
+		text = "Scramble " + name + "\n" + fields["state"] + "\nEnd\n";
+	else if (fields.count("alg"))
+		text = "ScrambleAlg " + name + "\n" + fields["alg"] + "\nEnd\n";
+	else {
+		sendError(request, "no scramble, state or alg");
+		return;
+	}
+	puzzleScope scope(puzzle, false);
+	std::istringstream scrambleStream(text);
+	Scramble states(scrambleStream, puzzle.solved, puzzle.moves, puzzle.datasets, puzzle.blocks, *puzzle.options);
+
+	// a mistake in the scramble ends the request, with what was solved before it
+	ScrambleDef scramble;
+	try {
+		scramble = states.getScramble();
+	} catch (inputError &error) {
+		sendError(request, error.what());
+		return;
+	}
+	while (scramble.state.size() != 0 && !request.cancelled) {
+		if (fields.count("max_depth"))
+			scramble.max_depth = atoi(fields["max_depth"].c_str());
+		if (fields.count("slack"))
+			scramble.slack = atoi(fields["slack"].c_str());
+		if (fields.count("metric"))
+			scramble.metric = (fields["metric"] == "qtm" || fields["metric"] == "QTM") ? 1 : 0;
+		if (fields.count("max_solutions"))
+			scramble.max_solutions = atoll(fields["max_solutions"].c_str());
+		request.found = 0;
+		request.stop = request.cancelled.load();
+
+		std::pair<serverRequest *, string *> context(&request, &scramble.name);
+		solutionSink sink(serverFound, &context);
+		sink.stop = &request.stop;
+		int length = solveScramble(puzzle, scramble, sink);
+		request.client->send("{\"id\":" + request.id + ",\"scramble\":" + jsonString(scramble.name)
+			+ ",\"length\":" + (length < 0 ? string("null") : std::to_string(length))
+			+ ",\"solutions\":" + std::to_string(request.found) + "}");
+
+		freeScramble(scramble);
+		try {
+			scramble = states.getScramble();
+		} catch (inputError &error) {
+			sendError(request, error.what());
+			return;
+		}
+	}
+	freeScramble(scramble);
+	request.client->send("{\"id\":" + request.id + ",\"done\":true,\"status\":"
+		+ (request.cancelled ? "\"cancelled\"" : "\"ok\"") + "}");
+}
+
+// A worker: take requests until the queue is closed and empty
+static void serverWork(loadedPuzzle &puzzle, serverQueue &queue) {
+	for (;;) {
+		std::unique_lock<std::mutex> lock(queue.lock);
+		queue.ready.wait(lock, [&queue] { return !queue.waiting.empty() || queue.closing; });
+		if (queue.waiting.empty())
+			return;
+		std::shared_ptr<serverRequest> request = queue.waiting.front();
+		queue.waiting.pop_front();
+		lock.unlock();
+
+		serverSolve(puzzle, *request);
+
+		lock.lock();
+		std::pair<serverClient *, string> key(request->client.get(), request->id);
+		if (queue.open.count(key) && queue.open[key] == request)
+			queue.open.erase(key);
+	}
+}
+
+// Read a client's requests, a line each, into the queue
+static void serverRead(std::shared_ptr<serverClient> client, serverQueue &queue) {
+	string pending;
+	char buffer[65536];
+	for (;;) {
+		size_t newline = pending.find('\n');
+		if (newline == string::npos) {
+			ssize_t n = read(client->in, buffer, sizeof(buffer));
+			if (n <= 0)
+				break;
+			pending.append(buffer, n);
+			continue;
+		}
+		string line = pending.substr(0, newline);
+		pending.erase(0, newline + 1);
+		if (line.find_first_not_of(" \t\r") == string::npos)
+			continue;
+
+		std::map<string, string> values, raw;
+		if (!parseJsonObject(line, values, raw)) {
+			client->send("{\"status\":\"error\",\"error\":" + jsonString("not a JSON object: " + line) + "}");
+			continue;
+		}
+		std::lock_guard<std::mutex> lock(queue.lock);
+		if (raw.count("cancel")) {
+			std::pair<serverClient *, string> key(client.get(), raw["cancel"]);
+			if (queue.open.count(key)) {
+				queue.open[key]->cancelled = true;
+				queue.open[key]->stop = true;
+			}
+			continue;
+		}
+		std::shared_ptr<serverRequest> request(new serverRequest);
+		request->id = raw.count("id") ? raw["id"] : "null";
+		request->fields = values;
+		request->client = client;
+		request->cancelled = false;
+		request->stop = false;
+		std::pair<serverClient *, string> key(client.get(), request->id);
+		if (queue.open.count(key)) { // not "done", as the request with this id goes on
+			client->send("{\"id\":" + request->id + ",\"status\":\"error\",\"error\":" + jsonString("id already in use") + "}");
+			continue;
+		}
+		queue.open[key] = request;
+		queue.waiting.push_back(request);
+		queue.ready.notify_one();
+	}
+}
+
+// Serve requests from stdin until it ends, or from the clients of a socket
+// at socketPath for as long as ksolve runs. Only the one puzzle is served. ksolveWrapped sends everything
+// else printed to stderr, so that stdout has only answers.
+static void serveRequests(loadedPuzzle &puzzle, const string &socketPath, int workers) {
+	serverQueue queue;
+	queue.closing = false;
+	signal(SIGPIPE, SIG_IGN); // a client that is gone shows up as a failed write instead
+	if (workers <= 0)
+		workers = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<std::thread> pool;
+	for (int w = 0; w < workers; w++)
+		pool.push_back(std::thread(serverWork, std::ref(puzzle), std::ref(queue)));
+
+	if (socketPath.empty()) {
+		std::cerr << "Serving " << puzzle.defFileName << " on stdin with " << workers << " workers.\n";
+		serverRead(std::shared_ptr<serverClient>(new serverClient(0, 1)), queue);
+	} else {
+		int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+		struct sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if (socketPath.size() >= sizeof(address.sun_path)) {
+			std::cerr << "Socket path " << socketPath << " is too long.\n";
+			exit(-1);
+		}
+		strcpy(address.sun_path, socketPath.c_str());
+		unlink(socketPath.c_str());
+		if (listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 16) != 0) {
+			std::cerr << "Can't listen on socket " << socketPath << ".\n";
+			exit(-1);
+		}
+		std::cerr << "Serving " << puzzle.defFileName << " on " << socketPath << " with " << workers << " workers.\n";
+		for (;;) {
+			int connection = accept(listener, NULL, NULL);
+			if (connection < 0)
+				continue;
+			std::thread(serverRead, std::shared_ptr<serverClient>(new serverClient(connection, connection)), std::ref(queue)).detach();
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(queue.lock);
+		queue.closing = true;
+	}
+	queue.ready.notify_all();
+	for (int w = 0; w < workers; w++)
+		pool[w].join();
+}
+
+#endif
+#endif
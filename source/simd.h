@@ -0,0 +1,292 @@
+/*
+ KSolve+ - Puzzle solving program.
+ Copyright (C) 2007-2013 Kre Krig and Michael Gottlieb
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+// Vectorised kernels for applying moves, comparing sets and ranking the
+// orientations of all children of a position. The instruction set is picked
+// at runtime from the CPU, so one binary runs on any x86-64 machine; other
+// compilers and the Javascript build only get the scalar versions.
+// Pieces and orientations are ints: AVX2 permutes up to 8 pieces with one
+// shuffle and AVX-512 up to 32 with one or two, larger sets use gathers.
+// Orientation ranks are ints, which is enough for complete orientation tables.
+// The vector versions expect orientations already reduced mod omod.
+
+#ifndef SIMD_H
+#define SIMD_H
+
+struct simdKernels {
+	const char *name;
+	// pout[i] = p[mp[i]-1], oout[i] = (o[mp[i]-1] + mo[mp[i]-1]) % omod
+	void (*applySubmove)(int *pout, int *oout, const int *p, const int *o, const int *mp, const int *mo, int size, int omod);
+	// are the first size ints of a and b equal?
+	bool (*equal)(const int *a, const int *b, int size);
+	// ranks[m] = orientation index of o after move m, for every move of children
+	void (*rankChildOrientations)(const int *o, const childMoves &children, int *ranks);
+};
+
+static void applySubmoveScalar(int *pout, int *oout, const int *p, const int *o, const int *mp, const int *mo, int size, int omod) {
+	if (omod == 1) {
+		for (int i = 0; i < size; i++) {
+			oout[i] = 0;
+			pout[i] = p[mp[i] - 1];
+		}
+	} else {
+		for (int i = 0; i < size; i++) {
+			int permuted = mp[i] - 1;
+			oout[i] = (o[permuted] + mo[permuted]) % omod;
+			pout[i] = p[permuted];
+		}
+	}
+}
+
+static bool equalScalar(const int *a, const int *b, int size) {
+	return memcmp(a, b, size*sizeof(int)) == 0;
+}
+
+static void rankChildOrientationsScalar(const int *o, const childMoves &children, int *ranks) {
+	int size = children.size;
+	for (int m = 0; m < children.nmoves; m++) {
+		const int *from = &children.from[m*size];
+		const int *twist = &children.twist[m*size];
+		int rank = 0;
+		for (int i = 0; i < size; i++)
+			rank = rank*children.omod + (o[from[i]] + twist[i]) % children.omod;
+		ranks[m] = rank;
+	}
+}
+
+#ifdef KSOLVE_X86_KERNELS
+
+__attribute__((target("avx2")))
+static __m256i tailMask8(int n) {
+	return _mm256_cmpgt_epi32(_mm256_set1_epi32(n), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+// subtract omod from the lanes that reached it
+__attribute__((target("avx2")))
+static __m256i reduce8(__m256i x, __m256i omod) {
+	return _mm256_sub_epi32(x, _mm256_andnot_si256(_mm256_cmpgt_epi32(omod, x), omod));
+}
+
+__attribute__((target("avx2")))
+static void applySubmoveAVX2(int *pout, int *oout, const int *p, const int *o, const int *mp, const int *mo, int size, int omod) {
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i mod = _mm256_set1_epi32(omod);
+	const __m256i zero = _mm256_setzero_si256();
+	if (size <= 8) {
+		__m256i mask = tailMask8(size);
+		__m256i idx = _mm256_sub_epi32(_mm256_maskload_epi32(mp, mask), one);
+		_mm256_maskstore_epi32(pout, mask, _mm256_permutevar8x32_epi32(_mm256_maskload_epi32(p, mask), idx));
+		__m256i ori = zero;
+		if (omod != 1) {
+			ori = _mm256_add_epi32(_mm256_maskload_epi32(o, mask), _mm256_maskload_epi32(mo, mask));
+			ori = reduce8(_mm256_permutevar8x32_epi32(ori, idx), mod);
+		}
+		_mm256_maskstore_epi32(oout, mask, ori);
+		return;
+	}
+	for (int i = 0; i < size; i += 8) {
+		__m256i mask = tailMask8(size - i);
+		__m256i idx = _mm256_sub_epi32(_mm256_maskload_epi32(mp + i, mask), one);
+		_mm256_maskstore_epi32(pout + i, mask, _mm256_mask_i32gather_epi32(zero, p, idx, mask, 4));
+		__m256i ori = zero;
+		if (omod != 1) {
+			ori = _mm256_add_epi32(_mm256_mask_i32gather_epi32(zero, o, idx, mask, 4),
+				_mm256_mask_i32gather_epi32(zero, mo, idx, mask, 4));
+			ori = reduce8(ori, mod);
+		}
+		_mm256_maskstore_epi32(oout + i, mask, ori);
+	}
+}
+
+__attribute__((target("avx2")))
+static bool equalAVX2(const int *a, const int *b, int size) {
+	for (int i = 0; i < size; i += 8) {
+		__m256i mask = tailMask8(size - i);
+		__m256i eq = _mm256_cmpeq_epi32(_mm256_maskload_epi32(a + i, mask), _mm256_maskload_epi32(b + i, mask));
+		if (_mm256_movemask_epi8(eq) != -1)
+			return false;
+	}
+	return true;
+}
+
+__attribute__((target("avx2")))
+static void rankChildOrientationsAVX2(const int *o, const childMoves &children, int *ranks) {
+	int size = children.size;
+	const __m256i mod = _mm256_set1_epi32(children.omod);
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i low = _mm256_maskload_epi32(o, tailMask8(size));
+	for (int m = 0; m < children.nmoves; m++) {
+		const int *from = &children.from[m*size];
+		const int *twist = &children.twist[m*size];
+		__m256i sum = zero;
+		for (int i = 0; i < size; i += 8) {
+			__m256i mask = tailMask8(size - i);
+			__m256i idx = _mm256_maskload_epi32(from + i, mask);
+			__m256i ori = (size <= 8) ? _mm256_permutevar8x32_epi32(low, idx) : _mm256_mask_i32gather_epi32(zero, o, idx, mask, 4);
+			ori = reduce8(_mm256_add_epi32(ori, _mm256_maskload_epi32(twist + i, mask)), mod);
+			sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(ori, _mm256_maskload_epi32(&children.weight[i], mask)));
+		}
+		__m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+		half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4e));
+		half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xb1));
+		ranks[m] = _mm_cvtsi128_si32(half);
+	}
+}
+
+__attribute__((target("avx512f")))
+static __mmask16 tailMask16(int n) {
+	if (n <= 0)
+		return 0;
+	return (n >= 16) ? (__mmask16) 0xffff : (__mmask16) ((1u << n) - 1);
+}
+
+// pick the lanes idx (0-based) from p, with p holding up to 32 ints; the
+// zero-masked permute, as the plain one starts from an undefined register
+// that -Wall warns about
+__attribute__((target("avx512f")))
+static __m512i permute32(__m512i low, __m512i high, __m512i idx, int size) {
+	return (size <= 16) ? _mm512_maskz_permutexvar_epi32((__mmask16) 0xffff, idx, low) : _mm512_permutex2var_epi32(low, idx, high);
+}
+
+// the sum of all lanes, without _mm512_reduce_add_epi32 for the same reason
+__attribute__((target("avx512f")))
+static int addLanes(__m512i v) {
+	__m256i half = _mm256_add_epi32(_mm512_maskz_extracti64x4_epi64((__mmask8) 0xff, v, 0),
+		_mm512_maskz_extracti64x4_epi64((__mmask8) 0xff, v, 1));
+	__m128i quarter = _mm_add_epi32(_mm256_castsi256_si128(half), _mm256_extracti128_si256(half, 1));
+	quarter = _mm_add_epi32(quarter, _mm_shuffle_epi32(quarter, 0x4e));
+	quarter = _mm_add_epi32(quarter, _mm_shuffle_epi32(quarter, 0xb1));
+	return _mm_cvtsi128_si32(quarter);
+}
+
+__attribute__((target("avx512f")))
+static void applySubmoveAVX512(int *pout, int *oout, const int *p, const int *o, const int *mp, const int *mo, int size, int omod) {
+	const __m512i one = _mm512_set1_epi32(1);
+	const __m512i mod = _mm512_set1_epi32(omod);
+	const __m512i zero = _mm512_setzero_si512();
+	if (size <= 8) { // one AVX2 shuffle is quicker
+		applySubmoveAVX2(pout, oout, p, o, mp, mo, size, omod);
+		return;
+	}
+	if (size <= 32) {
+		__mmask16 lowMask = tailMask16(size);
+		__mmask16 highMask = tailMask16(size - 16);
+		__m512i pLow = _mm512_maskz_loadu_epi32(lowMask, p);
+		__m512i pHigh = _mm512_maskz_loadu_epi32(highMask, p + 16);
+		__m512i oLow = zero, oHigh = zero;
+		if (omod != 1) {
+			oLow = _mm512_add_epi32(_mm512_maskz_loadu_epi32(lowMask, o), _mm512_maskz_loadu_epi32(lowMask, mo));
+			oHigh = _mm512_add_epi32(_mm512_maskz_loadu_epi32(highMask, o + 16), _mm512_maskz_loadu_epi32(highMask, mo + 16));
+		}
+		for (int i = 0; i < size; i += 16) {
+			__mmask16 mask = tailMask16(size - i);
+			__m512i idx = _mm512_sub_epi32(_mm512_maskz_loadu_epi32(mask, mp + i), one);
+			_mm512_mask_storeu_epi32(pout + i, mask, permute32(pLow, pHigh, idx, size));
+			__m512i ori = zero;
+			if (omod != 1) {
+				ori = permute32(oLow, oHigh, idx, size);
+				ori = _mm512_mask_sub_epi32(ori, _mm512_cmpge_epi32_mask(ori, mod), ori, mod);
+			}
+			_mm512_mask_storeu_epi32(oout + i, mask, ori);
+		}
+		return;
+	}
+	for (int i = 0; i < size; i += 16) {
+		__mmask16 mask = tailMask16(size - i);
+		__m512i idx = _mm512_sub_epi32(_mm512_maskz_loadu_epi32(mask, mp + i), one);
+		_mm512_mask_storeu_epi32(pout + i, mask, _mm512_mask_i32gather_epi32(zero, mask, idx, p, 4));
+		__m512i ori = zero;
+		if (omod != 1) {
+			ori = _mm512_add_epi32(_mm512_mask_i32gather_epi32(zero, mask, idx, o, 4),
+				_mm512_mask_i32gather_epi32(zero, mask, idx, mo, 4));
+			ori = _mm512_mask_sub_epi32(ori, _mm512_cmpge_epi32_mask(ori, mod), ori, mod);
+		}
+		_mm512_mask_storeu_epi32(oout + i, mask, ori);
+	}
+}
+
+__attribute__((target("avx512f")))
+static bool equalAVX512(const int *a, const int *b, int size) {
+	for (int i = 0; i < size; i += 16) {
+		__mmask16 mask = tailMask16(size - i);
+		if (_mm512_mask_cmpneq_epi32_mask(mask, _mm512_maskz_loadu_epi32(mask, a + i), _mm512_maskz_loadu_epi32(mask, b + i)) != 0)
+			return false;
+	}
+	return true;
+}
+
+__attribute__((target("avx512f")))
+static void rankChildOrientationsAVX512(const int *o, const childMoves &children, int *ranks) {
+	int size = children.size;
+	if (size <= 8) {
+		rankChildOrientationsAVX2(o, children, ranks);
+		return;
+	}
+	const __m512i mod = _mm512_set1_epi32(children.omod);
+	const __m512i zero = _mm512_setzero_si512();
+	__m512i oLow = _mm512_maskz_loadu_epi32(tailMask16(size), o);
+	__m512i oHigh = _mm512_maskz_loadu_epi32(tailMask16(size - 16), o + 16);
+	for (int m = 0; m < children.nmoves; m++) {
+		const int *from = &children.from[m*size];
+		const int *twist = &children.twist[m*size];
+		__m512i sum = zero;
+		for (int i = 0; i < size; i += 16) {
+			__mmask16 mask = tailMask16(size - i);
+			__m512i idx = _mm512_maskz_loadu_epi32(mask, from + i);
+			__m512i ori = (size <= 32) ? permute32(oLow, oHigh, idx, size) : _mm512_mask_i32gather_epi32(zero, mask, idx, o, 4);
+			ori = _mm512_add_epi32(ori, _mm512_maskz_loadu_epi32(mask, twist + i));
+			ori = _mm512_mask_sub_epi32(ori, _mm512_cmpge_epi32_mask(ori, mod), ori, mod);
+			sum = _mm512_add_epi32(sum, _mm512_mullo_epi32(ori, _mm512_maskz_loadu_epi32(mask, &children.weight[i])));
+		}
+		ranks[m] = addLanes(sum);
+	}
+}
+
+#endif
+
+// The kernels for this CPU, chosen on first use
+static simdKernels chooseKernels() {
+	simdKernels k;
+	k.name = "scalar";
+	k.applySubmove = applySubmoveScalar;
+	k.equal = equalScalar;
+	k.rankChildOrientations = rankChildOrientationsScalar;
+#ifdef KSOLVE_X86_KERNELS
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		k.name = "AVX-512";
+		k.applySubmove = applySubmoveAVX512;
+		k.equal = equalAVX512;
+		k.rankChildOrientations = rankChildOrientationsAVX512;
+	} else if (__builtin_cpu_supports("avx2")) {
+		k.name = "AVX2";
+		k.applySubmove = applySubmoveAVX2;
+		k.equal = equalAVX2;
+		k.rankChildOrientations = rankChildOrientationsAVX2;
+	}
+#endif
+	return k;
+}
+
+static const simdKernels &kernels() {
+	static const simdKernels k = chooseKernels();
+	return k;
+}
+
+#endif
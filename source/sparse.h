@@ -0,0 +1,399 @@
+/*
+ KSolve+ - Puzzle solving program.
+ Copyright (C) 2007-2013 Kre Krig and Michael Gottlieb
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+// God's Algorithm tables for puzzles that reach only a small part of their
+// index, like bandaged ones. The positions of each depth are kept in memory
+// as sorted keys, and when the table is done a minimal perfect hash of the
+// keys numbers the positions, for an array of their distances.
+
+#ifndef SPARSE_H
+#define SPARSE_H
+
+// Sort positions of width words and drop duplicates
+static void sortRecords(std::vector<unsigned long long> &records, int width) {
+	if (width == 1) {
+		std::sort(records.begin(), records.end());
+		records.erase(std::unique(records.begin(), records.end()), records.end());
+		return;
+	}
+	long long n = records.size() / width;
+	if (n == 0)
+		return;
+	std::vector<long long> order(n);
+	for (long long i = 0; i < n; i++)
+		order[i] = i;
+	recordLess less = {&records[0], width};
+	std::sort(order.begin(), order.end(), less);
+	std::vector<unsigned long long> sorted;
+	sorted.reserve(records.size());
+	for (long long i = 0; i < n; i++)
+		if (i == 0 || compareRecords(&records[order[i]*width], &records[order[i-1]*width], width) != 0)
+			sorted.insert(sorted.end(), records.begin() + order[i]*width, records.begin() + (order[i] + 1)*width);
+	records.swap(sorted);
+}
+
+// Remove from sorted positions those also in the sorted positions of other
+static void subtractRecords(std::vector<unsigned long long> &records, const std::vector<unsigned long long> &other, int width) {
+	std::size_t kept = 0, j = 0;
+	for (std::size_t i = 0; i < records.size(); i += width) {
+		while (j < other.size() && compareRecords(&other[j], &records[i], width) < 0)
+			j += width;
+		if (j < other.size() && compareRecords(&other[j], &records[i], width) == 0)
+			continue;
+		std::copy(records.begin() + i, records.begin() + i + width, records.begin() + kept);
+		kept += width;
+	}
+	records.resize(kept);
+}
+
+// A minimal perfect hash of a set of positions, by hash and displace: keys
+// go into buckets of about four, and each bucket, largest first, gets the
+// first displacement that sends all of its keys to free slots. There are a
+// quarter more slots than keys, and counting the slots in use before a
+// key's slot numbers the keys from 0 to keys-1. Positions not in the set
+// get the number of some position that is, so the keys are kept by their
+// numbers too, and find checks a position against its key.
+struct perfectHash {
+	int width;
+	unsigned long long seed;
+	long long keys, slots;
+	std::vector<unsigned int> displacement; // for each bucket
+	std::vector<unsigned long long> used; // a bit for each slot
+	std::vector<long long> before; // slots used before each word of used
+	std::vector<unsigned long long> stored; // the key numbered k at k*width
+
+	static inline unsigned long long mix(unsigned long long x) {
+		x ^= x >> 30;
+		x *= 0xbf58476d1ce4e5b9ULL;
+		x ^= x >> 27;
+		x *= 0x94d049bb133111ebULL;
+		return x ^ (x >> 31);
+	}
+
+	unsigned long long keyHash(const unsigned long long *key) const {
+		unsigned long long h = seed;
+		for (int i = 0; i < width; i++)
+			h = mix(h ^ key[i]);
+		return h;
+	}
+
+	long long slot(unsigned long long h, unsigned int d) const {
+		return mix(h + d * 0x9e3779b97f4a7c15ULL) % slots;
+	}
+
+	long long index(const unsigned long long *key) const {
+		unsigned long long h = keyHash(key);
+		long long s = slot(h, displacement[h % displacement.size()]);
+		return before[s >> 6] + __builtin_popcountll(used[s >> 6] & ((1ULL << (s & 63)) - 1));
+	}
+
+	// The number of a key, or -1 if it is not one of the keys
+	long long find(const unsigned long long *key) const {
+		long long k = index(key);
+		return std::equal(key, key + width, &stored[k * width]) ? k : -1;
+	}
+
+	// Build the hash of all positions in the sorted levels
+	void build(const std::vector<std::vector<unsigned long long> > &levels, int recordWidth) {
+		width = recordWidth;
+		keys = 0;
+		for (unsigned int d = 0; d < levels.size(); d++)
+			keys += levels[d].size() / width;
+		slots = keys + keys / 4 + 1;
+		long long buckets = keys / 4 + 1;
+		for (seed = 0; ; seed++) {
+			std::vector<unsigned long long> hashes;
+			hashes.reserve(keys);
+			for (unsigned int d = 0; d < levels.size(); d++)
+				for (std::size_t i = 0; i < levels[d].size(); i += width)
+					hashes.push_back(keyHash(&levels[d][i]));
+
+			// the keys of each bucket, and the buckets from largest to smallest
+			std::vector<long long> start(buckets + 1, 0), members(keys);
+			for (long long k = 0; k < keys; k++)
+				start[hashes[k] % buckets + 1]++;
+			for (long long b = 0; b < buckets; b++)
+				start[b + 1] += start[b];
+			std::vector<long long> fill(start.begin(), start.end() - 1);
+			for (long long k = 0; k < keys; k++)
+				members[fill[hashes[k] % buckets]++] = k;
+			std::vector<std::pair<long long, long long> > order(buckets);
+			for (long long b = 0; b < buckets; b++)
+				order[b] = std::make_pair(start[b] - start[b + 1], b);
+			std::sort(order.begin(), order.end());
+
+			displacement.assign(buckets, 0);
+			used.assign(slots / 64 + 1, 0);
+			bool placed = true;
+			std::vector<long long> trial;
+			for (long long o = 0; o < buckets && placed && order[o].first < 0; o++) {
+				long long b = order[o].second;
+				placed = false;
+				// keys with the same hash can never be separated, so give up
+				// on this seed after a while
+				for (unsigned int d = 0; d < (1U << 20) && !placed; d++) {
+					trial.clear();
+					bool free = true;
+					for (long long m = start[b]; m < start[b + 1] && free; m++) {
+						long long s = slot(hashes[members[m]], d);
+						if ((used[s >> 6] >> (s & 63)) & 1 || std::find(trial.begin(), trial.end(), s) != trial.end())
+							free = false;
+						trial.push_back(s);
+					}
+					if (!free)
+						continue;
+					for (unsigned int t = 0; t < trial.size(); t++)
+						used[trial[t] >> 6] |= 1ULL << (trial[t] & 63);
+					displacement[b] = d;
+					placed = true;
+				}
+			}
+			if (placed)
+				break;
+		}
+		before.assign(used.size(), 0);
+		for (std::size_t w = 1; w < used.size(); w++)
+			before[w] = before[w - 1] + __builtin_popcountll(used[w - 1]);
+		stored.resize(keys * width);
+		for (unsigned int d = 0; d < levels.size(); d++)
+			for (std::size_t i = 0; i < levels[d].size(); i += width)
+				std::copy(&levels[d][i], &levels[d][i] + width, &stored[index(&levels[d][i]) * width]);
+	}
+
+	void write(std::ostream &out) const {
+		out.write((const char *)&displacement[0], displacement.size() * sizeof(unsigned int));
+		out.write((const char *)&used[0], used.size() * sizeof(unsigned long long));
+		out.write((const char *)&before[0], before.size() * sizeof(long long));
+		out.write((const char *)&stored[0], stored.size() * sizeof(unsigned long long));
+	}
+
+	// Read a hash written by write, given its header fields
+	bool read(std::istream &in) {
+		displacement.resize(keys / 4 + 1);
+		used.resize(slots / 64 + 1);
+		before.resize(used.size());
+		stored.resize(keys * width);
+		in.read((char *)&displacement[0], displacement.size() * sizeof(unsigned int));
+		in.read((char *)&used[0], used.size() * sizeof(unsigned long long));
+		in.read((char *)&before[0], before.size() * sizeof(long long));
+		in.read((char *)&stored[0], stored.size() * sizeof(unsigned long long));
+		return !in.fail();
+	}
+
+	long long bytes() const {
+		return displacement.size() * sizeof(unsigned int) + used.size() * sizeof(unsigned long long) + before.size() * sizeof(long long)
+			+ stored.size() * sizeof(unsigned long long);
+	}
+};
+
+// Breadth-first God's Algorithm enumeration with the positions of each
+// depth in memory, sorted. Positions found for a depth are gathered in an
+// unsorted buffer, then sorted and stripped of those found at earlier
+// depths (at most 2*maxQTM earlier) once the depth before is done.
+struct sparseBFS {
+	Position &solved;
+	MoveList &moves;
+	PieceTypes &datasets;
+	std::vector<Block> &blocks;
+	std::map<std::pair<int, int>, long long> &subSizes;
+	int metric;
+	bool ranked; // one word per position, the index used by the array; otherwise packPosition2
+	int width;
+	int maxQTM;
+	long long maxmem; // bytes the positions may take (-M)
+	std::vector<std::vector<unsigned long long> > levels; // the sorted positions of each depth
+	std::map<int, std::vector<unsigned long long> > pending; // positions found for later depths
+
+	sparseBFS(Position &solved, MoveList &moves, PieceTypes &datasets, std::vector<Block> &blocks,
+			std::map<std::pair<int, int>, long long> &subSizes, int metric, bool ranked, long long maxmem)
+		: solved(solved), moves(moves), datasets(datasets), blocks(blocks), subSizes(subSizes), metric(metric), ranked(ranked), maxmem(maxmem) {
+		width = ranked ? 1 : packPosition2(solved, datasets, 0).size();
+		maxQTM = 1;
+		for (MoveList::iterator m = moves.begin(); m != moves.end(); m++)
+			if (metric == 1 && m->second.qtm > maxQTM)
+				maxQTM = m->second.qtm;
+	}
+
+	void pack(Position &position, unsigned long long *record) {
+		if (ranked) {
+			record[0] = packPosition(position, subSizes, datasets);
+		} else {
+			std::vector<long long> packed = packPosition2(position, datasets, width);
+			for (int i = 0; i < width; i++)
+				record[i] = packed[i];
+		}
+	}
+
+	void unpack(const unsigned long long *record, Position &position) {
+		if (ranked) {
+			unpackPosition(position, record[0], subSizes, datasets, solved);
+		} else {
+			std::vector<long long> packed(record, record + width);
+			unpackPosition2(position, packed, datasets);
+		}
+	}
+
+	// Memory used by the positions so far
+	long long bytes() {
+		long long words = 0;
+		for (unsigned int d = 0; d < levels.size(); d++)
+			words += levels[d].size();
+		std::map<int, std::vector<unsigned long long> >::iterator iter;
+		for (iter = pending.begin(); iter != pending.end(); iter++)
+			words += iter->second.size();
+		return words * sizeof(unsigned long long);
+	}
+
+	void checkMemory() {
+		if (bytes() > maxmem) {
+			std::cerr << "Out of memory for the positions; give a scratch directory with -T to keep them on disk.\n";
+			exit(-1);
+		}
+	}
+
+	// The level of depth 0 holds only the solved position
+	void start() {
+		levels.assign(1, std::vector<unsigned long long>(width));
+		pack(solved, &levels[0][0]);
+	}
+
+	// Apply every move to every position of this depth, gathering the
+	// results by the depth they would have
+	void expand(int depth) {
+		bool using_blocks = blocks.size() != 0;
+		std::size_t compactAt = 1 << 20; // words gathered before duplicates are dropped
+		std::size_t gathered = 0;
+		std::vector<unsigned long long> record(width);
+		Position from(solved.size()), to(solved.size());
+		for (int iter = 0; iter < solved.size(); iter++) {
+			from[iter] = newSubstate(solved[iter].size);
+			to[iter] = newSubstate(solved[iter].size);
+		}
+
+		std::vector<unsigned long long> &level = levels[depth];
+		for (std::size_t i = 0; i < level.size(); i += width) {
+			unpack(&level[i], from);
+			MoveList::iterator moveIter;
+			for (moveIter = moves.begin(); moveIter != moves.end(); moveIter++) {
+				if (using_blocks) // see if the blocks will prevent this move
+					if (!blockLegal(from, blocks, moveIter->second.state))
+						continue;
+				applyMove(from, to, moveIter->second.state, datasets);
+				pack(to, &record[0]);
+				std::vector<unsigned long long> &buffer = pending[depth + (metric == 0 ? 1 : moveIter->second.qtm)];
+				buffer.insert(buffer.end(), record.begin(), record.end());
+				gathered += width;
+			}
+			if (gathered > compactAt) {
+				gathered = 0;
+				std::map<int, std::vector<unsigned long long> >::iterator iter;
+				for (iter = pending.begin(); iter != pending.end(); iter++) {
+					sortRecords(iter->second, width);
+					gathered += iter->second.size();
+				}
+				compactAt = std::max(compactAt, 2 * gathered);
+				checkMemory();
+			}
+		}
+
+		for (int iter = 0; iter < solved.size(); iter++) {
+			delete []from[iter].permutation;
+			delete []from[iter].orientation;
+			delete []to[iter].permutation;
+			delete []to[iter].orientation;
+		}
+	}
+
+	// Sort the positions found for this depth into its level, and return
+	// its size
+	long long finish(int depth) {
+		std::vector<unsigned long long> level;
+		level.swap(pending[depth]);
+		pending.erase(depth);
+		sortRecords(level, width);
+		for (int d = depth - 1; d >= 0 && d >= depth - 2*maxQTM; d--)
+			subtractRecords(level, levels[d], width);
+		levels.resize(depth + 1);
+		levels[depth].swap(level);
+		checkMemory();
+		return levels[depth].size() / width;
+	}
+
+	// Number every position with a minimal perfect hash, and give each its
+	// distance
+	void buildIndex(perfectHash &index, std::vector<unsigned char> &distance) {
+		index.build(levels, width);
+		distance.assign(index.keys, 0);
+		for (unsigned int d = 0; d < levels.size(); d++)
+			for (std::size_t i = 0; i < levels[d].size(); i += width)
+				distance[index.index(&levels[d][i])] = d;
+	}
+
+	// Print the first n positions of this depth, each with a solution that
+	// always moves to the closest neighbor (the first move of those)
+	void printAntipodes(int depth, long long n, perfectHash &index, std::vector<unsigned char> &distance) {
+		std::vector<unsigned long long> record(width);
+		Position start(solved.size()), cur(solved.size()), next(solved.size());
+		for (int iter = 0; iter < solved.size(); iter++) {
+			start[iter] = newSubstate(solved[iter].size);
+			cur[iter] = newSubstate(solved[iter].size);
+			next[iter] = newSubstate(solved[iter].size);
+		}
+		for (long long a = 0; a < n && a * width < (long long)levels[depth].size(); a++) {
+			unpack(&levels[depth][a * width], start);
+			unpack(&levels[depth][a * width], cur);
+			std::cout << "Antipode solved by";
+			int curDepth = depth;
+			while (curDepth > 0) {
+				int best = -1, bestDepth = curDepth;
+				MoveList::iterator moveIter;
+				for (moveIter = moves.begin(); moveIter != moves.end(); moveIter++) {
+					if (blocks.size() != 0 && !blockLegal(cur, blocks, moveIter->second.state))
+						continue;
+					applyMove(cur, next, moveIter->second.state, datasets);
+					pack(next, &record[0]);
+					if (distance[index.index(&record[0])] < bestDepth) {
+						best = moveIter->first;
+						bestDepth = distance[index.index(&record[0])];
+					}
+				}
+				applyMove(cur, next, moves[best].state, datasets);
+				for (int iter = 0; iter < solved.size(); iter++) {
+					std::copy(next[iter].permutation, next[iter].permutation + next[iter].size, cur[iter].permutation);
+					std::copy(next[iter].orientation, next[iter].orientation + next[iter].size, cur[iter].orientation);
+				}
+				curDepth = bestDepth;
+				std::cout << " " << moves[best].name;
+			}
+			std::cout << ":\n";
+			printPosition(start);
+			std::cout << "\n";
+		}
+		for (int iter = 0; iter < solved.size(); iter++) {
+			delete []start[iter].permutation;
+			delete []start[iter].orientation;
+			delete []cur[iter].permutation;
+			delete []cur[iter].orientation;
+			delete []next[iter].permutation;
+			delete []next[iter].orientation;
+		}
+	}
+};
+
+#endif